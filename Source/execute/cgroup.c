@@ -0,0 +1,235 @@
+#include "cgroup.h"
+
+#include "../util/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+
+
+#define CGROUP_DRAIN_MS 200     // time given to a killed leaf to empty before it is removed
+#define CGROUP_LEAF_NAME 64     // room left after the parent for "/pipe-<pid>-<n>"
+
+typedef struct
+{
+    char parent[MAX_PATH_SIZE];
+    bool enabled;
+    atomic_ulong next;          // leaves made, names every leaf uniquely
+    atomic_bool warned;         // limits could not be applied once already
+} CgroupState;
+
+
+// ==== Static variables ====
+
+static CgroupState cgroups = (CgroupState)
+{
+    .parent = {0},
+    .enabled = false,
+    .next = 0,
+    .warned = false,
+};
+
+
+
+// ==== Internal Helpers ====
+
+//* "<directory>/<name>" into <buf> -> false if it does not fit
+static bool join_control(char* buf, size_t size, const char* directory, const char* name)
+{
+    int length = snprintf(buf, size, "%s/%s", directory, name);
+    return length >= 0 && (size_t)length < size;
+}
+
+//* Write <text> to the control file <name> of <directory> -> success
+static bool write_control(const char* directory, const char* name, const char* text)
+{
+    char path[MAX_PATH_SIZE + 32];
+    if(!join_control(path, sizeof(path), directory, name)) return false;
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd == -1) return false;
+    size_t length = strlen(text);
+    bool written = write(fd, text, length) == (ssize_t)length;
+    close(fd);
+    return written;
+}
+
+//* Read the control file <name> of <directory> into <buffer> -> false if unreadable
+static bool read_control(const char* directory, const char* name, char* buffer, size_t size)
+{
+    char path[MAX_PATH_SIZE + 32];
+    if(!join_control(path, sizeof(path), directory, name)) return false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return false;
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if(length < 0) return false;
+    buffer[length] = '\0';
+    return true;
+}
+
+//* Value following "<key>" (up to a blank) in <text>, summed over all occurrences
+static uint64_t sum_field(const char* text, const char* key)
+{
+    uint64_t total = 0;
+    size_t length = strlen(key);
+    for(const char* at = strstr(text, key); at != NULL; at = strstr(at + length, key))
+    {
+        if(at != text && at[-1] != ' ' && at[-1] != '\n') continue;     // "user_usec" inside "nr_user_usec"
+        total += strtoull(at + length, NULL, 10);
+    }
+    return total;
+}
+
+//* Kill every process of the leaf and wait a little for it to empty
+static void kill_leaf(const char* path)
+{
+    if(!write_control(path, "cgroup.kill", "1")) return;
+
+    char events[256];
+    for(int waited = 0; waited < CGROUP_DRAIN_MS; waited++)
+    {
+        if(!read_control(path, "cgroup.events", events, sizeof(events)) || strstr(events, "populated 0") != NULL) return;
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+static void warn_limits(void)
+{
+    if(!atomic_exchange(&cgroups.warned, true))
+        log_full("Could not apply a job's limits; are the memory and cpu controllers delegated?", WARNING, EXECUTE);
+}
+
+
+
+// ==== Interface ====
+
+/*
+ * The parent must be a cgroup v2 directory pipe may write to, with no
+ * processes of its own: controllers are only handed down to leaves
+ * from there. Controllers already enabled, or refused, are left as is.
+*/
+bool init_cgroups(const char* parent)
+{
+    cgroups.enabled = false;
+    if(parent == NULL || parent[0] == '\0') return false;
+
+    // every leaf path must fit, or a truncated one would be made instead
+    if(strlen(parent) >= sizeof(cgroups.parent) - CGROUP_LEAF_NAME)
+    {
+        log_full("!job_cgroup is too long; jobs run without a cgroup.", WARNING, EXECUTE);
+        return false;
+    }
+
+    char controllers[256];
+    if(!read_control(parent, "cgroup.controllers", controllers, sizeof(controllers)))
+    {
+        log_full("!job_cgroup is not a cgroup v2 directory; jobs run without a cgroup.", WARNING, EXECUTE);
+        return false;
+    }
+    strcpy(cgroups.parent, parent);
+
+    const char* wanted[] = {"memory", "cpu", "io"};
+    for(size_t i = 0; i < sizeof(wanted) / sizeof(wanted[0]); i++)
+    {
+        char enable[16];
+        snprintf(enable, sizeof(enable), "+%s", wanted[i]);
+        if(strstr(controllers, wanted[i]) != NULL) write_control(parent, "cgroup.subtree_control", enable);
+    }
+
+    // a leaf that can be made now can be made for every job
+    char probe[MAX_PATH_SIZE];
+    int length = snprintf(probe, sizeof(probe), "%s/pipe-%ld-probe", parent, (long)getpid());
+    if(length < 0 || (size_t)length >= sizeof(probe) || (mkdir(probe, 0755) == -1 && errno != EEXIST))
+    {
+        log_full("Could not create a cgroup under !job_cgroup; jobs run without a cgroup.", WARNING, EXECUTE);
+        return false;
+    }
+    rmdir(probe);
+
+    cgroups.enabled = true;
+    return true;
+}
+
+
+bool cgroups_enabled(void)
+{
+    return cgroups.enabled;
+}
+
+
+bool open_job_cgroup(JobCgroup* group, const ShellCommand* command)
+{
+    if(group == NULL) return false;
+    group->path[0] = '\0';
+    group->procs[0] = '\0';
+    if(!cgroups.enabled) return false;
+
+    char path[MAX_PATH_SIZE];
+    int length = snprintf(path, sizeof(path), "%s/pipe-%ld-%lu", cgroups.parent, (long)getpid(), atomic_fetch_add(&cgroups.next, 1));
+    if(length < 0 || (size_t)length >= sizeof(path)) return false;
+    if(mkdir(path, 0755) == -1 && errno != EEXIST) return false;
+
+    char value[64];
+    if(command != NULL && command->memory_limit != 0)
+    {
+        snprintf(value, sizeof(value), "%ju", (uintmax_t)command->memory_limit);
+        if(!write_control(path, "memory.max", value)) warn_limits();
+    }
+    if(command != NULL && command->cpu_limit != 0)
+    {
+        uint64_t quota = (uint64_t)command->cpu_limit * CGROUP_CPU_PERIOD / 1000;
+        snprintf(value, sizeof(value), "%ju %d", (uintmax_t)(quota > 1000 ? quota : 1000), CGROUP_CPU_PERIOD);
+        if(!write_control(path, "cpu.max", value)) warn_limits();
+    }
+
+    strcpy(group->path, path);
+    join_control(group->procs, sizeof(group->procs), path, "cgroup.procs");    // procs has room for any leaf
+    return true;
+}
+
+
+/*
+ * The leaf saw the whole process tree, so its totals replace what
+ * wait4() reported for the direct child only. Processes the command
+ * left behind are killed with the leaf, which is removed either way.
+*/
+void close_job_cgroup(JobCgroup* group, CommandUsage* usage, bool kill)
+{
+    if(group == NULL || group->path[0] == '\0') return;
+
+    char stat[4096];
+    if(usage != NULL && read_control(group->path, "cpu.stat", stat, sizeof(stat)))
+    {
+        usage->user_ns = sum_field(stat, "user_usec ") * 1000;
+        usage->system_ns = sum_field(stat, "system_usec ") * 1000;
+        usage->measured = true;
+    }
+    if(usage != NULL && read_control(group->path, "memory.peak", stat, sizeof(stat)))
+    {
+        uint64_t peak = strtoull(stat, NULL, 10);
+        if(peak > usage->peak_rss) usage->peak_rss = peak;
+    }
+    if(usage != NULL && read_control(group->path, "io.stat", stat, sizeof(stat)))
+    {
+        uint64_t read = sum_field(stat, "rbytes=");
+        uint64_t written = sum_field(stat, "wbytes=");
+        if(read > usage->read_bytes) usage->read_bytes = read;
+        if(written > usage->write_bytes) usage->write_bytes = written;
+    }
+
+    if(kill) kill_leaf(group->path);
+    if(rmdir(group->path) == -1 && errno == EBUSY)
+    {
+        kill_leaf(group->path);
+        rmdir(group->path);
+    }
+    group->path[0] = '\0';
+    group->procs[0] = '\0';
+}
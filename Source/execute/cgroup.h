@@ -0,0 +1,36 @@
+#pragma once
+// Cgroup runs each command in its own cgroup v2 leaf below a parent
+// directory delegated to pipe. The leaf enforces the memory and CPU
+// limits of the command and accounts for its whole process tree,
+// including commands that went through the persistent shell.
+
+#include "../global.h"
+#include "../util/platform.h"
+#include "command.h"
+
+
+#define CGROUP_CPU_PERIOD 100000    // microseconds of the cpu.max period
+
+
+#ifndef EXECUTE_PUBLIC
+
+typedef struct
+{
+    char path[MAX_PATH_SIZE];       // the leaf, empty when the command runs without one
+    char procs[MAX_PATH_SIZE + 16]; // its cgroup.procs, a process writing "0" to it moves in
+} JobCgroup;
+
+
+//* Make a leaf for <command> and apply its limits -> false if none could be made
+bool open_job_cgroup(JobCgroup* group, const ShellCommand* command);
+//* Read the leaf's accounting into <usage>, kill what is left in it if <kill>, then remove it
+void close_job_cgroup(JobCgroup* group, CommandUsage* usage, bool kill);
+
+#endif
+
+
+//* Run commands in leaves below the cgroup v2 directory <parent> (NULL disables)
+//* -> false if it can't be used, commands then run where pipe runs
+bool init_cgroups(const char* parent);
+//* Whether init_cgroups() succeeded
+bool cgroups_enabled(void);
@@ -0,0 +1,139 @@
+#include "command.h"
+
+
+
+// ==== Internal Helpers ====
+
+//* Copy up to <count> jobs into the ring. Lock must be held.
+static size_t ring_write(CommandQueue* queue, CommandJob* const* jobs, size_t count)
+{
+    size_t written = 0;
+    while(written < count && queue->count < QUEUE_CAPACITY)
+    {
+        queue->jobs[queue->tail] = jobs[written++];
+        queue->tail = (queue->tail + 1) % QUEUE_CAPACITY;
+        queue->count++;
+    }
+
+    return written;
+}
+
+//* Copy up to <max> jobs out of the ring. Lock must be held.
+static size_t ring_read(CommandQueue* queue, CommandJob** jobs, size_t max)
+{
+    size_t read = 0;
+    while(read < max && queue->count > 0)
+    {
+        jobs[read++] = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % QUEUE_CAPACITY;
+        queue->count--;
+    }
+
+    return read;
+}
+
+
+
+// ==== Interface ====
+
+void init_queue(CommandQueue* queue)
+{
+    if(queue == NULL) return;
+
+    queue->head = 0;
+    queue->tail = 0;
+    queue->count = 0;
+
+    pthread_mutex_init(&queue->mutex_lock, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return;
+}
+
+
+void destroy_queue(CommandQueue* queue)
+{
+    if(queue == NULL) return;
+
+    pthread_mutex_destroy(&queue->mutex_lock);
+    pthread_cond_destroy(&queue->not_full);
+    return;
+}
+
+
+/*
+ * Pushes the whole batch while holding the lock, only waiting when the ring is full.
+ * Workers find the jobs through the scheduler's wake-up, not through this lane.
+*/
+size_t queue_push_batch(CommandQueue* queue, CommandJob* const* jobs, size_t count)
+{
+    if(queue == NULL || jobs == NULL) return 0;
+
+    size_t pushed = 0;
+    pthread_mutex_lock(&queue->mutex_lock);
+    while(pushed < count)
+    {
+        while(queue->count == QUEUE_CAPACITY)
+            pthread_cond_wait(&queue->not_full, &queue->mutex_lock);
+        pushed += ring_write(queue, &jobs[pushed], count - pushed);
+    }
+    pthread_mutex_unlock(&queue->mutex_lock);
+
+    return pushed;
+}
+
+
+size_t queue_try_push_batch(CommandQueue* queue, CommandJob* const* jobs, size_t count)
+{
+    if(queue == NULL || jobs == NULL) return 0;
+
+    pthread_mutex_lock(&queue->mutex_lock);
+    size_t pushed = ring_write(queue, jobs, count);
+    pthread_mutex_unlock(&queue->mutex_lock);
+
+    return pushed;
+}
+
+
+size_t queue_try_pop_batch(CommandQueue* queue, CommandJob** jobs, size_t max)
+{
+    if(queue == NULL || jobs == NULL || max == 0) return 0;
+
+    pthread_mutex_lock(&queue->mutex_lock);
+    size_t popped = ring_read(queue, jobs, max);
+    if(popped > 0) pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex_lock);
+
+    return popped;
+}
+
+
+/*
+ * Thieves take from the tail so the owner, reading from the head,
+ * keeps its oldest jobs and only contends on a nearly empty lane.
+ * Both lanes are locked in address order so two thieves never deadlock.
+*/
+size_t queue_steal(CommandQueue* victim, CommandQueue* thief, CommandJob** job, size_t max)
+{
+    if(victim == NULL || thief == NULL || job == NULL || victim == thief || max == 0) return 0;
+
+    CommandQueue* first = victim < thief ? victim : thief;
+    CommandQueue* second = victim < thief ? thief : victim;
+    pthread_mutex_lock(&first->mutex_lock);
+    pthread_mutex_lock(&second->mutex_lock);
+
+    size_t stolen = (victim->count + 1) / 2;
+    if(stolen > max) stolen = max;
+    if(stolen > QUEUE_CAPACITY - thief->count + 1) stolen = QUEUE_CAPACITY - thief->count + 1;
+    for(size_t i = 0; i < stolen; i++)
+    {
+        victim->tail = (victim->tail + QUEUE_CAPACITY - 1) % QUEUE_CAPACITY;
+        victim->count--;
+        if(i == 0) *job = victim->jobs[victim->tail];
+        else ring_write(thief, &victim->jobs[victim->tail], 1);
+    }
+    if(stolen > 0) pthread_cond_signal(&victim->not_full);
+
+    pthread_mutex_unlock(&second->mutex_lock);
+    pthread_mutex_unlock(&first->mutex_lock);
+    return stolen;
+}
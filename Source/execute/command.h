@@ -1,55 +1,132 @@
-#pragma once
-
-#include "../global.h"
-
-#include <pthread.h>
-
-
-
-typedef struct 
-{
-    const char* command;
-    const char* cwd;
-    unsigned int timeout;
-} ShellCommand;
-
-
-typedef struct
-{
-    int exit_code;
-    int signal;
-    char *stdout_buff;
-    char *stderr_buff;
-} CommandResult;
-
-
-#ifndef EXECUTE_PUBLIC
-
-typedef struct
-{
-    ShellCommand commands;
-    int head;
-    int tail;
-    int count;
-    bool global_stop;
-    // TODO: [global] halt vs abort vs stop
-
-
-    pthread_mutex_t mutex_lock;
-    pthread_cond_t not_full;    // allow main write
-    pthread_cond_t not_empty;   // allow thread reads
-} CommandQueue;
-
-#endif
-
-
-/* TODOs:
- * 1. Clean the structures used and make sure it's what we need
- * 2. Clear up the create process of said tracking structures (especially worker_tracker, creating vars in 3 different places)
- * 3. Passing error codes up the line and links
- * 4. stop vs halt vs abort clear up (local + global)
- * 5. Make the queue (it's currently very messy and not functional)
- * 6. Add queue lanes and some form of request from workers to scheduler
- * 7. Logging
- * 8. Passing down the commands and back up again.
+#pragma once
+
+#include "../global.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+
+typedef enum
+{
+    EXEC_AUTO = 0,  // spawn directly unless the command needs the shell
+    EXEC_SHELL,     // through the worker's persistent shell
+    EXEC_DIRECT,    // tokenized and spawned without a shell
+} ExecMode;
+
+
+typedef struct 
+{
+    const char* command;
+    const char* cwd;
+    unsigned int timeout;   // milliseconds, 0 for none
+    ExecMode mode;      // requested execution path
+    uint64_t memory_limit;  // bytes, enforced in the command's cgroup, 0 for none
+    unsigned int cpu_limit; // thousandths of a CPU, enforced in the command's cgroup, 0 for none
+    uint64_t weight;        // bytes it is expected to use, claimed from the throttle while it runs, 0 for none
+} ShellCommand;
+
+
+//* Milestones of a command, monotonic ns (0 if never reached)
+typedef struct
+{
+    uint64_t queued;    // submitted to the scheduler
+    uint64_t started;   // taken by a worker
+    uint64_t running;   // spawned (direct) or handed to the shell
+    uint64_t exited;    // exit status known
+    uint64_t drained;   // output copied out, about to complete
+} CommandSpan;
+
+
+//* Resources a command used, from wait4() and from its cgroup when it had one
+typedef struct
+{
+    uint64_t user_ns;
+    uint64_t system_ns;
+    uint64_t peak_rss;          // bytes
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t voluntary_switches;
+    uint64_t involuntary_switches;
+    bool measured;      // false when nothing could be read, shell commands outside a cgroup only get CPU times
+} CommandUsage;
+
+
+typedef struct
+{
+    int exit_code;
+    int signal;
+    char *stdout_buff;
+    char *stderr_buff;
+    ExecMode mode;      // path actually taken, never EXEC_AUTO
+    bool timed_out;     // killed after ShellCommand.timeout
+    unsigned int worker;    // id of the worker that ran it
+    CommandSpan span;
+    CommandUsage usage;
+} CommandResult;
+
+
+typedef size_t CommandTicket;   // handle to a submitted command, 0 is invalid
+
+//* Called from the worker thread once a command completed
+typedef void (*command_callback)(CommandTicket ticket, const CommandResult* result, void* context);
+
+
+#ifndef EXECUTE_PUBLIC
+
+#define QUEUE_CAPACITY 256  // slots in the command ring
+
+
+typedef struct
+{
+    ShellCommand command;
+    CommandResult result;
+    CommandTicket ticket;
+    uint64_t queued;    // monotonic ns at submission
+    atomic_bool done;
+    atomic_int group;   // process group of the command while it runs, 0 otherwise
+
+    command_callback callback;
+    void* context;
+} CommandJob;
+
+
+typedef struct
+{
+    CommandJob* jobs[QUEUE_CAPACITY];
+    size_t head;    // next slot to read
+    size_t tail;    // next slot to write
+    size_t count;   // occupied slots
+
+    pthread_mutex_t mutex_lock;
+    pthread_cond_t not_full;    // allow main write
+} CommandQueue;
+
+
+void init_queue(CommandQueue* queue);
+void destroy_queue(CommandQueue* queue);
+
+//* Push <count> jobs under a single lock -> number of jobs pushed
+size_t queue_push_batch(CommandQueue* queue, CommandJob* const* jobs, size_t count);
+//* Non-blocking push of up to <count> jobs -> number of jobs pushed
+size_t queue_try_push_batch(CommandQueue* queue, CommandJob* const* jobs, size_t count);
+//* Non-blocking pop of up to <max> jobs from the head -> number of jobs popped
+size_t queue_try_pop_batch(CommandQueue* queue, CommandJob** jobs, size_t max);
+//* Move up to half of <victim>'s jobs (at most <max>) from its tail:
+//* the first lands in <job>, the rest in <thief> -> number of jobs stolen
+size_t queue_steal(CommandQueue* victim, CommandQueue* thief, CommandJob** job, size_t max);
+
+#endif
+
+
+/* TODOs:
+ * 1. Clean the structures used and make sure it's what we need
+ * 2. Clear up the create process of said tracking structures (especially worker_tracker, creating vars in 3 different places)
+ * 3. Passing error codes up the line and links
+ * 4. stop vs halt vs abort clear up (local + global)
+ * 5. Make the queue (DONE)
+ * 6. Add queue lanes and some form of request from workers to scheduler (DONE, work stealing)
+ * 7. Logging
+ * 8. Passing down the commands and back up again. (DONE, tickets)
 */
\ No newline at end of file
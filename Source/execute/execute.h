@@ -1,11 +1,13 @@
-#pragma once
-
-// Pass command to run, which feeds command to shell.
-// Run manages threads and shells
-
-#define EXECUTE_PUBLIC
-#include "command.h"
-#include "scheduler.h"
-#include "worker.h"
-#include "shell.h"
+#pragma once
+
+// Pass command to run, which feeds command to shell.
+// Run manages threads and shells
+
+#define EXECUTE_PUBLIC
+#include "command.h"
+#include "scheduler.h"
+#include "worker.h"
+#include "shell.h"
+#include "throttle.h"
+#include "cgroup.h"
 #undef EXECUTE_PUBLIC
\ No newline at end of file
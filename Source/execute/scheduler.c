@@ -1,62 +1,392 @@
-#include "scheduler.h"
-
-#include "worker.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include "../util/util.h"
-
-
-
-// ==== Static worker references ====
-static unsigned int numWorkers;
-static WorkerTracker* trackers = NULL;
-static CommandQueue command_queue;
-
-
-void init_workers(unsigned int numJobs)
-{
-    // Setup queue
-    pthread_mutex_init(&command_queue.mutex_lock, NULL);
-    pthread_cond_init(&command_queue.not_full, NULL);
-    pthread_cond_init(&command_queue.not_empty, NULL);
-
-    if(numJobs == 0) numJobs = 1;
-    numWorkers = numJobs;
-
-    trackers = (WorkerTracker*)malloc(numWorkers*sizeof(WorkerTracker));
-    if(trackers == NULL)
-    {
-        log_fatal("Could not allocate required space for workers. Stop.", SYSTEM);
-        return;
-    }
-    for(size_t workerID = 0; workerID < numWorkers; workerID++)
-    {
-        trackers[workerID] = (WorkerTracker){workerID};
-        init_worker(&trackers[workerID], &command_queue);
-        run_worker(&trackers[workerID]);
-    }
-}
-
-
-CommandResult runCommand(const ShellCommand command)
-{
-    char buff[256];
-    sprintf(buff, "(placeholder) Running command: %s", command.command);
-    log_l(buff, INFO);
-
-    // pass command on to the appropriate thread (calculations required).
-    // Thread will then manage the execution of the command with it's designated linked shell.
-
-    return (CommandResult){0, 0, NULL, NULL};
-}
-
-
-void close_workers(void)
-{
-    if(trackers == NULL) return;
-    for(size_t workerID = 0; workerID < numWorkers; workerID++)
-    {
-        close_worker(&trackers[workerID], false);
-    }
-    free(trackers);
-}
+#include "scheduler.h"
+
+#include "worker.h"
+#include "throttle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "../util/util.h"
+
+
+
+// ==== Static worker references ====
+static unsigned int numWorkers;
+static WorkerTracker* trackers = NULL;
+static WorkerPool worker_pool;
+static atomic_size_t next_lane = 0;    // round-robin dispatch cursor, callbacks may dispatch too
+
+// ==== Static job table ====
+#define JOB_PAGE_SIZE 256   // jobs never move once allocated, pages are only appended
+
+static CommandJob** job_pages = NULL;
+static size_t job_page_count = 0;
+static size_t job_count = 0;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+
+
+// ==== Internal Helpers ====
+
+//* Wake idle workers after lanes were filled or the pool was stopped
+static void wake_workers(void)
+{
+    pthread_mutex_lock(&worker_pool.idle_lock);
+    pthread_cond_broadcast(&worker_pool.work_ready);
+    pthread_mutex_unlock(&worker_pool.idle_lock);
+}
+
+
+/*
+ * Spreads the jobs in contiguous chunks over the worker lanes,
+ * one lock per lane. Uneven chunks are balanced by workers stealing.
+*/
+static size_t dispatch(CommandJob* const* jobs, size_t count)
+{
+    if(trackers == NULL || worker_pool.stop) return 0;
+
+    size_t chunk = (count + numWorkers - 1) / numWorkers;
+
+    size_t queued = 0;
+    while(queued < count)
+    {
+        CommandQueue* lane = &trackers[atomic_fetch_add(&next_lane, 1) % numWorkers].lane;
+
+        size_t size = count - queued;
+        if(size > chunk) size = chunk;
+        atomic_fetch_add(&worker_pool.pending, size);   // before the push, workers may pop right away
+        size_t pushed = queue_try_push_batch(lane, &jobs[queued], size);
+        if(pushed == 0)     // every lane may be full: let workers drain, then wait on this one
+        {
+            wake_workers();
+            pushed = queue_push_batch(lane, &jobs[queued], size);
+        }
+        queued += pushed;
+        if(pushed < size)
+        {
+            atomic_fetch_sub(&worker_pool.pending, size - pushed);
+            break;
+        }
+    }
+
+    wake_workers();
+    return queued;
+}
+
+
+//* Find the job behind a ticket. Lock must be held.
+static CommandJob* find_job(CommandTicket ticket)
+{
+    if(ticket == 0 || ticket > job_count) return NULL;
+    size_t index = ticket - 1;
+    return &job_pages[index / JOB_PAGE_SIZE][index % JOB_PAGE_SIZE];
+}
+
+
+//* Reserve a job slot. Lock must be held.
+static CommandJob* new_job(const ShellCommand command, command_callback callback, void* context)
+{
+    if(job_count == job_page_count * JOB_PAGE_SIZE)
+    {
+        CommandJob** pages = realloc(job_pages, (job_page_count + 1) * sizeof(CommandJob*));
+        if(pages == NULL) return NULL;
+        job_pages = pages;
+
+        job_pages[job_page_count] = malloc(JOB_PAGE_SIZE * sizeof(CommandJob));
+        if(job_pages[job_page_count] == NULL) return NULL;
+        job_page_count++;
+    }
+
+    CommandJob* job = &job_pages[job_count / JOB_PAGE_SIZE][job_count % JOB_PAGE_SIZE];
+    job_count++;
+    *job = (CommandJob){
+        .command = command,
+        .result = {.exit_code = 0},
+        .ticket = job_count,
+        .queued = monotonic_ns(),
+        .done = false,
+        .group = 0,
+        .callback = callback,
+        .context = context,
+    };
+    return job;
+}
+
+
+//* Milliseconds between two span milestones, 0 if either was not reached
+static double span_ms(uint64_t from, uint64_t to)
+{
+    if(from == 0 || to < from) return 0.0;
+    return (double)(to - from) / 1e6;
+}
+
+
+//* Log where a finished job spent its time and what it used (VERBOSE)
+static void log_job_span(const CommandJob* job)
+{
+    const CommandSpan* span = &job->result.span;
+    const CommandUsage* usage = &job->result.usage;
+    char resources[192] = "";
+    if(usage->measured)
+        snprintf(resources, sizeof(resources), ", user %.3fms, sys %.3fms, rss %.1fMB, io %ju/%juB, switches %ju/%ju",
+                 (double)usage->user_ns / 1e6, (double)usage->system_ns / 1e6, (double)usage->peak_rss / 1048576.0,
+                 (uintmax_t)usage->read_bytes, (uintmax_t)usage->write_bytes,
+                 (uintmax_t)usage->voluntary_switches, (uintmax_t)usage->involuntary_switches);
+
+    char message[448];
+    snprintf(message, sizeof(message), "Command %zu (%s): queued %.3fms, spawn %.3fms, run %.3fms, drain %.3fms%s: %.120s",
+             job->ticket, job->result.mode == EXEC_DIRECT ? "direct" : "shell",
+             span_ms(span->queued, span->started), span_ms(span->started, span->running),
+             span_ms(span->running, span->exited), span_ms(span->exited, span->drained), resources, job->command.command);
+    log_full(message, VERBOSE, EXECUTE);
+}
+
+
+//* Free all jobs and their output buffers
+static void clear_jobs(void)
+{
+    pthread_mutex_lock(&jobs_lock);
+    for(size_t index = 0; index < job_count; index++)
+    {
+        CommandJob* job = &job_pages[index / JOB_PAGE_SIZE][index % JOB_PAGE_SIZE];
+        free(job->result.stdout_buff);
+        free(job->result.stderr_buff);
+    }
+    for(size_t page = 0; page < job_page_count; page++)
+        free(job_pages[page]);
+
+    free(job_pages);
+    job_pages = NULL;
+    job_page_count = 0;
+    job_count = 0;
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+
+
+// ==== Interface ====
+
+void init_workers(unsigned int numJobs)
+{
+    if(numJobs == 0) numJobs = 1;
+    numWorkers = numJobs;
+
+    trackers = (WorkerTracker*)malloc(numWorkers*sizeof(WorkerTracker));
+    if(trackers == NULL)
+    {
+        log_fatal("Could not allocate required space for workers. Stop.", SYSTEM);
+        return;
+    }
+
+    // Setup pool, shared by all lanes
+    worker_pool.trackers = trackers;
+    worker_pool.count = numWorkers;
+    atomic_init(&worker_pool.pending, 0);
+    atomic_init(&worker_pool.stop, false);
+    pthread_mutex_init(&worker_pool.idle_lock, NULL);
+    pthread_cond_init(&worker_pool.work_ready, NULL);
+
+    // all lanes must exist before any worker may steal from them
+    for(size_t workerID = 0; workerID < numWorkers; workerID++)
+    {
+        trackers[workerID] = (WorkerTracker){workerID};
+        init_worker(&trackers[workerID], &worker_pool);
+    }
+    for(size_t workerID = 0; workerID < numWorkers; workerID++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "worker %zu", workerID);
+        trace_track((uint32_t)workerID + 1, name);
+        run_worker(&trackers[workerID]);
+    }
+}
+
+
+CommandResult runCommand(const ShellCommand command)
+{
+    CommandTicket ticket = submit_command(command, NULL, NULL);
+    if(ticket == 0) return (CommandResult){.exit_code = -1};
+    return wait_command(ticket);
+}
+
+
+CommandTicket submit_command(const ShellCommand command, command_callback callback, void* context)
+{
+    CommandTicket ticket = 0;
+    if(submit_commands(&command, 1, callback, context, &ticket) != 1) return 0;
+    return ticket;
+}
+
+
+/*
+ * Jobs are reserved under the table lock, then handed to the lanes
+ * in one dispatch so the caller returns as soon as they are queued.
+*/
+size_t submit_commands(const ShellCommand* commands, size_t count,
+                       command_callback callback, void* context, CommandTicket* tickets)
+{
+    if(commands == NULL || count == 0) return 0;
+
+    CommandJob** jobs = malloc(count * sizeof(CommandJob*));
+    if(jobs == NULL)
+    {
+        log_l("Could not allocate required space to submit commands.", CRITICAL);
+        return 0;
+    }
+
+    size_t reserved = 0;
+    pthread_mutex_lock(&jobs_lock);
+    for(; reserved < count; reserved++)
+    {
+        jobs[reserved] = new_job(commands[reserved], callback, context);
+        if(jobs[reserved] == NULL) break;
+        if(tickets != NULL) tickets[reserved] = jobs[reserved]->ticket;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+    for(size_t index = 0; index < reserved; index++)    // before any worker can take, and release, them
+        if(jobs[index]->command.weight > 0) throttle_claim(jobs[index]->ticket, jobs[index]->command.weight);
+
+    // jobs are dispatched in order, so only the tail past <queued> may have missed a lane
+    size_t queued = dispatch(jobs, reserved);
+    if(queued < count)
+    {
+        pthread_mutex_lock(&jobs_lock);
+        for(size_t index = queued; index < reserved; index++)
+        {
+            jobs[index]->result = (CommandResult){.exit_code = -1};
+            jobs[index]->done = true;   // nothing waits forever on a job no worker will take
+        }
+        pthread_cond_broadcast(&job_done);
+        pthread_mutex_unlock(&jobs_lock);
+        for(size_t index = queued; index < reserved; index++) throttle_release(jobs[index]->ticket);
+
+        if(tickets != NULL)
+            for(size_t index = queued; index < count; index++) tickets[index] = 0;
+        log_l("Workers are stopped or out of memory; some commands were dropped.", WARNING);
+    }
+    free(jobs);
+
+    return queued;
+}
+
+
+bool poll_command(CommandTicket ticket, CommandResult* result)
+{
+    pthread_mutex_lock(&jobs_lock);
+    CommandJob* job = find_job(ticket);
+    bool done = job != NULL && job->done;
+    if(done && result != NULL) *result = job->result;
+    pthread_mutex_unlock(&jobs_lock);
+
+    return done;
+}
+
+
+CommandResult wait_command(CommandTicket ticket)
+{
+    CommandResult result = (CommandResult){.exit_code = -1};
+    wait_any(&ticket, 1, &result);
+    return result;
+}
+
+
+CommandTicket wait_any(const CommandTicket* tickets, size_t count, CommandResult* result)
+{
+    if(tickets == NULL) return 0;
+
+    pthread_mutex_lock(&jobs_lock);
+    while(true)
+    {
+        bool anyValid = false;
+        for(size_t index = 0; index < count; index++)
+        {
+            CommandJob* job = find_job(tickets[index]);
+            if(job == NULL) continue;
+            anyValid = true;
+            if(!job->done) continue;
+
+            if(result != NULL) *result = job->result;
+            pthread_mutex_unlock(&jobs_lock);
+            return job->ticket;
+        }
+
+        if(!anyValid) break;
+        pthread_cond_wait(&job_done, &jobs_lock);
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    return 0;
+}
+
+
+size_t wait_all(const CommandTicket* tickets, size_t count)
+{
+    if(tickets == NULL) return 0;
+
+    size_t failed = 0;
+    pthread_mutex_lock(&jobs_lock);
+    for(size_t index = 0; index < count; index++)
+    {
+        CommandJob* job = find_job(tickets[index]);
+        if(job == NULL) { failed++; continue; }
+        while(!job->done)
+            pthread_cond_wait(&job_done, &jobs_lock);
+        if(job->result.exit_code != 0 || job->result.signal != 0) failed++;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    return failed;
+}
+
+
+int command_group(CommandTicket ticket)
+{
+    pthread_mutex_lock(&jobs_lock);
+    CommandJob* job = find_job(ticket);
+    int group = job != NULL ? atomic_load(&job->group) : 0;
+    pthread_mutex_unlock(&jobs_lock);
+
+    return group;
+}
+
+
+void complete_job(CommandJob* job)
+{
+    if(job == NULL) return;
+    log_job_span(job);
+    throttle_release(job->ticket);
+
+    pthread_mutex_lock(&jobs_lock);
+    job->done = true;
+    pthread_cond_broadcast(&job_done);
+    pthread_mutex_unlock(&jobs_lock);
+
+    // outside the lock, so callbacks may submit follow-up commands
+    if(job->callback != NULL)
+        job->callback(job->ticket, &job->result, job->context);
+}
+
+
+void close_workers(void)
+{
+    if(trackers == NULL) return;
+    worker_pool.stop = true;    // workers drain what is left, then exit
+    wake_workers();
+    for(size_t workerID = 0; workerID < numWorkers; workerID++)
+    {
+        close_worker(&trackers[workerID], false);
+    }
+    for(size_t workerID = 0; workerID < numWorkers; workerID++)
+        destroy_queue(&trackers[workerID].lane);
+
+    free(trackers);
+    trackers = NULL;
+    pthread_mutex_destroy(&worker_pool.idle_lock);
+    pthread_cond_destroy(&worker_pool.work_ready);
+    clear_jobs();
+}
+
+
+unsigned int worker_count(void)
+{
+    return trackers != NULL ? numWorkers : 0;
+}
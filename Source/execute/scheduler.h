@@ -1,12 +1,47 @@
-#pragma once
-// Scheduler manages the input command stream and
-// dispatches the commands to the appropriate lanes (queues)
-// from which workers will pull. It listens for errors in workers
-// and halts if a fatal error occured.d
-
-#include "command.h"
-
-
-void init_workers(unsigned int numJobs);
-CommandResult runCommand(const ShellCommand command);
-void close_workers(void);
\ No newline at end of file
+#pragma once
+// Scheduler manages the input command stream and
+// dispatches the commands to the appropriate lanes (queues)
+// from which workers will pull. It listens for errors in workers
+// and halts if a fatal error occured.d
+
+#include "command.h"
+
+
+void init_workers(unsigned int numJobs);
+//* Submit and block until the command completed
+CommandResult runCommand(const ShellCommand command);
+void close_workers(void);
+//* Number of workers started by init_workers()
+unsigned int worker_count(void);
+
+//* Queue a command without waiting -> ticket (0 on failure). <callback> may be NULL.
+CommandTicket submit_command(const ShellCommand command, command_callback callback, void* context);
+//* Queue a batch of commands (e.g. a pipe's expanded mappings) -> number queued, dropped ones get ticket 0. <tickets> may be NULL.
+size_t submit_commands(const ShellCommand* commands, size_t count,
+                       command_callback callback, void* context, CommandTicket* tickets);
+
+//* Non-blocking completion check, fills <result> when done
+bool poll_command(CommandTicket ticket, CommandResult* result);
+//* Block until <ticket> completed -> its result
+CommandResult wait_command(CommandTicket ticket);
+//* Block until any of the tickets completed -> that ticket (0 if none valid)
+CommandTicket wait_any(const CommandTicket* tickets, size_t count, CommandResult* result);
+//* Block until all the tickets completed -> number of failed commands
+size_t wait_all(const CommandTicket* tickets, size_t count);
+
+
+/* Note:
+ * Results (and their output buffers) are owned by the scheduler and
+ * stay valid until close_workers(). Callbacks run on the worker thread
+ * and may submit further commands.
+ */
+
+
+#ifndef EXECUTE_PUBLIC
+
+//* Store the job result and notify waiters (worker side)
+void complete_job(CommandJob* job);
+//* Process group of the command behind <ticket> while it runs -> 0 if it is not running
+int command_group(CommandTicket ticket);
+
+#endif
\ No newline at end of file
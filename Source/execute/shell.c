@@ -1,119 +1,763 @@
-#include "shell.h"
-
-#include "../util/util.h"
-
-#include <fcntl.h>
-#include <string.h>
-#include <errno.h>
-#include <time.h>
-#include <sys/wait.h>
-
-
-Shell new_shell(void)
-{
-    // creates pipes
-    int write_pipe[2];
-    int read_pipe[2];
-    int err_pipe[2];
-    pipe(write_pipe);
-    pipe(read_pipe);
-    pipe(err_pipe);
-
-    // create the new shell
-    Shell newShell = {0};
-    newShell.shell_pid = fork();
-
-    // handle forked child
-    if(newShell.shell_pid == 0)
-    {
-        dup2(write_pipe[0], STDIN_FILENO);
-        dup2(read_pipe[1], STDOUT_FILENO);
-        dup2(read_pipe[1], STDERR_FILENO);
-
-        close(write_pipe[1]);   // avoid hanging reads because write is still open
-        close(read_pipe[0]);    // clean unused reading point
-        close(err_pipe[0]);     // clean unused reading point
-        
-        fcntl(err_pipe[1], F_SETFD, FD_CLOEXEC);    // Close write on exec success
-        setpgid(0, 0);  // make leader of a new process group ID
-        execl("/bin/sh", "sh", NULL);
-
-        // on exec failure
-        int err = errno;
-        write(err_pipe[1], &err, sizeof(err));
-        _exit(1);    // kill forked process, async-signal-safe
-    }
-
-    // handle parent process
-    close(write_pipe[0]);
-    close(read_pipe[1]);
-    close(err_pipe[1]);
-
-    newShell.shell_input = write_pipe[1];
-    newShell.shell_output = read_pipe[0];
-
-    // check that forked process spawned shell
-    int err;
-    size_t bytes = read(err_pipe[0], &err, sizeof(err));
-    close(err_pipe[0]);
-    if(bytes == 0) return newShell; // success
-
-    // child failure
-    newShell.err_code = err;
-    waitpid(newShell.shell_pid, NULL, 0);
-    newShell.shell_pid = -1;
-
-    close(newShell.shell_input);
-    close(newShell.shell_output);
-    newShell.shell_input = -1;
-    newShell.shell_output = -1;
-
-    return newShell;
-    // no log, since inside thread
-}
-
-
-// returns -1 on error (errno = 0 -> timeout), exit code otherwise
-static int waitpid_timeout(pid_t pid, unsigned int timeout)
-{
-    time_t start = time(NULL);
-    int status;
-    pid_t retpid = 0;
-    while(retpid == 0)
-    {
-        retpid = waitpid(pid, &status, WNOHANG);
-        if(retpid == -1) return -1;
-        if(time(NULL) - start >= timeout)
-        {
-            errno = 0;
-            return -1;
-        }   // timeout
-    }
-
-    return status;
-}
-
-
-int stop_shell(Shell* shell, bool force)
-{
-    if(shell == NULL) return 0;
-    int ret = 0;
-    if(!force)
-    {
-        const char* exit_cmd = "exit\n";
-        write(shell->shell_input, exit_cmd, strlen(exit_cmd));
-        close(shell->shell_input);
-        ret = waitpid_timeout(shell->shell_pid, GRACEFUL_TIMEOUT);
-    }
-
-    if(ret >= 0) return ret;
-    if(ret == -1 && errno != 0) return errno;
-    kill(-(shell->shell_pid), SIGTERM);  // graceful force
-    ret = waitpid_timeout(shell->shell_pid, FORCEFUL_TIMEOUT);
-
-    if(ret >= 0) return ret;
-    if(ret == -1 && errno != 0) return errno;
-    kill(-(shell->shell_pid), SIGKILL);
-    waitpid(shell->shell_pid, &ret, 0);
-    return ret;
-}
\ No newline at end of file
+#define _GNU_SOURCE     // pipe2, posix_spawn_file_actions_addchdir_np
+#include "shell.h"
+#include "cgroup.h"
+
+#include "../util/util.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+    #define HAS_SPAWN_CHDIR
+#endif
+
+extern char** environ;
+
+// how a capture ended
+typedef enum
+{
+    CAPTURE_DONE,       // every stream reached EOF or its end marker
+    CAPTURE_CLOSED,     // a stream closed before its end marker
+    CAPTURE_TIMEOUT,    // the deadline passed first
+} CaptureEnd;
+
+// words that only mean something to a shell
+static const char* const shell_builtins[] =
+{
+    "cd", "exit", "export", "unset", "set", "alias", "unalias", ".", "source",
+    "eval", "exec", "read", "ulimit", "umask", "shift", "trap", "wait", "return",
+    NULL
+};
+
+
+
+// ==== Internal Helpers ====
+
+//* Milliseconds left until <deadline> (monotonic ns) -> -1 if no deadline, 0 if passed
+static int remaining_ms(uint64_t deadline)
+{
+    if(deadline == 0) return -1;
+    uint64_t now = monotonic_ns();
+    if(now >= deadline) return 0;
+    uint64_t left = (deadline - now + 999999) / 1000000;   // round up, never wake early
+    return left > INT32_MAX ? INT32_MAX : (int)left;
+}
+
+//* Deadline in monotonic ns, <timeout> milliseconds from now -> 0 (none) if <timeout> is 0
+static uint64_t deadline_in(unsigned int timeout)
+{
+    if(timeout == 0) return 0;
+    return monotonic_ns() + (uint64_t)timeout * 1000000ull;
+}
+
+
+/*
+ * Waits for <pid> without spinning: a pidfd becomes readable when the child
+ * exits, so poll sleeps until then or until the timeout (milliseconds, 0 = none).
+ * Kernels without pidfd fall back to WNOHANG polling with a growing sleep.
+ * Returns the wait status, or -1 on error (errno = 0 -> timeout).
+ * <usage> (may be NULL) receives the child's resource usage once reaped.
+*/
+static int waitpid_timeout(pid_t pid, unsigned int timeout, struct rusage* usage)
+{
+    uint64_t deadline = deadline_in(timeout);
+    int status;
+
+#ifdef SYS_pidfd_open
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if(pidfd >= 0)
+    {
+        struct pollfd fd = {pidfd, POLLIN, 0};
+        int ready;
+        while((ready = poll(&fd, 1, remaining_ms(deadline))) == -1 && errno == EINTR);
+        close(pidfd);
+        if(ready == 0)
+        {
+            errno = 0;
+            return -1;
+        }   // timeout
+    }
+#endif
+
+    long sleep_ns = 100000;     // fallback only, pidfd already waited for the exit
+    pid_t retpid;
+    while((retpid = wait4(pid, &status, deadline ? WNOHANG : 0, usage)) == 0 || (retpid == -1 && errno == EINTR))
+    {
+        if(retpid == -1) continue;
+        int left = remaining_ms(deadline);
+        if(left == 0)
+        {
+            errno = 0;
+            return -1;
+        }   // timeout
+
+        if(sleep_ns > (long)left * 1000000) sleep_ns = (long)left * 1000000;
+        struct timespec pause = {0, sleep_ns};
+        nanosleep(&pause, NULL);
+        if(sleep_ns < 50000000) sleep_ns *= 2;
+    }
+    if(retpid == -1) return -1;
+
+    return status;
+}
+
+
+//* Keep parent pipe ends out of later children, so EOF is seen as soon as the command exits
+static void set_parent_end(int fd, bool nonBlocking)
+{
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if(nonBlocking) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+//* Append up to CAPTURE_LIMIT bytes, growing the buffer inside the arena
+static void stream_append(OutputStream* stream, Arena* arena, const char* data, size_t size)
+{
+    size_t kept = size;
+    if(stream->length + kept > CAPTURE_LIMIT) kept = CAPTURE_LIMIT - stream->length;
+    stream->dropped += size - kept;
+    if(kept == 0) return;
+
+    if(stream->length + kept + 1 > stream->capacity)
+    {
+        size_t capacity = stream->capacity ? stream->capacity * 2 : READ_CHUNK;
+        while(capacity < stream->length + kept + 1) capacity *= 2;
+
+        char* grown = (char*)arena_alloc(arena, capacity);
+        if(grown == NULL)
+        {
+            stream->dropped += kept;
+            return;
+        }
+        if(stream->length > 0) memcpy(grown, stream->data, stream->length);
+        stream->data = grown;
+        stream->capacity = capacity;
+    }
+
+    memcpy(&stream->data[stream->length], data, kept);
+    stream->length += kept;
+    stream->data[stream->length] = '\0';
+}
+
+
+//* Stream every complete, not yet logged line
+static void stream_log_lines(OutputStream* stream, LogLevel level, bool flush)
+{
+    while(stream->logged < stream->length)
+    {
+        char* start = &stream->data[stream->logged];
+        char* end = memchr(start, '\n', stream->length - stream->logged);
+        if(end == NULL && !flush) return;
+        if(end == NULL) end = &stream->data[stream->length];
+
+        char saved = *end;
+        *end = '\0';
+        log_full(start, level, EXECUTE);
+        *end = saved;
+
+        stream->logged = end - stream->data + (saved == '\n');
+    }
+}
+
+
+/*
+ * Feeds a chunk through the end-marker matcher. Bytes that might start the
+ * marker are held back until they either complete it or turn out to be output,
+ * so a marker split across two reads is still found. Returns true once framed.
+*/
+static bool frame_feed(OutputStream* stream, Arena* arena, const char* marker, const char* data, size_t size)
+{
+    size_t markerLength = strlen(marker);
+    size_t runStart = 0;    // start of plain output not yet appended
+    for(size_t index = 0; index < size && !stream->framed; index++)
+    {
+        char c = data[index];
+        if(stream->matched == markerLength)     // inside the trailer, up to a blank line
+        {
+            if(c == '\n' && (stream->lineStart || stream->trailerLength == 0)) stream->framed = true;
+            else if(stream->trailerLength < sizeof(stream->trailer) - 1)
+                stream->trailer[stream->trailerLength++] = c;
+            stream->lineStart = c == '\n';
+            runStart = index + 1;
+            continue;
+        }
+
+        if(c == marker[stream->matched])
+        {
+            if(stream->matched == 0) stream_append(stream, arena, &data[runStart], index - runStart);
+            stream->matched++;
+            runStart = index + 1;
+            continue;
+        }
+
+        if(stream->matched > 0)     // false start, the held back bytes were output
+        {
+            stream_append(stream, arena, marker, stream->matched);
+            stream->matched = 0;
+            runStart = index;
+            if(c == marker[0])
+            {
+                stream->matched = 1;
+                runStart = index + 1;
+            }
+        }
+    }
+
+    if(!stream->framed && stream->matched == 0)
+        stream_append(stream, arena, &data[runStart], size - runStart);
+
+    stream->trailer[stream->trailerLength] = '\0';
+    return stream->framed;
+}
+
+
+/*
+ * Polls both streams and drains whatever is readable. Nothing blocks on a
+ * single stream, so a command filling its stderr pipe while we wait on
+ * stdout can't deadlock. A stream is done once <marker> was framed on it,
+ * or on EOF when <marker> is NULL. Stops at <deadline> (monotonic ns, 0 = none).
+*/
+static CaptureEnd capture_streams(int outFd, int errFd, OutputStream* out, OutputStream* err,
+                                  Arena* arena, const char* marker, uint64_t deadline)
+{
+    struct pollfd fds[2] = {{outFd, POLLIN, 0}, {errFd, POLLIN, 0}};
+    OutputStream* streams[2] = {out, err};
+    LogLevel levels[2] = {VERBOSE, INFO};
+    // stderr always reaches the log, stdout only when someone reads VERBOSE
+    bool streamLog[2] = {get_std_verbosity() == VERBOSE || get_log_verbosity() == VERBOSE, true};
+    char chunk[READ_CHUNK];
+
+    CaptureEnd end = CAPTURE_DONE;
+    size_t open = 2;
+    while(open > 0)
+    {
+        int ready = poll(fds, 2, remaining_ms(deadline));
+        if(ready == 0)
+        {
+            end = CAPTURE_TIMEOUT;
+            break;
+        }
+        if(ready == -1)
+        {
+            if(errno == EINTR) continue;
+            end = CAPTURE_CLOSED;
+            break;
+        }
+
+        for(size_t index = 0; index < 2; index++)
+        {
+            if(fds[index].fd < 0 || fds[index].revents == 0) continue;
+            OutputStream* stream = streams[index];
+
+            ssize_t bytes = read(fds[index].fd, chunk, sizeof(chunk));
+            if(bytes == -1 && (errno == EAGAIN || errno == EINTR)) continue;
+            if(bytes > 0)
+            {
+                if(marker == NULL) stream_append(stream, arena, chunk, bytes);
+                else frame_feed(stream, arena, marker, chunk, bytes);
+                if(streamLog[index]) stream_log_lines(stream, levels[index], false);
+                if(marker == NULL || !stream->framed) continue;
+            }
+            else if(marker != NULL) end = CAPTURE_CLOSED;   // shell went away mid-command
+
+            fds[index].fd = -1;     // done with this stream, poll ignores negative fds
+            open--;
+        }
+    }
+
+    for(size_t index = 0; index < 2; index++)
+        if(streamLog[index]) stream_log_lines(streams[index], levels[index], true);
+    return end;
+}
+
+
+//* Write everything, retrying short writes -> false on error
+static bool write_all(int fd, const char* data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if(written == -1 && errno == EINTR) continue;
+        if(written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+
+//* Copy <src> into <dest> with every ' escaped for a single-quoted shell word -> length written
+static size_t quote_into(char* dest, const char* src)
+{
+    size_t length = 0;
+    for(; *src != '\0'; src++)
+    {
+        if(*src != '\'')
+        {
+            dest[length++] = *src;
+            continue;
+        }
+        memcpy(&dest[length], "'\\''", 4);
+        length += 4;
+    }
+
+    return length;
+}
+
+
+//* Detach a captured stream from the arena -> heap copy or NULL if empty
+static char* detach_stream(const OutputStream* stream)
+{
+    if(stream->length == 0) return NULL;
+
+    char* copy = (char*)malloc(stream->length + 1);
+    if(copy == NULL) return NULL;
+    memcpy(copy, stream->data, stream->length + 1);
+    return copy;
+}
+
+
+
+// ==== Interface ====
+
+
+Shell new_shell(void)
+{
+    // creates pipes
+    int write_pipe[2];
+    int read_pipe[2];
+    int error_pipe[2];
+    int err_pipe[2];
+    pipe(write_pipe);
+    pipe(read_pipe);
+    pipe(error_pipe);
+    pipe(err_pipe);
+
+    // create the new shell
+    Shell newShell = {0};
+    newShell.shell_pid = fork();
+
+    // handle forked child
+    if(newShell.shell_pid == 0)
+    {
+        dup2(write_pipe[0], STDIN_FILENO);
+        dup2(read_pipe[1], STDOUT_FILENO);
+        dup2(error_pipe[1], STDERR_FILENO);
+
+        close(write_pipe[1]);   // avoid hanging reads because write is still open
+        close(read_pipe[0]);    // clean unused reading point
+        close(error_pipe[0]);   // clean unused reading point
+        close(err_pipe[0]);     // clean unused reading point
+        
+        fcntl(err_pipe[1], F_SETFD, FD_CLOEXEC);    // Close write on exec success
+        setpgid(0, 0);  // make leader of a new process group ID
+        execl("/bin/sh", "sh", NULL);
+
+        // on exec failure
+        int err = errno;
+        write(err_pipe[1], &err, sizeof(err));
+        _exit(1);    // kill forked process, async-signal-safe
+    }
+
+    // handle parent process
+    close(write_pipe[0]);
+    close(read_pipe[1]);
+    close(error_pipe[1]);
+    close(err_pipe[1]);
+
+    newShell.shell_input = write_pipe[1];
+    newShell.shell_output = read_pipe[0];
+    newShell.shell_error = error_pipe[0];
+    set_parent_end(newShell.shell_input, false);
+    set_parent_end(newShell.shell_output, true);
+    set_parent_end(newShell.shell_error, true);
+    arena_init(&newShell.arena, 0);
+
+    // check that forked process spawned shell
+    int err;
+    size_t bytes = read(err_pipe[0], &err, sizeof(err));
+    close(err_pipe[0]);
+    if(bytes == 0) return newShell; // success
+
+    // child failure
+    newShell.err_code = err;
+    waitpid(newShell.shell_pid, NULL, 0);
+    newShell.shell_pid = -1;
+
+    close(newShell.shell_input);
+    close(newShell.shell_output);
+    close(newShell.shell_error);
+    newShell.shell_input = -1;
+    newShell.shell_output = -1;
+    newShell.shell_error = -1;
+
+    return newShell;
+    // no log, since inside thread
+}
+
+
+int stop_shell(Shell* shell, bool force)
+{
+    if(shell == NULL) return 0;
+    arena_free(&shell->arena);
+    if(shell->shell_pid <= 0) return 0;
+    close(shell->shell_output);
+    close(shell->shell_error);
+
+    int ret = 0;
+    if(!force)
+    {
+        const char* exit_cmd = "exit\n";
+        write(shell->shell_input, exit_cmd, strlen(exit_cmd));
+        close(shell->shell_input);
+        ret = waitpid_timeout(shell->shell_pid, GRACEFUL_TIMEOUT, NULL);
+    }
+
+    if(ret >= 0) return ret;
+    if(ret == -1 && errno != 0) return errno;
+    kill(-(shell->shell_pid), SIGTERM);  // graceful force
+    ret = waitpid_timeout(shell->shell_pid, FORCEFUL_TIMEOUT, NULL);
+
+    if(ret >= 0) return ret;
+    if(ret == -1 && errno != 0) return errno;
+    kill(-(shell->shell_pid), SIGKILL);
+    return waitpid_timeout(shell->shell_pid, 0, NULL);
+}
+
+
+/*
+ * Splits a command on blanks into <argv> (arena-backed, NULL-terminated).
+ * Returns 0 when the command needs the shell: quoting, expansion,
+ * redirection, globbing, control operators, assignments or builtins.
+*/
+static size_t split_direct(const char* command, char** argv, Arena* arena)
+{
+    size_t argc = 0;
+    const char* word = NULL;
+    for(const char* c = command; ; c++)
+    {
+        bool blank = *c == ' ' || *c == '\t' || *c == '\0';
+        if(!blank && strchr("|&;<>()$`\\\"'*?[{}!\n", *c) != NULL) return 0;
+        if(!blank && word == NULL)
+        {
+            if(*c == '#' || *c == '~') return 0;   // comment or home expansion at word start
+            word = c;
+        }
+        if(blank && word != NULL)
+        {
+            if(argc == MAX_DIRECT_ARGS) return 0;
+            argv[argc] = arena_strndup(arena, word, c - word);
+            if(argv[argc] == NULL) return 0;
+            if(argc == 0 && strchr(argv[0], '=') != NULL) return 0;     // VAR=value prefix
+            argc++;
+            word = NULL;
+        }
+        if(*c == '\0') break;
+    }
+
+    if(argc == 0) return 0;
+    for(size_t index = 0; shell_builtins[index] != NULL; index++)
+        if(strcmp(argv[0], shell_builtins[index]) == 0) return 0;
+
+    argv[argc] = NULL;
+    return argc;
+}
+
+
+//* True if <cwd> is the current directory, which needs no chdir
+static bool is_current_dir(const char* cwd)
+{
+    return cwd == NULL || strcmp(cwd, ".") == 0 || strcmp(cwd, "./") == 0;
+}
+
+
+//* Fill <usage> from what wait4() reported
+static void read_rusage(const struct rusage* rusage, CommandUsage* usage)
+{
+    usage->user_ns = (uint64_t)rusage->ru_utime.tv_sec * 1000000000ull + (uint64_t)rusage->ru_utime.tv_usec * 1000ull;
+    usage->system_ns = (uint64_t)rusage->ru_stime.tv_sec * 1000000000ull + (uint64_t)rusage->ru_stime.tv_usec * 1000ull;
+    usage->peak_rss = (uint64_t)rusage->ru_maxrss * 1024;   // reported in KiB
+    usage->read_bytes = (uint64_t)rusage->ru_inblock * 512;  // reported in 512 byte blocks
+    usage->write_bytes = (uint64_t)rusage->ru_oublock * 512;
+    usage->voluntary_switches = (uint64_t)rusage->ru_nvcsw;
+    usage->involuntary_switches = (uint64_t)rusage->ru_nivcsw;
+    usage->measured = true;
+}
+
+
+/*
+ * Spawns argv[0] straight from the worker with posix_spawnp: no shell
+ * parse and one process less. stdin is /dev/null, stdout and stderr are
+ * captured until EOF the same way the shell path captures until its markers.
+ * With a cgroup, a small sh moves itself into it, then execs the command,
+ * so that nothing the command starts runs outside of it.
+*/
+static CommandResult spawn_exec(Shell* shell, const ShellCommand* command, char** argv, const JobCgroup* group)
+{
+    CommandResult result = (CommandResult){.exit_code = -1, .mode = EXEC_DIRECT};
+
+    int out_pipe[2];
+    int err_pipe[2];
+    if(pipe2(out_pipe, O_CLOEXEC) == -1) return result;
+    if(pipe2(err_pipe, O_CLOEXEC) == -1)
+    {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return result;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+#ifdef HAS_SPAWN_CHDIR
+    if(!is_current_dir(command->cwd))
+        posix_spawn_file_actions_addchdir_np(&actions, command->cwd);
+#endif
+
+    posix_spawnattr_t attributes;   // own process group, a timeout kills the whole tree
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    char* wrapped[MAX_DIRECT_ARGS + 5];
+    char** spawned = argv;
+    if(group->procs[0] != '\0')
+    {
+        wrapped[0] = "/bin/sh";
+        wrapped[1] = "-c";
+        wrapped[2] = "echo 0 > \"$0\" && exec \"$@\"";
+        wrapped[3] = (char*)group->procs;
+        size_t argc = 0;
+        for(; argv[argc] != NULL; argc++) wrapped[argc + 4] = argv[argc];
+        wrapped[argc + 4] = NULL;
+        spawned = wrapped;
+    }
+
+    pid_t pid;
+    uint64_t deadline = deadline_in(command->timeout);
+    int err = posix_spawnp(&pid, spawned[0], &actions, &attributes, spawned, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    result.span.running = monotonic_ns();
+    if(err == 0 && shell->group != NULL) atomic_store(shell->group, pid);
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    OutputStream out = {0};
+    OutputStream errStream = {0};
+    if(err != 0)    // report like the shell would, so results look the same either way
+    {
+        char message[512];
+        int length = snprintf(message, sizeof(message), "%s: %s\n", argv[0], strerror(err));
+        stream_append(&errStream, &shell->arena, message, length);
+        result.exit_code = err == ENOENT ? 127 : 126;
+    }
+    else
+    {
+        fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(err_pipe[0], F_SETFL, O_NONBLOCK);
+        CaptureEnd end = capture_streams(out_pipe[0], err_pipe[0], &out, &errStream, &shell->arena, NULL, deadline);
+
+        // streams may close before the exit, the deadline still holds
+        int status = -1;
+        struct rusage usage;
+        memset(&usage, 0, sizeof(usage));
+        result.timed_out = end == CAPTURE_TIMEOUT;
+        if(!result.timed_out)
+        {
+            status = waitpid_timeout(pid, deadline == 0 ? 0 : (unsigned int)remaining_ms(deadline) + 1, &usage);
+            result.timed_out = status == -1 && errno == 0;
+            if(status == -1 && errno != 0)  // not the deadline: the child can't be waited for at all
+            {
+                char message[512];
+                snprintf(message, sizeof(message), "Could not wait for '%s': %s", argv[0], strerror(errno));
+                log_full(message, WARNING, EXECUTE);
+            }
+        }
+        if(result.timed_out)
+        {
+            kill(-pid, SIGKILL);
+            status = waitpid_timeout(pid, 0, &usage);
+        }
+        if(status != -1 && WIFEXITED(status)) result.exit_code = WEXITSTATUS(status);
+        if(status != -1 && WIFSIGNALED(status)) result.signal = WTERMSIG(status);
+        read_rusage(&usage, &result.usage);
+    }
+    result.span.exited = monotonic_ns();
+    close(out_pipe[0]);
+    close(err_pipe[0]);
+
+    result.stdout_buff = detach_stream(&out);
+    result.stderr_buff = detach_stream(&errStream);
+    result.span.drained = monotonic_ns();
+    return result;
+}
+
+
+//* Parse one "<m>m<s>s" duration printed by 'times' -> ns, advancing <text>
+static uint64_t read_duration(const char** text)
+{
+    char* end;
+    uint64_t minutes = strtoull(*text, &end, 10);
+    if(*end != 'm') return 0;
+    double seconds = strtod(end + 1, &end);
+    if(*end == 's') end++;
+    *text = end;
+    return minutes * 60000000000ull + (uint64_t)(seconds * 1e9);
+}
+
+
+/*
+ * Reads the 'times' lines of a stdout trailer: the shell's own times, then
+ * the cumulative times of its reaped children. The growth since the previous
+ * command is what this one used, subshell and all.
+*/
+static void read_times(Shell* shell, const char* trailer, CommandUsage* usage)
+{
+    const char* line = strchr(trailer, '\n');
+    if(line != NULL) line = strchr(line + 1, '\n');
+    if(line == NULL) return;
+    line++;
+
+    uint64_t user = read_duration(&line);
+    while(*line == ' ') line++;
+    uint64_t system = read_duration(&line);
+    if(user < shell->children_user_ns || system < shell->children_system_ns) return;
+
+    usage->user_ns = user - shell->children_user_ns;
+    usage->system_ns = system - shell->children_system_ns;
+    usage->measured = true;
+    shell->children_user_ns = user;
+    shell->children_system_ns = system;
+}
+
+
+//* Kill and reap a shell that can no longer be trusted to frame its output
+static void drop_shell(Shell* shell)
+{
+    kill(-(shell->shell_pid), SIGKILL);
+    waitpid_timeout(shell->shell_pid, 0, NULL);
+    close(shell->shell_input);
+    close(shell->shell_output);
+    close(shell->shell_error);
+    shell->shell_pid = -1;
+}
+
+
+/*
+ * Spawns plain commands directly, otherwise issues <command> to the persistent
+ * shell following the framing protocol and captures both streams until their
+ * end markers. stdout and stderr are collected in the shell's arena, then
+ * copied out so the arena can be reset.
+*/
+CommandResult shell_exec(Shell* shell, const ShellCommand* command)
+{
+    CommandResult result = (CommandResult){.exit_code = -1, .mode = EXEC_SHELL};
+    if(shell == NULL || command == NULL || command->command == NULL) return result;
+
+    bool direct = command->mode != EXEC_SHELL;
+#ifndef HAS_SPAWN_CHDIR
+    direct = direct && is_current_dir(command->cwd);
+#endif
+    JobCgroup group;
+    open_job_cgroup(&group, command);
+
+    char* argv[MAX_DIRECT_ARGS + 1];
+    if(direct && split_direct(command->command, argv, &shell->arena) > 0)
+    {
+        result = spawn_exec(shell, command, argv, &group);
+        arena_reset(&shell->arena);
+        close_job_cgroup(&group, &result.usage, result.timed_out);
+        return result;
+    }
+    arena_reset(&shell->arena);     // drop a partial split
+
+    if(shell->shell_pid <= 0)   // restart a dead shell, keeping the worker alive
+    {
+        arena_free(&shell->arena);
+        unsigned long sequence = shell->sequence;
+        atomic_int* published = shell->group;
+        *shell = new_shell();
+        shell->sequence = sequence;
+        shell->group = published;
+        if(shell->shell_pid <= 0)
+        {
+            close_job_cgroup(&group, NULL, false);
+            return result;
+        }
+    }
+
+    const char* cwd = command->cwd != NULL ? command->cwd : ".";
+    char marker[32];
+    snprintf(marker, sizeof(marker), FRAME_MARKER "%lu", ++shell->sequence);
+
+    // single line script, every quote in cwd, command or cgroup can grow 4 times
+    size_t size = 4 * (strlen(cwd) + strlen(command->command) + strlen(group.procs)) + 2 * sizeof(marker) + 160;
+    char* script = (char*)arena_alloc(&shell->arena, size);
+    if(script == NULL)
+    {
+        close_job_cgroup(&group, NULL, false);
+        return result;
+    }
+
+    size_t length = 0;
+    length += sprintf(&script[length], "( ");
+    if(group.procs[0] != '\0')    // the subshell moves itself into the cgroup, the shell stays out
+    {
+        length += sprintf(&script[length], "{ echo 0 > '");
+        length += quote_into(&script[length], group.procs);
+        length += sprintf(&script[length], "'; } 2>/dev/null; ");
+    }
+    length += sprintf(&script[length], "cd -- '");
+    length += quote_into(&script[length], cwd);
+    length += sprintf(&script[length], "' && eval '");
+    length += quote_into(&script[length], command->command);
+    length += sprintf(&script[length], "' ) </dev/null; printf '%%s %%d\\n' '%s' \"$?\"; times; echo; printf '%%s\\n' '%s' >&2\n",
+                      marker, marker);
+
+    OutputStream out = {0};
+    OutputStream err = {0};
+    bool written = write_all(shell->shell_input, script, length);
+    result.span.running = monotonic_ns();
+    if(shell->group != NULL) atomic_store(shell->group, shell->shell_pid);   // the subshell stays in the shell's group
+    CaptureEnd end = CAPTURE_CLOSED;
+    if(written)
+        end = capture_streams(shell->shell_output, shell->shell_error, &out, &err,
+                              &shell->arena, marker, deadline_in(command->timeout));
+    result.span.exited = monotonic_ns();
+
+    if(end == CAPTURE_DONE)
+    {
+        // sh reports a signal as 128 + n, the same as a plain 'exit 128+n': keep it as the exit code
+        result.exit_code = atoi(out.trailer);
+        read_times(shell, out.trailer, &result.usage);
+    }
+    else    // the command may still run inside the shell's group: only a fresh shell is safe
+    {
+        result.timed_out = end == CAPTURE_TIMEOUT;
+        if(result.timed_out) result.signal = SIGKILL;
+        drop_shell(shell);
+    }
+
+    result.stdout_buff = detach_stream(&out);
+    result.stderr_buff = detach_stream(&err);
+    arena_reset(&shell->arena);
+    close_job_cgroup(&group, &result.usage, result.timed_out);
+    result.span.drained = monotonic_ns();
+    return result;
+}
@@ -1,29 +1,75 @@
-#pragma once
-// Shell is the executor. It takes a command,
-// issues it through pipes, waits for the output
-// and returns the result back to it's linked worker.
-
-#include <unistd.h>
-#include "../global.h"
-
-
-#define GRACEFUL_TIMEOUT 2
-#define FORCEFUL_TIMEOUT 2
-
-
-#ifndef EXECUTE_PUBLIC
-
-typedef struct {
-    pid_t shell_pid;
-    int shell_input;
-    int shell_output;
-
-    char read_buff[256];
-    int err_code;
-} Shell;
-
-
-Shell new_shell(void);
-int stop_shell(Shell* shell, bool force);
-
+#pragma once
+// Shell is the executor. It takes a command,
+// issues it through pipes, waits for the output
+// and returns the result back to it's linked worker.
+
+#include <unistd.h>
+#include "../global.h"
+#include "../util/arena.h"
+#include "command.h"
+
+
+#define GRACEFUL_TIMEOUT 2000    // ms given to a shell to exit on its own
+#define FORCEFUL_TIMEOUT 2000    // ms given to a shell to exit after SIGTERM
+
+#define READ_CHUNK 4096             // bytes read per poll wakeup
+#define CAPTURE_LIMIT (1 << 20)     // bytes kept per stream, the rest is drained and dropped
+#define FRAME_MARKER "\036PIPE_END_"  // prefix of the end-of-command line, followed by a sequence number
+#define MAX_DIRECT_ARGS 256         // longer commands go through the shell
+
+
+#ifndef EXECUTE_PUBLIC
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    size_t dropped;     // bytes discarded past CAPTURE_LIMIT
+    size_t logged;      // bytes already streamed to the log
+
+    size_t matched;     // marker bytes matched so far, held back from <data>
+    char trailer[96];   // text between the marker and the blank line ending it (status and times on stdout)
+    size_t trailerLength;
+    bool lineStart;     // the trailer is at the start of a line
+    bool framed;        // end marker of the current command seen
+} OutputStream;
+
+typedef struct {
+    pid_t shell_pid;
+    int shell_input;
+    int shell_output;
+    int shell_error;
+
+    Arena arena;        // capture buffers, reset after each command
+    unsigned long sequence; // commands issued, makes every end marker unique
+    atomic_int* group;  // where the running command's process group is published, may be NULL
+    uint64_t children_user_ns;      // CPU of the commands it reaped so far, as 'times' reported it
+    uint64_t children_system_ns;
+    int err_code;
+} Shell;
+
+
+Shell new_shell(void);
+int stop_shell(Shell* shell, bool force);
+
+//* Run a command and capture stdout and stderr separately. Plain commands are
+//* spawned directly (see ExecMode), anything else goes through the persistent shell.
+//* A shell that died is restarted before the command is issued.
+CommandResult shell_exec(Shell* shell, const ShellCommand* command);
+
+
+/* Framing protocol:
+ * Every command is written to the shell as a single line
+ *     ( cd -- '<cwd>' && eval '<command>' ) </dev/null; <end markers>
+ * The shell then prints FRAME_MARKER<seq> followed by " <$?>" and the output of
+ * 'times' on stdout, and by nothing on stderr; both trailers end at a blank line.
+ * Output before the marker belongs to the command. The status is kept as the exit
+ * code: sh reports a signal as 128 + n, which a command exiting with that code
+ * can't be told apart from. The growth of the children's CPU times since the last
+ * command is its usage, at the shell's clock tick; peak RSS and I/O are only known
+ * inside a cgroup.
+ * When the command has a cgroup, the subshell first moves itself into it by
+ * writing 0 to the leaf's cgroup.procs.
+ */
+
 #endif
\ No newline at end of file
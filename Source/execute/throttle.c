@@ -0,0 +1,285 @@
+#include "throttle.h"
+
+#include "scheduler.h"
+#include "../util/util.h"
+#include "../util/pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+typedef struct
+{
+    CommandTicket ticket;
+    uint64_t weight;        // declared, or measured on an earlier run
+    uint64_t used;          // resident memory of its process group at the last sample
+} ThrottleClaim;
+
+typedef struct
+{
+    unsigned int maxJobs;
+    bool adaptive;
+
+    uint64_t sampledAt;     // monotonic ns, 0 before the first sample
+    unsigned int limit;     // last decision
+    uint64_t available;     // MemAvailable at the last sample, 0 if unknown
+
+    ThrottleClaim* claims;  // one per submitted command with a weight, until it completes
+    size_t claimCount;
+    size_t claimCapacity;
+    pthread_mutex_t lock;   // claims come and go from the submitting and the worker threads
+} ThrottleState;
+
+
+// ==== Static variables ====
+
+static ThrottleState throttle = (ThrottleState)
+{
+    .maxJobs = 1,
+    .adaptive = false,
+    .sampledAt = 0,
+    .limit = 1,
+    .available = 0,
+    .claims = NULL,
+    .claimCount = 0,
+    .claimCapacity = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+// ==== Internal Helpers ====
+
+//* Read a small /proc file into <buf> -> false if missing
+static bool read_proc(const char* path, char* buf, size_t size)
+{
+    FILE* file = fopen(path, "r");
+    if(file == NULL) return false;
+    size_t length = fread(buf, 1, size - 1, file);
+    fclose(file);
+    buf[length] = '\0';
+    return length > 0;
+}
+
+//* "avg10" of the "some" line of a pressure file -> -1 if unavailable
+static double read_pressure(const char* path)
+{
+    char buf[512];
+    if(!read_proc(path, buf, sizeof(buf))) return -1.0;
+    const char* some = strstr(buf, "some avg10=");
+    return some != NULL ? strtod(some + 11, NULL) : -1.0;
+}
+
+static uint64_t read_available_memory(void)
+{
+    char buf[4096];
+    if(!read_proc("/proc/meminfo", buf, sizeof(buf))) return 0;
+    const char* line = strstr(buf, "MemAvailable:");
+    return line != NULL ? strtoull(line + 13, NULL, 10) * 1024 : 0;
+}
+
+
+/*
+ * Sums the resident memory of every process by process group, which is
+ * where a command's whole tree runs: its own group when spawned directly,
+ * the worker shell's group otherwise. Claims of commands not running yet
+ * measure 0. Lock must be held.
+*/
+static void measure_claims(void)
+{
+    bool any = false;
+    int* groups = (int*)malloc((throttle.claimCount + 1) * sizeof(int));
+    if(groups == NULL) return;
+    for(size_t i = 0; i < throttle.claimCount; i++)
+    {
+        groups[i] = command_group(throttle.claims[i].ticket);
+        throttle.claims[i].used = 0;
+        any = any || groups[i] > 0;
+    }
+
+    DIR* proc = any ? opendir("/proc") : NULL;
+    struct dirent* entry;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    while(proc != NULL && (entry = readdir(proc)) != NULL)
+    {
+        if(!isdigit((unsigned char)entry->d_name[0])) continue;
+
+        char path[64];
+        char buf[1024];
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        if(!read_proc(path, buf, sizeof(buf))) continue;
+
+        // past the command name: the group is the 5th field of the line, the rss in pages the 24th
+        const char* field = strrchr(buf, ')');
+        int group = 0;
+        unsigned long long pages = 0;
+        if(field == NULL || sscanf(field + 1, " %*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %*llu %*llu %*d %*d %*d %*d %*d %*d %*llu %*llu %llu",
+                                   &group, &pages) != 2) continue;
+
+        for(size_t i = 0; i < throttle.claimCount; i++)
+            if(groups[i] > 0 && groups[i] == group) throttle.claims[i].used += (uint64_t)pages * (uint64_t)pageSize;
+    }
+    if(proc != NULL) closedir(proc);
+    free(groups);
+}
+
+
+/*
+ * Other processes' share of the load average is what the machine runs
+ * besides our own commands; the rest of the processors are ours. The
+ * average trails by a minute, so pressure stalls, which react within
+ * seconds, hold the count (cpu) or shed a job (memory) first.
+*/
+static void sample_host(unsigned int running)
+{
+    unsigned int limit = throttle.maxJobs;
+
+    char buf[256];
+    double load = -1.0;
+    if(read_proc("/proc/loadavg", buf, sizeof(buf))) load = strtod(buf, NULL);
+    if(load >= 0.0)
+    {
+        double others = load - (double)running;
+        unsigned int cpus = processor_count();
+        unsigned int spare = others > 0.0 ? (others >= cpus ? 1 : cpus - (unsigned int)(others + 0.5)) : cpus;
+        if(spare < limit) limit = spare;
+    }
+
+    double cpuPressure = read_pressure("/proc/pressure/cpu");
+    double memoryPressure = read_pressure("/proc/pressure/memory");
+    if(cpuPressure > CPU_PRESSURE_HOLD && running < limit) limit = running;
+    if(memoryPressure > MEMORY_PRESSURE_SHED && running > 1 && running - 1 < limit) limit = running - 1;
+
+    throttle.limit = limit > 0 ? limit : 1;
+}
+
+
+
+// ==== Interface ====
+
+void init_throttle(unsigned int maxJobs, bool adaptive)
+{
+    throttle.maxJobs = maxJobs > 0 ? maxJobs : 1;
+    throttle.adaptive = adaptive;
+    throttle.limit = throttle.maxJobs;
+    throttle.sampledAt = 0;
+    throttle.available = 0;
+}
+
+
+unsigned int throttle_limit(unsigned int running)
+{
+    if(!throttle.adaptive) return throttle.maxJobs;
+
+    uint64_t now = monotonic_ns();
+    if(throttle.sampledAt == 0 || now - throttle.sampledAt >= THROTTLE_PERIOD_MS * 1000000ull)
+    {
+        unsigned int previous = throttle.limit;
+        sample_host(running);
+        throttle.sampledAt = now;
+        if(throttle.limit != previous)
+        {
+            char buf[96];
+            snprintf(buf, sizeof(buf), "Running up to %u of %u jobs.", throttle.limit, throttle.maxJobs);
+            log_full(buf, VERBOSE, SYSTEM);
+        }
+    }
+    return throttle.limit;
+}
+
+
+/*
+ * Weights are what an action declares it needs. The memory a running
+ * command uses is already missing from MemAvailable, so each claim only
+ * counts for what its command may still grow by: its weight less what
+ * it used at the last sample. A command started since then counts whole.
+*/
+bool throttle_admit(uint64_t weight, unsigned int running)
+{
+    if(weight == 0 || running == 0) return true;    // one command always runs
+
+    pthread_mutex_lock(&throttle.lock);
+    uint64_t now = monotonic_ns();
+    if(throttle.sampledAt == 0 || throttle.available == 0 || now - throttle.sampledAt >= THROTTLE_PERIOD_MS * 1000000ull)
+    {
+        throttle.available = read_available_memory();
+        measure_claims();
+        if(throttle.adaptive) sample_host(running);
+        throttle.sampledAt = now;
+    }
+
+    uint64_t outstanding = 0;
+    for(size_t i = 0; i < throttle.claimCount; i++)
+        if(throttle.claims[i].weight > throttle.claims[i].used)
+            outstanding += throttle.claims[i].weight - throttle.claims[i].used;
+    uint64_t available = throttle.available;
+    pthread_mutex_unlock(&throttle.lock);
+    if(available == 0) return true;     // unknown, do not block
+
+    uint64_t budget = available > MEMORY_RESERVE ? available - MEMORY_RESERVE : 0;
+    return outstanding + weight <= budget;
+}
+
+
+void throttle_claim(CommandTicket ticket, uint64_t weight)
+{
+    if(ticket == 0 || weight == 0) return;
+
+    pthread_mutex_lock(&throttle.lock);
+    if(throttle.claimCount == throttle.claimCapacity)
+    {
+        size_t grown = throttle.claimCapacity ? throttle.claimCapacity * 2 : 16;
+        ThrottleClaim* claims = (ThrottleClaim*)realloc(throttle.claims, grown * sizeof(ThrottleClaim));
+        if(claims == NULL)
+        {
+            pthread_mutex_unlock(&throttle.lock);
+            return;     // unclaimed, the command is only seen through MemAvailable
+        }
+        throttle.claims = claims;
+        throttle.claimCapacity = grown;
+    }
+    throttle.claims[throttle.claimCount++] = (ThrottleClaim){ticket, weight, 0};
+    pthread_mutex_unlock(&throttle.lock);
+}
+
+
+void throttle_release(CommandTicket ticket)
+{
+    pthread_mutex_lock(&throttle.lock);
+    for(size_t i = 0; i < throttle.claimCount; i++)
+    {
+        if(throttle.claims[i].ticket != ticket) continue;
+        throttle.claims[i] = throttle.claims[--throttle.claimCount];
+        break;
+    }
+    pthread_mutex_unlock(&throttle.lock);
+}
+
+
+uint64_t parse_size(const char* text)
+{
+    if(text == NULL) return 0;
+    char* end = NULL;
+    double value = strtod(text, &end);
+    if(end == text || value <= 0.0) return 0;
+    while(*end == ' ') end++;
+
+    uint64_t unit = 1;
+    switch(*end)
+    {
+    case 'k': case 'K': unit = 1ull << 10; end++; break;
+    case 'm': case 'M': unit = 1ull << 20; end++; break;
+    case 'g': case 'G': unit = 1ull << 30; end++; break;
+    case 't': case 'T': unit = 1ull << 40; end++; break;
+    default: break;
+    }
+    if(*end == 'i') end++;
+    if(*end == 'B' || *end == 'b') end++;
+    if(*end != '\0') return 0;
+    return (uint64_t)(value * (double)unit);
+}
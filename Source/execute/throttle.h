@@ -0,0 +1,31 @@
+#pragma once
+// Throttle decides how many commands may run at once. With a fixed
+// job count it only enforces the memory weights of actions; in auto
+// mode it also follows the host: load average, pressure stall
+// information and available memory, sampled a few times a second.
+// Submitted commands claim their weight until they complete.
+
+#include "../global.h"
+#include "command.h"
+
+#include <stdint.h>
+
+
+#define THROTTLE_PERIOD_MS 250          // minimum time between two samples of /proc
+#define MEMORY_RESERVE (256ull << 20)   // bytes always left to the rest of the system
+#define CPU_PRESSURE_HOLD 40.0          // cpu "some" avg10 (%) above which no job is added
+#define MEMORY_PRESSURE_SHED 10.0       // memory "some" avg10 (%) above which jobs are shed
+
+
+//* <maxJobs> workers exist; <adaptive> follows the host load below that
+void init_throttle(unsigned int maxJobs, bool adaptive);
+//* Commands allowed to run now, <running> being in flight (at least 1)
+unsigned int throttle_limit(unsigned int running);
+//* Whether a command expected to use <weight> bytes may start while <running> commands run
+bool throttle_admit(uint64_t weight, unsigned int running);
+//* Hold <weight> bytes for the command behind <ticket> until it is released; thread-safe
+void throttle_claim(CommandTicket ticket, uint64_t weight);
+//* Drop the claim of <ticket>, if any; thread-safe
+void throttle_release(CommandTicket ticket);
+//* Parse a size such as "512M" or "2G" (K, M, G, T; bytes without suffix) -> 0 if invalid
+uint64_t parse_size(const char* text);
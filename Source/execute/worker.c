@@ -1,91 +1,158 @@
-#include "worker.h"
-
-
-#include "shell.h"
-#include "../util/util.h"
-
-#include <stddef.h>
-#include <pthread.h>
-#include <stdio.h>
-
-
-// local
-static void* worker_loop(void* arg)
-{
-    WorkerTracker* tracker = arg;
-    if(tracker == NULL) return NULL;
-
-    pthread_mutex_lock(&tracker->mutex_lock);
-
-    tracker->executor = new_shell();
-    printf("Worker %d is running.\n", tracker->id);
-    int retCode = stop_shell(&tracker->executor, false);
-
-    pthread_mutex_unlock(&tracker->mutex_lock);
-    // return &retCode;
-    return NULL;
-    // TODO: store and return ret code properly
-}
-
-
-// runs in main thread, no need for locks
-void init_worker(WorkerTracker* new_tracker, CommandQueue* command_queue)
-{
-    if(new_tracker == NULL) return;
-    
-    // trust user on tracker id
-    new_tracker->executor = (Shell){-1};
-    new_tracker->halt = true;   // default no-run
-    new_tracker->abort = false;   // default no-run
-    new_tracker->queue = command_queue;
-
-    pthread_mutex_init(&new_tracker->mutex_lock, NULL);
-    return;
-}
-
-
-bool run_worker(WorkerTracker* tracker)
-{
-    if(tracker == NULL) return false;
-    tracker->halt = false;
-
-    pthread_mutex_lock(&tracker->mutex_lock); // allow thread handle to be written
-    pthread_create(&tracker->thread_handle, NULL, worker_loop, tracker);
-    pthread_mutex_unlock(&tracker->mutex_lock);
-
-    return true;
-}
-
-
-void close_worker(WorkerTracker* worker_tracker, bool abort)
-{
-    if(worker_tracker == NULL) return;
-
-    worker_tracker->halt = true;
-    if(abort) worker_tracker->abort = true;
-    int thread_return;
-    pthread_join(worker_tracker->thread_handle, NULL);
-    printf("Worker thread closed.\n");
-    // TODO: timeout + cancel thread
-    // TODO: fetch thread exit codef properly
-
-    return;
-}
-
-// TODO: lane requesting
-
-// WorkerTracker new_worker(size_t workerID)
-// {
-//     Shell newShell = new_shell();
-//     if(newShell.shell_pid == -1)
-//         log_l("Failed to create executor shell.", CRITICAL);    // TODO: add more log info on success/failure (pid, errcode, ...)
-//     else log_l("Created new shell.", INFO);
-//     return (WorkerTracker){workerID, newShell};
-// }
-
-
-// void close_worker(WorkerTracker* worker)
-// {
-//     stop_shell(&(worker->executor), false);
-//     log_l("Shell terminated.", INFO);   // TODO: add more info on which chell was terminated
+#include "worker.h"
+
+
+#include "shell.h"
+#include "scheduler.h"
+#include "../util/util.h"
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sched.h>
+
+
+// local
+//* Take half of the first non-empty sibling lane, starting after our own id
+static bool steal_job(WorkerTracker* tracker, CommandJob** job)
+{
+    WorkerPool* pool = tracker->pool;
+    for(size_t offset = 1; offset < pool->count; offset++)
+    {
+        WorkerTracker* victim = &pool->trackers[(tracker->id + offset) % pool->count];
+        if(queue_steal(&victim->lane, &tracker->lane, job, STEAL_BATCH) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+// local
+//* Fetch the next job: own lane, then siblings, then sleep until dispatch -> false once stopped and drained
+static bool next_job(WorkerTracker* tracker, CommandJob** job)
+{
+    WorkerPool* pool = tracker->pool;
+    while(!tracker->abort)
+    {
+        if(queue_try_pop_batch(&tracker->lane, job, 1) == 1 || steal_job(tracker, job))
+        {
+            atomic_fetch_sub(&pool->pending, 1);
+            return true;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+        while(atomic_load(&pool->pending) == 0 && !pool->stop && !tracker->abort)
+            pthread_cond_wait(&pool->work_ready, &pool->idle_lock);
+        bool drained = atomic_load(&pool->pending) == 0;
+        pthread_mutex_unlock(&pool->idle_lock);
+
+        if(drained) return false;   // woken by stop or abort
+        sched_yield();  // pending commands are still being pushed to a lane
+    }
+
+    return false;
+}
+
+
+// local
+static void* worker_loop(void* arg)
+{
+    WorkerTracker* tracker = arg;
+    if(tracker == NULL) return NULL;
+
+    pthread_mutex_lock(&tracker->mutex_lock);
+
+    tracker->executor = new_shell();
+    char message[64];
+    snprintf(message, sizeof(message), "Worker %zu is running.", tracker->id);
+    log_full(message, VERBOSE, EXECUTE);
+
+    CommandJob* job;
+    while(next_job(tracker, &job))
+    {
+        uint64_t started = monotonic_ns();
+        tracker->executor.group = &job->group;
+        job->result = shell_exec(&tracker->executor, &job->command);
+        tracker->executor.group = NULL;
+        atomic_store(&job->group, 0);
+        job->result.worker = (unsigned int)tracker->id;
+        job->result.span.queued = job->queued;
+        job->result.span.started = started;
+        complete_job(job);
+    }
+
+    int retCode = stop_shell(&tracker->executor, false);
+
+    pthread_mutex_unlock(&tracker->mutex_lock);
+    // return &retCode;
+    return NULL;
+    // TODO: store and return ret code properly
+}
+
+
+// runs in main thread, no need for locks
+void init_worker(WorkerTracker* new_tracker, WorkerPool* pool)
+{
+    if(new_tracker == NULL) return;
+    
+    // trust user on tracker id
+    new_tracker->executor = (Shell){-1};
+    new_tracker->halt = true;   // default no-run
+    new_tracker->abort = false;   // default no-run
+    new_tracker->pool = pool;
+    init_queue(&new_tracker->lane);
+
+    pthread_mutex_init(&new_tracker->mutex_lock, NULL);
+    return;
+}
+
+
+bool run_worker(WorkerTracker* tracker)
+{
+    if(tracker == NULL) return false;
+    tracker->halt = false;
+
+    pthread_mutex_lock(&tracker->mutex_lock); // allow thread handle to be written
+    pthread_create(&tracker->thread_handle, NULL, worker_loop, tracker);
+    pthread_mutex_unlock(&tracker->mutex_lock);
+
+    return true;
+}
+
+
+void close_worker(WorkerTracker* worker_tracker, bool abort)
+{
+    if(worker_tracker == NULL) return;
+
+    worker_tracker->halt = true;
+    if(abort)
+    {
+        worker_tracker->abort = true;
+        pthread_mutex_lock(&worker_tracker->pool->idle_lock);
+        pthread_cond_broadcast(&worker_tracker->pool->work_ready);
+        pthread_mutex_unlock(&worker_tracker->pool->idle_lock);
+    }
+    int thread_return;
+    pthread_join(worker_tracker->thread_handle, NULL);
+    log_full("Worker thread closed.", VERBOSE, EXECUTE);
+    // TODO: timeout + cancel thread
+    // TODO: fetch thread exit codef properly
+
+    return;
+}
+
+// WorkerTracker new_worker(size_t workerID)
+// {
+//     Shell newShell = new_shell();
+//     if(newShell.shell_pid == -1)
+//         log_l("Failed to create executor shell.", CRITICAL);    // TODO: add more log info on success/failure (pid, errcode, ...)
+//     else log_l("Created new shell.", INFO);
+//     return (WorkerTracker){workerID, newShell};
+// }
+
+
+// void close_worker(WorkerTracker* worker)
+// {
+//     stop_shell(&(worker->executor), false);
+//     log_l("Shell terminated.", INFO);   // TODO: add more info on which chell was terminated
 // }
\ No newline at end of file
@@ -1,36 +1,53 @@
-#pragma once
-// A worker is a unit of execution.
-// It pulls commands from lanes and decides what gets run how.
-// It then issues those commands to shell, waiting for the output.
-
-#include "shell.h"
-#include "command.h"
-#include "../global.h"
-
-#include <stddef.h>
-#include <pthread.h>
-#include <stdatomic.h>
-
-
-#ifndef EXECUTE_PUBLIC
-
-
-typedef struct {
-    size_t id;
-    Shell executor;
-    atomic_bool halt;   // graceful, finnish the queue
-    atomic_bool abort;  // forced, stop immediatly
-    CommandQueue* queue;
-    // TODO: halt vs abort vs stop
-
-    pthread_t thread_handle;
-    pthread_mutex_t mutex_lock;
-} WorkerTracker;
-
-
-void init_worker(WorkerTracker* new_tracker, CommandQueue* command_queue);
-bool run_worker(WorkerTracker* tracker);
-void close_worker(WorkerTracker* worker_tracker, bool abort);
-
-
+#pragma once
+// A worker is a unit of execution.
+// It pulls commands from lanes and decides what gets run how.
+// It then issues those commands to shell, waiting for the output.
+
+#include "shell.h"
+#include "command.h"
+#include "../global.h"
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+#ifndef EXECUTE_PUBLIC
+
+
+#define STEAL_BATCH 16    // max commands taken from a sibling lane at once
+
+
+struct WorkerTracker;
+
+typedef struct {
+    struct WorkerTracker* trackers;
+    size_t count;
+    atomic_size_t pending;  // commands sitting in lanes, not yet taken
+    atomic_bool stop;       // no more commands will be dispatched
+
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work_ready;  // wakes idle workers on dispatch or stop
+} WorkerPool;
+
+
+typedef struct WorkerTracker {
+    size_t id;
+    Shell executor;
+    atomic_bool halt;   // graceful, finnish the queue
+    atomic_bool abort;  // forced, stop immediatly
+    CommandQueue lane;  // local deque, siblings steal from its tail
+    WorkerPool* pool;
+    // TODO: halt vs abort vs stop
+
+    pthread_t thread_handle;
+    pthread_mutex_t mutex_lock;
+} WorkerTracker;
+
+
+void init_worker(WorkerTracker* new_tracker, WorkerPool* pool);
+bool run_worker(WorkerTracker* tracker);
+void close_worker(WorkerTracker* worker_tracker, bool abort);
+
+
 #endif
\ No newline at end of file
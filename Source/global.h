@@ -1,5 +1,7 @@
-#pragma once
-#include <stdbool.h>
-#include <stddef.h>
-
-#define DEFAULT_PIPELINE "Pipeline"    // default input file name
\ No newline at end of file
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DEFAULT_PIPELINE "Pipeline"    // default input file name
+#define PIPE_DIRECTORY ".pipe"          // metadata folder (cache, logs, ...)
+#define PIPE_LOG "log"                  // log of the last run inside PIPE_DIRECTORY
\ No newline at end of file
@@ -0,0 +1,517 @@
+#include "load.h"
+
+#include "../util/util.h"
+#include "../util/hash.h"
+#include "../util/path.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*
+ * On-disk layout, native endianness:
+ *   CacheHeader
+ *   CacheEntry[count]      sorted by (key, path)
+ *   char strings[]         paths, not NUL-terminated
+ * The file is mapped read-only; changes go to an in-memory overlay
+ * and are merged into a new file on save. Mapped entries nobody looked
+ * up this run are left out then, so deleted files do not linger.
+ */
+
+
+
+// ==== Internal structures and types ====
+
+#define CACHE_MAGIC "PIPEFC\0"      // 8 bytes with the terminator
+#define OVERLAY_MIN 64              // initial overlay slots, always a power of 2
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t stringsSize;
+} CacheHeader;
+
+typedef struct
+{
+    uint64_t key;           // hash of the normalized path
+    FileRecord record;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+} CacheEntry;
+
+typedef struct
+{
+    char* path;             // NULL marks a free slot
+    uint64_t key;
+    FileRecord record;
+} OverlayEntry;
+
+typedef struct
+{
+    char* filePath;
+
+    void* mapping;
+    size_t mappingSize;
+    const CacheEntry* entries;
+    size_t count;
+    const char* strings;
+    uint8_t* seen;          // one flag per mapped entry, set by lookups; NULL keeps them all
+    size_t seenCount;
+
+    OverlayEntry* overlay;
+    size_t overlaySize;
+    size_t overlayCount;
+
+    pthread_mutex_t lock;   // hashing threads store concurrently
+} FileCache;
+
+
+// ==== Static variables ====
+
+static FileCache fileCache = (FileCache)
+{
+    .filePath = NULL,
+    .mapping = NULL,
+    .mappingSize = 0,
+    .entries = NULL,
+    .count = 0,
+    .strings = NULL,
+    .seen = NULL,
+    .seenCount = 0,
+    .overlay = NULL,
+    .overlaySize = 0,
+    .overlayCount = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+// ==== Internal Helpers ====
+
+//* Normalize <path> into <buf> and hash it -> key, 0 if the path is unusable
+static uint64_t cache_key(const char* path, char* buf, size_t size)
+{
+    if(normalize_path(path, buf, size) == NULL) return 0;
+    uint64_t key = hash_string(buf);
+    return key == 0 ? 1 : key;  // 0 is reserved
+}
+
+
+//* Index of the first mapped entry with <key>, or where it would be. Lock must be held.
+static size_t first_mapped(uint64_t key)
+{
+    size_t low = 0;
+    size_t high = fileCache.count;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(fileCache.entries[middle].key < key) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+//* Binary search of the mapped entries. Lock must be held.
+static const CacheEntry* find_mapped(uint64_t key, const char* path)
+{
+    size_t low = first_mapped(key);
+    size_t pathLength = strlen(path);
+    for(; low < fileCache.count && fileCache.entries[low].key == key; low++)
+    {
+        const CacheEntry* entry = &fileCache.entries[low];
+        if(entry->pathLength == pathLength && memcmp(&fileCache.strings[entry->pathOffset], path, pathLength) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+
+//* Flag a mapped entry as still in use, so save_cache keeps it. Lock must be held.
+static void mark_seen(const CacheEntry* entry)
+{
+    size_t index = entry - fileCache.entries;
+    if(fileCache.seen == NULL || fileCache.seen[index]) return;
+    fileCache.seen[index] = 1;
+    fileCache.seenCount++;
+}
+
+
+//* Every entry's path lies inside the strings section
+static bool validate_entries(const CacheEntry* entries, size_t count, uint64_t stringsSize)
+{
+    for(size_t i = 0; i < count; i++)
+        if((uint64_t)entries[i].pathOffset + entries[i].pathLength > stringsSize) return false;
+    return true;
+}
+
+
+//* Slot of <path> in the overlay, or the free slot it would take. Lock must be held.
+static OverlayEntry* find_overlay(uint64_t key, const char* path)
+{
+    if(fileCache.overlay == NULL) return NULL;
+
+    size_t mask = fileCache.overlaySize - 1;
+    for(size_t slot = key & mask; ; slot = (slot + 1) & mask)
+    {
+        OverlayEntry* entry = &fileCache.overlay[slot];
+        if(entry->path == NULL) return entry;
+        if(entry->key == key && strcmp(entry->path, path) == 0) return entry;
+    }
+}
+
+
+//* Overlay entry with <key>, for callers without a path string. Sets <unique>
+//* to false if several paths share the key. Lock must be held.
+static OverlayEntry* find_overlay_key(uint64_t key, bool* unique)
+{
+    *unique = true;
+    if(fileCache.overlay == NULL) return NULL;
+
+    OverlayEntry* found = NULL;
+    size_t mask = fileCache.overlaySize - 1;
+    for(size_t slot = key & mask; fileCache.overlay[slot].path != NULL; slot = (slot + 1) & mask)
+    {
+        if(fileCache.overlay[slot].key != key) continue;
+        if(found != NULL) *unique = false;
+        found = &fileCache.overlay[slot];
+    }
+    return found;
+}
+
+
+//* Double the overlay once it is 70% full. Lock must be held.
+static bool grow_overlay(void)
+{
+    if(fileCache.overlay != NULL && (fileCache.overlayCount + 1) * 10 < fileCache.overlaySize * 7)
+        return true;
+
+    size_t oldSize = fileCache.overlaySize;
+    OverlayEntry* old = fileCache.overlay;
+    size_t newSize = oldSize ? oldSize * 2 : OVERLAY_MIN;
+    OverlayEntry* grown = (OverlayEntry*)calloc(newSize, sizeof(OverlayEntry));
+    if(grown == NULL) return false;
+
+    fileCache.overlay = grown;
+    fileCache.overlaySize = newSize;
+    for(size_t slot = 0; slot < oldSize; slot++)
+        if(old[slot].path != NULL) *find_overlay(old[slot].key, old[slot].path) = old[slot];
+
+    free(old);
+    return true;
+}
+
+
+//* Insert or replace the record of the normalized <path>. Takes the lock.
+static void store_record(uint64_t key, const char* path, const FileRecord* record)
+{
+    pthread_mutex_lock(&fileCache.lock);
+    if(!grow_overlay())
+    {
+        pthread_mutex_unlock(&fileCache.lock);
+        log_full("Could not grow the file cache; record dropped.", WARNING, CACHE);
+        return;
+    }
+
+    OverlayEntry* entry = find_overlay(key, path);
+    if(entry->path == NULL)
+    {
+        entry->path = strdup(path);
+        if(entry->path == NULL)
+        {
+            pthread_mutex_unlock(&fileCache.lock);
+            return;
+        }
+        entry->key = key;
+        fileCache.overlayCount++;
+    }
+    entry->record = *record;
+    pthread_mutex_unlock(&fileCache.lock);
+}
+
+
+//* Sort merged entries by key, then path
+static const char* sortStrings = NULL;
+static int compare_entries(const void* left, const void* right)
+{
+    const CacheEntry* a = (const CacheEntry*)left;
+    const CacheEntry* b = (const CacheEntry*)right;
+    if(a->key != b->key) return a->key < b->key ? -1 : 1;
+
+    size_t length = a->pathLength < b->pathLength ? a->pathLength : b->pathLength;
+    int order = memcmp(&sortStrings[a->pathOffset], &sortStrings[b->pathOffset], length);
+    if(order != 0) return order;
+    return (a->pathLength > b->pathLength) - (a->pathLength < b->pathLength);
+}
+
+
+//* Unmap and free everything, without saving
+static void reset_cache(void)
+{
+    if(fileCache.mapping != NULL) munmap(fileCache.mapping, fileCache.mappingSize);
+    for(size_t slot = 0; slot < fileCache.overlaySize; slot++)
+        free(fileCache.overlay[slot].path);
+    free(fileCache.overlay);
+    free(fileCache.filePath);
+    free(fileCache.seen);
+
+    fileCache.filePath = NULL;
+    fileCache.mapping = NULL;
+    fileCache.mappingSize = 0;
+    fileCache.entries = NULL;
+    fileCache.count = 0;
+    fileCache.strings = NULL;
+    fileCache.seen = NULL;
+    fileCache.seenCount = 0;
+    fileCache.overlay = NULL;
+    fileCache.overlaySize = 0;
+    fileCache.overlayCount = 0;
+}
+
+
+
+// ==== Interface ====
+
+bool load_cache(const char* directory)
+{
+    if(directory == NULL) return false;
+    reset_cache();
+
+    fileStat dirStat = stat_path(directory);
+    if(!dirStat.exists && !create_dir(directory))
+    {
+        log_full("Could not create the .pipe directory; cache disabled.", WARNING, CACHE);
+        return false;
+    }
+
+    size_t length = strlen(directory) + strlen(FILE_CACHE) + 2;
+    fileCache.filePath = (char*)malloc(length);
+    if(fileCache.filePath == NULL)
+    {
+        log_fatal("Could not allocate required space for the file cache.", CACHE);
+        return false;
+    }
+    snprintf(fileCache.filePath, length, "%s/%s", directory, FILE_CACHE);
+
+    int fd = open(fileCache.filePath, O_RDONLY);
+    if(fd == -1) return true;   // first run, nothing cached yet
+
+    struct stat fileInfo;
+    if(fstat(fd, &fileInfo) == -1 || (size_t)fileInfo.st_size < sizeof(CacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) return false;
+
+    const CacheHeader* header = (const CacheHeader*)mapping;
+    const CacheEntry* entries = (const CacheEntry*)(header + 1);
+    size_t expected = sizeof(CacheHeader) + (size_t)header->count * sizeof(CacheEntry) + header->stringsSize;
+    if(memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+       header->version != FILE_CACHE_VERSION || header->stringsSize > (uint64_t)fileInfo.st_size ||
+       expected != (size_t)fileInfo.st_size || !validate_entries(entries, header->count, header->stringsSize))
+    {
+        munmap(mapping, fileInfo.st_size);
+        log_full("File cache is stale or corrupt; starting from scratch.", WARNING, CACHE);
+        return false;
+    }
+
+    fileCache.mapping = mapping;
+    fileCache.mappingSize = fileInfo.st_size;
+    fileCache.entries = entries;
+    fileCache.count = header->count;
+    fileCache.strings = (const char*)(fileCache.entries + fileCache.count);
+    fileCache.seen = (uint8_t*)calloc(fileCache.count ? fileCache.count : 1, 1);
+    return true;
+}
+
+
+bool cache_lookup(const char* path, FileRecord* record)
+{
+    char normal[MAX_PATH_SIZE];
+    uint64_t key = cache_key(path, normal, sizeof(normal));
+    if(key == 0) return false;
+
+    pthread_mutex_lock(&fileCache.lock);
+    bool found = false;
+    OverlayEntry* overlay = find_overlay(key, normal);
+    if(overlay != NULL && overlay->path != NULL)
+    {
+        found = true;
+        if(record != NULL) *record = overlay->record;
+    }
+    else
+    {
+        const CacheEntry* entry = find_mapped(key, normal);
+        found = entry != NULL;
+        if(found) mark_seen(entry);
+        if(found && record != NULL) *record = entry->record;
+    }
+    pthread_mutex_unlock(&fileCache.lock);
+
+    return found;
+}
+
+
+/*
+ * Interned paths carry the cache key already, so the lookup is a pure
+ * key search. The string is only compared, or built, when the key is
+ * held by more than one entry: an overlay entry hides the mapped entry
+ * of the same path, and keys shared by two paths need the path back.
+*/
+bool cache_lookup_id(PathID id, FileRecord* record)
+{
+    uint64_t key = path_key(id);
+    if(key == 0) return false;
+
+    pthread_mutex_lock(&fileCache.lock);
+    bool unique;
+    const OverlayEntry* overlay = find_overlay_key(key, &unique);
+    size_t first = first_mapped(key);
+    size_t mapped = 0;
+    while(first + mapped < fileCache.count && fileCache.entries[first + mapped].key == key) mapped++;
+    const CacheEntry* entry = mapped == 1 ? &fileCache.entries[first] : NULL;
+    if(mapped > 1) unique = false;
+    if(unique && overlay != NULL && entry != NULL)
+    {
+        unique = strlen(overlay->path) == entry->pathLength &&
+                 memcmp(overlay->path, &fileCache.strings[entry->pathOffset], entry->pathLength) == 0;
+        entry = NULL;
+    }
+
+    bool found = unique && (overlay != NULL || entry != NULL);
+    if(found && overlay == NULL) mark_seen(entry);
+    if(found && record != NULL) *record = overlay != NULL ? overlay->record : entry->record;
+    pthread_mutex_unlock(&fileCache.lock);
+
+    if(!unique)
+    {
+        char path[MAX_PATH_SIZE];
+        return path_string(id, path, sizeof(path)) > 0 && cache_lookup(path, record);
+    }
+    return found;
+}
+
+
+void cache_store(const char* path, const FileRecord* record)
+{
+    char normal[MAX_PATH_SIZE];
+    uint64_t key = cache_key(path, normal, sizeof(normal));
+    if(key == 0 || record == NULL) return;
+    store_record(key, normal, record);
+}
+
+
+//* Interned paths are canonical already: no normalizing nor hashing of the string
+void cache_store_id(PathID id, const FileRecord* record)
+{
+    char path[MAX_PATH_SIZE];
+    uint64_t key = path_key(id);
+    if(key == 0 || record == NULL || path_string(id, path, sizeof(path)) == 0) return;
+    store_record(key, path, record);
+}
+
+
+/*
+ * Merges the mapped entries and the overlay into a fresh file, written
+ * next to the old one and renamed over it so a crash never leaves half a cache.
+*/
+bool save_cache(void)
+{
+    if(fileCache.filePath == NULL) return false;
+    pthread_mutex_lock(&fileCache.lock);
+    // a run that looked nothing up (e.g. failed early) says nothing about what is gone
+    bool prune = fileCache.seen != NULL && fileCache.seenCount > 0;
+    if(fileCache.overlayCount == 0 && (!prune || fileCache.seenCount == fileCache.count))
+    {
+        pthread_mutex_unlock(&fileCache.lock);
+        return true;
+    }
+
+    size_t maxCount = fileCache.count + fileCache.overlayCount;
+    size_t stringsSize = (fileCache.mapping ? fileCache.mappingSize : 0);
+    for(size_t slot = 0; slot < fileCache.overlaySize; slot++)
+        if(fileCache.overlay[slot].path != NULL) stringsSize += strlen(fileCache.overlay[slot].path);
+
+    CacheEntry* entries = (CacheEntry*)malloc(maxCount * sizeof(CacheEntry) + 1);
+    char* strings = (char*)malloc(stringsSize + 1);
+    if(entries == NULL || strings == NULL)
+    {
+        pthread_mutex_unlock(&fileCache.lock);
+        free(entries);
+        free(strings);
+        log_full("Could not allocate required space to save the file cache.", CRITICAL, CACHE);
+        return false;
+    }
+
+    size_t count = 0;
+    size_t used = 0;
+    for(size_t slot = 0; slot < fileCache.overlaySize; slot++)
+    {
+        const OverlayEntry* entry = &fileCache.overlay[slot];
+        if(entry->path == NULL) continue;
+        size_t length = strlen(entry->path);
+        memcpy(&strings[used], entry->path, length);
+        entries[count++] = (CacheEntry){entry->key, entry->record, (uint32_t)used, (uint32_t)length};
+        used += length;
+    }
+    for(size_t index = 0; index < fileCache.count; index++)
+    {
+        const CacheEntry* entry = &fileCache.entries[index];
+        char normal[MAX_PATH_SIZE];
+        if(prune && !fileCache.seen[index]) continue;   // not part of the build anymore
+        if(entry->pathLength >= sizeof(normal)) continue;
+        memcpy(normal, &fileCache.strings[entry->pathOffset], entry->pathLength);
+        normal[entry->pathLength] = '\0';
+        OverlayEntry* replaced = find_overlay(entry->key, normal);
+        if(replaced != NULL && replaced->path != NULL) continue;
+
+        memcpy(&strings[used], normal, entry->pathLength);
+        entries[count] = *entry;
+        entries[count++].pathOffset = (uint32_t)used;
+        used += entry->pathLength;
+    }
+    pthread_mutex_unlock(&fileCache.lock);
+
+    sortStrings = strings;
+    qsort(entries, count, sizeof(CacheEntry), compare_entries);
+
+    CacheHeader header = {CACHE_MAGIC, FILE_CACHE_VERSION, (uint32_t)count, used};
+    char tmpPath[MAX_PATH_SIZE];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", fileCache.filePath);
+    FILE* file = fopen(tmpPath, "wb");
+    bool written = file != NULL
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries, sizeof(CacheEntry), count, file) == count
+        && fwrite(strings, 1, used, file) == used;
+    if(file != NULL && fclose(file) != 0) written = false;
+    free(entries);
+    free(strings);
+
+    if(!written || rename(tmpPath, fileCache.filePath) == -1)
+    {
+        remove(tmpPath);
+        log_full("Could not write the file cache.", WARNING, CACHE);
+        return false;
+    }
+
+    return true;
+}
+
+
+void close_cache(void)
+{
+    save_cache();
+    reset_cache();
+}
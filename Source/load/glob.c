@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include "load.h"
+
+#include "../util/util.h"
+#include "../util/pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+
+typedef struct
+{
+    char* path;         // relative to the walk root, "." for the root itself
+    size_t segment;     // next pattern segment to match below <path>
+} WalkItem;
+
+/*
+ * Directories waiting to be matched. Walkers pop an item, match its
+ * entries against one segment and push the subdirectories that can
+ * still lead to a match; everything else is pruned.
+*/
+typedef struct
+{
+    const GlobPattern* glob;
+    int rootFd;
+    GlobResult* result;
+
+    WalkItem* items;
+    size_t count;
+    size_t capacity;
+    size_t active;          // walkers busy with an item
+    bool failed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} Walk;
+
+
+
+// ==== Internal Helpers ====
+
+//* '*' matches any run of characters, everything else matches itself
+static bool match_wildcard(const char* pattern, const char* name)
+{
+    const char* star = NULL;
+    const char* resume = NULL;
+    while(*name != '\0')
+    {
+        if(*pattern == '*')
+        {
+            star = pattern++;
+            resume = name;
+        }
+        else if(*pattern == *name)
+        {
+            pattern++;
+            name++;
+        }
+        else if(star != NULL)
+        {
+            pattern = star + 1;
+            name = ++resume;
+        }
+        else return false;
+    }
+    while(*pattern == '*') pattern++;
+    return *pattern == '\0';
+}
+
+//* Hidden entries are only matched by segments that name them explicitly
+static bool match_segment(const GlobSegment* segment, const char* name)
+{
+    if(name[0] == '.' && segment->text[0] != '.') return false;
+    return match_wildcard(segment->text, name);
+}
+
+//* <path> split at separators, matched from segment <at>
+static bool match_from(const GlobPattern* glob, size_t at, const char* path)
+{
+    if(at == glob->count) return *path == '\0';
+    if(*path == '\0') return glob->segments[at].type == SEGMENT_GLOBSTAR && match_from(glob, at + 1, path);
+
+    const char* end = strchr(path, '/');
+    size_t length = end != NULL ? (size_t)(end - path) : strlen(path);
+    const char* rest = end != NULL ? end + 1 : path + length;
+    char name[MAX_PATH_SIZE];
+    if(length >= sizeof(name)) return false;
+    memcpy(name, path, length);
+    name[length] = '\0';
+
+    const GlobSegment* segment = &glob->segments[at];
+    switch(segment->type)
+    {
+        case SEGMENT_GLOBSTAR:
+            if(match_from(glob, at + 1, path)) return true;
+            return name[0] != '.' && match_from(glob, at, rest);
+        case SEGMENT_WILDCARD:
+            return match_segment(segment, name) && match_from(glob, at + 1, rest);
+        default:
+            return strcmp(segment->text, name) == 0 && match_from(glob, at + 1, rest);
+    }
+}
+
+static char* join_path(const char* dir, const char* name)
+{
+    if(dir[0] == '.' && dir[1] == '\0') return strdup(name);
+
+    size_t dirLength = strlen(dir);
+    size_t nameLength = strlen(name);
+    char* path = (char*)malloc(dirLength + nameLength + 2);
+    if(path == NULL) return NULL;
+    memcpy(path, dir, dirLength);
+    path[dirLength] = '/';
+    memcpy(&path[dirLength + 1], name, nameLength + 1);
+    return path;
+}
+
+//* Queue <path> (taken over) for matching at <segment>. Lock must not be held.
+static void push_item(Walk* walk, char* path, size_t segment)
+{
+    if(path == NULL)
+    {
+        walk->failed = true;
+        return;
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    if(walk->count == walk->capacity)
+    {
+        size_t capacity = walk->capacity ? walk->capacity * 2 : 64;
+        WalkItem* grown = (WalkItem*)realloc(walk->items, capacity * sizeof(WalkItem));
+        if(grown == NULL)
+        {
+            walk->failed = true;
+            pthread_mutex_unlock(&walk->lock);
+            free(path);
+            return;
+        }
+        walk->items = grown;
+        walk->capacity = capacity;
+    }
+    walk->items[walk->count++] = (WalkItem){path, segment};
+    pthread_cond_signal(&walk->ready);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+//* Record a match; the path is shown from the pattern's root
+static void add_match(Walk* walk, const char* path)
+{
+    pthread_mutex_lock(&walk->lock);
+    GlobResult* result = walk->result;
+    if(result->count == result->capacity)
+    {
+        size_t capacity = result->capacity ? result->capacity * 2 : 64;
+        const char** grown = (const char**)realloc(result->paths, capacity * sizeof(const char*));
+        if(grown == NULL)
+        {
+            walk->failed = true;
+            pthread_mutex_unlock(&walk->lock);
+            return;
+        }
+        result->paths = grown;
+        result->capacity = capacity;
+    }
+
+    char* copy;
+    if(walk->glob->absolute)
+    {
+        size_t length = strlen(path);
+        copy = (char*)arena_alloc(&result->arena, length + 2);
+        if(copy != NULL)
+        {
+            copy[0] = '/';
+            memcpy(&copy[1], path, length + 1);
+        }
+    }
+    else copy = arena_strndup(&result->arena, path, strlen(path));
+
+    if(copy == NULL) walk->failed = true;
+    else result->paths[result->count++] = copy;
+    pthread_mutex_unlock(&walk->lock);
+}
+
+
+static void match_listing(Walk* walk, const WalkItem* item, const DirListing* listing)
+{
+    const GlobSegment* segment = &walk->glob->segments[item->segment];
+    bool last = item->segment + 1 == walk->glob->count;
+    bool globstar = segment->type == SEGMENT_GLOBSTAR;
+
+    const char* record = listing->data;
+    for(uint32_t i = 0; i < listing->count; i++)
+    {
+        uint8_t type = (uint8_t)record[0];
+        const char* name = &record[1];
+        record = name + strlen(name) + 1;
+
+        if(globstar)
+        {
+            if(name[0] == '.') continue;
+            if(type == ENTRY_DIR) push_item(walk, join_path(item->path, name), item->segment);
+            else if(last && type == ENTRY_FILE)
+            {
+                char* path = join_path(item->path, name);
+                if(path != NULL) add_match(walk, path);
+                free(path);
+            }
+            continue;
+        }
+
+        if(!match_segment(segment, name)) continue;
+        if(!last && type != ENTRY_FILE) push_item(walk, join_path(item->path, name), item->segment + 1);
+        else if(last && type == ENTRY_FILE)
+        {
+            char* path = join_path(item->path, name);
+            if(path != NULL) add_match(walk, path);
+            free(path);
+        }
+    }
+}
+
+
+static void process_item(Walk* walk, const WalkItem* item)
+{
+    const GlobSegment* segment = &walk->glob->segments[item->segment];
+    bool last = item->segment + 1 == walk->glob->count;
+
+    // literal segments never need a listing: the next step fails on its own if the name is missing
+    if(segment->type == SEGMENT_LITERAL)
+    {
+        char* path = join_path(item->path, segment->text);
+        if(!last)
+        {
+            push_item(walk, path, item->segment + 1);
+            return;
+        }
+        struct stat info;
+        if(path != NULL && fstatat(walk->rootFd, path, &info, 0) == 0 && !S_ISDIR(info.st_mode))
+            add_match(walk, path);
+        free(path);
+        return;
+    }
+
+    // "a/**/b" also matches "a/b"
+    if(segment->type == SEGMENT_GLOBSTAR && !last) push_item(walk, strdup(item->path), item->segment + 1);
+
+    int dirFd = openat(walk->rootFd, item->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFd == -1) return;
+
+    char key[MAX_PATH_SIZE];
+    snprintf(key, sizeof(key), "%s%s", walk->glob->absolute ? "/" : "", item->path);
+    DirListing listing;
+    if(list_directory(dirFd, key, &listing))
+    {
+        match_listing(walk, item, &listing);
+        release_listing(&listing);
+    }
+    close(dirFd);
+}
+
+
+static void walk_task(size_t index, void* context)
+{
+    (void)index;
+    Walk* walk = (Walk*)context;
+
+    pthread_mutex_lock(&walk->lock);
+    for(;;)
+    {
+        while(walk->count == 0 && walk->active > 0) pthread_cond_wait(&walk->ready, &walk->lock);
+        if(walk->count == 0) break;
+
+        WalkItem item = walk->items[--walk->count];
+        walk->active++;
+        pthread_mutex_unlock(&walk->lock);
+
+        if(!walk->failed) process_item(walk, &item);
+        free(item.path);
+
+        pthread_mutex_lock(&walk->lock);
+        walk->active--;
+        if(walk->count == 0 && walk->active == 0) pthread_cond_broadcast(&walk->ready);
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return;
+}
+
+
+static int compare_paths(const void* left, const void* right)
+{
+    return strcmp(*(const char* const*)left, *(const char* const*)right);
+}
+
+
+
+// ==== Interface ====
+
+bool compile_glob(const char* pattern, GlobPattern* glob)
+{
+    memset(glob, 0, sizeof(GlobPattern));
+    if(pattern == NULL || pattern[0] == '\0') return false;
+
+    // strip the allow-empty markers before normalizing
+    size_t length = strlen(pattern);
+    char* stripped = (char*)malloc(length + 1);
+    if(stripped == NULL) return false;
+    size_t used = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        bool marker = pattern[i] == '?' && ((i > 0 && pattern[i - 1] == '*') || i + 1 == length);
+        if(marker) glob->allowEmpty = true;
+        else stripped[used++] = pattern[i];
+    }
+    stripped[used] = '\0';
+
+    glob->text = (char*)malloc(used + 2);
+    if(glob->text == NULL || normalize_path(stripped, glob->text, used + 2) == NULL)
+    {
+        free(stripped);
+        free_glob(glob);
+        return false;
+    }
+    free(stripped);
+
+    char* part = glob->text;
+    glob->absolute = part[0] == '/';
+    if(glob->absolute) part++;
+    while(*part != '\0')
+    {
+        if(glob->count == GLOB_MAX_SEGMENTS)
+        {
+            free_glob(glob);
+            return false;
+        }
+
+        char* end = strchr(part, '/');
+        if(end != NULL) *end = '\0';
+        GlobSegment* segment = &glob->segments[glob->count++];
+        segment->text = part;
+        if(strcmp(part, "**") == 0) segment->type = SEGMENT_GLOBSTAR;
+        else if(strchr(part, '*') != NULL) segment->type = SEGMENT_WILDCARD;
+        else segment->type = SEGMENT_LITERAL;
+
+        if(end == NULL) break;
+        part = end + 1;
+    }
+
+    // consecutive "**" match the same thing as one
+    size_t kept = 0;
+    for(size_t i = 0; i < glob->count; i++)
+    {
+        if(kept > 0 && glob->segments[i].type == SEGMENT_GLOBSTAR && glob->segments[kept - 1].type == SEGMENT_GLOBSTAR) continue;
+        glob->segments[kept++] = glob->segments[i];
+    }
+    glob->count = kept;
+    if(glob->count == 0)
+    {
+        free_glob(glob);
+        return false;
+    }
+    return true;
+}
+
+
+void free_glob(GlobPattern* glob)
+{
+    free(glob->text);
+    memset(glob, 0, sizeof(GlobPattern));
+}
+
+
+bool glob_match(const GlobPattern* glob, const char* path)
+{
+    char normal[MAX_PATH_SIZE];
+    if(normalize_path(path, normal, sizeof(normal)) == NULL) return false;
+    if((normal[0] == '/') != glob->absolute) return false;
+    return match_from(glob, 0, glob->absolute ? normal + 1 : normal);
+}
+
+
+bool run_glob(const GlobPattern* glob, unsigned int threads, GlobResult* result)
+{
+    memset(result, 0, sizeof(GlobResult));
+    arena_init(&result->arena, 0);
+
+    Walk walk;
+    memset(&walk, 0, sizeof(Walk));
+    walk.glob = glob;
+    walk.result = result;
+    walk.rootFd = open(glob->absolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(walk.rootFd == -1) return false;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.ready, NULL);
+
+    push_item(&walk, strdup("."), 0);
+    if(threads == 0) threads = processor_count();
+    run_parallel(threads, threads, walk_task, &walk);
+
+    for(size_t i = 0; i < walk.count; i++) free(walk.items[i].path);
+    free(walk.items);
+    close(walk.rootFd);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.ready);
+
+    // "**" next to another "**"-like segment can reach a file twice
+    qsort(result->paths, result->count, sizeof(const char*), compare_paths);
+    size_t kept = 0;
+    for(size_t i = 0; i < result->count; i++)
+        if(kept == 0 || strcmp(result->paths[kept - 1], result->paths[i]) != 0)
+            result->paths[kept++] = result->paths[i];
+    result->count = kept;
+
+    if(result->count > 0) result->ids = (PathID*)malloc(result->count * sizeof(PathID));
+    if(result->count > 0 && result->ids == NULL) walk.failed = true;
+    for(size_t i = 0; i < result->count && !walk.failed; i++)
+        if((result->ids[i] = intern_path(result->paths[i])) == PATH_NONE) walk.failed = true;
+
+    if(walk.failed) log_full("Ran out of memory while matching files.", CRITICAL, CACHE);
+    return !walk.failed;
+}
+
+
+void free_glob_result(GlobResult* result)
+{
+    free(result->paths);
+    free(result->ids);
+    arena_free(&result->arena);
+    memset(result, 0, sizeof(GlobResult));
+}
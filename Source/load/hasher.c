@@ -0,0 +1,144 @@
+#include "load.h"
+
+#include "../util/util.h"
+#include "../util/pool.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+// ==== Internal structures and types ====
+
+#define SMALL_FILE (64 * 1024)      // below this a single read beats setting up a mapping
+
+typedef struct
+{
+    const char* const* paths;
+    const PathID* ids;      // NULL if the paths were not interned
+    uint64_t* hashes;
+    atomic_size_t rehashed;
+} HashJob;
+
+
+
+// ==== Internal Helpers ====
+
+//* Hash an open file: one read for small files, a sequential mapping otherwise
+static bool hash_fd(int fd, size_t size, uint64_t* hash)
+{
+    if(size == 0)
+    {
+        *hash = hash_bytes(NULL, 0, 0);
+        return true;
+    }
+
+    if(size <= SMALL_FILE)
+    {
+        char buffer[SMALL_FILE];
+        size_t total = 0;
+        ssize_t bytes;
+        while(total < size && (bytes = read(fd, &buffer[total], size - total)) > 0)
+            total += bytes;
+        if(total != size) return false;
+        *hash = hash_bytes(buffer, size, 0);
+        return true;
+    }
+
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED) return false;
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    madvise(mapping, size, MADV_WILLNEED);
+    *hash = hash_bytes(mapping, size, 0);
+    munmap(mapping, size);
+    return true;
+}
+
+
+/*
+ * Reuses the cached hash when (mtime, size, inode) is unchanged,
+ * otherwise hashes the file and stores the fresh record.
+*/
+static void hash_task(size_t index, void* context)
+{
+    HashJob* job = (HashJob*)context;
+    const char* path = job->paths[index];
+    job->hashes[index] = 0;
+
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return;
+    struct stat info;
+    if(fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return;
+    }
+
+    FileRecord current = (FileRecord){
+        (uint64_t)info.st_mtim.tv_sec * 1000000000ull + info.st_mtim.tv_nsec,
+        (uint64_t)info.st_size, (uint64_t)info.st_ino, 0
+    };
+    FileRecord cached;
+    bool known = job->ids != NULL ? cache_lookup_id(job->ids[index], &cached) : cache_lookup(path, &cached);
+    if(known && cached.hash != 0 && cached.mtime == current.mtime &&
+       cached.size == current.size && cached.inode == current.inode)
+    {
+        close(fd);
+        job->hashes[index] = cached.hash;
+        return;
+    }
+
+    if(hash_fd(fd, current.size, &current.hash))
+    {
+        job->hashes[index] = current.hash;
+        if(job->ids != NULL) cache_store_id(job->ids[index], &current);
+        else cache_store(path, &current);
+        atomic_fetch_add(&job->rehashed, 1);
+    }
+    close(fd);
+}
+
+
+
+// ==== Interface ====
+
+bool hash_file(const char* path, uint64_t* hash)
+{
+    if(path == NULL || hash == NULL) return false;
+
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return false;
+    struct stat info;
+    bool hashed = fstat(fd, &info) == 0 && hash_fd(fd, info.st_size, hash);
+    close(fd);
+
+    return hashed;
+}
+
+
+size_t hash_files(const char* const* paths, const PathID* ids, size_t count, uint64_t* hashes, unsigned int threads)
+{
+    if(paths == NULL || hashes == NULL || count == 0) return 0;
+
+    HashJob job;
+    job.paths = paths;
+    job.ids = ids;
+    job.hashes = hashes;
+    atomic_init(&job.rehashed, 0);
+
+    run_parallel(count, threads, hash_task, &job);
+    return atomic_load(&job.rehashed);
+}
+
+
+uint64_t input_digest(const uint64_t* hashes, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+        if(hashes[i] == 0) return 0;
+
+    uint64_t digest = hash_bytes(hashes, count * sizeof(uint64_t), count);
+    return digest == 0 ? 1 : digest;    // 0 is reserved
+}
@@ -0,0 +1,548 @@
+#include "load.h"
+
+#include "../util/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+#define HISTORY_MAGIC "PIPEHI\0"    // 8 bytes with the terminator, both files
+#define HISTORY_BUFFER_MIN 4096     // initial bytes of the run's record buffer
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} HistoryHeader;
+
+//* One per run in HISTORY_INDEX, so that the last runs are found without reading the records
+typedef struct
+{
+    uint64_t offset;        // of the run's records in HISTORY_CACHE
+    uint64_t size;          // bytes of records
+    int64_t startedAt;      // seconds since the epoch
+    uint64_t duration;      // nanoseconds, whole run
+    uint32_t count;         // records stored
+    uint32_t upToDate;
+    uint32_t restored;
+    uint32_t built;
+    uint32_t failed;
+    uint32_t cancelled;
+} HistoryRun;
+
+//* One per output in HISTORY_CACHE, followed by the action then the output name
+typedef struct
+{
+    uint64_t duration;      // nanoseconds
+    uint64_t peakRss;       // bytes, 0 if unknown
+    int32_t exitCode;
+    uint8_t outcome;        // HistoryOutcome
+    uint8_t reason;         // RebuildReason
+    uint16_t actionLength;
+    uint16_t outputLength;
+    uint8_t mode;           // HistoryMode
+    uint8_t reserved;
+} HistoryRecord;
+
+typedef struct
+{
+    char* dataPath;
+    char* indexPath;
+    uint64_t startedAt;     // monotonic ns at open_history()
+    HistoryRun run;         // counters of this run, offset and size set on save
+
+    char* buffer;           // this run's records
+    size_t length;
+    size_t capacity;
+
+    pthread_mutex_t lock;   // outcomes are recorded from worker callbacks
+} HistoryLog;
+
+//* Aggregate of one action or one output over the reported runs
+typedef struct
+{
+    const char* name;
+    uint16_t length;
+    uint32_t jobs;
+    uint64_t total;         // nanoseconds
+    uint64_t peakRss;       // largest seen
+    uint64_t sequence;      // record order, the latest rebuild gives the reason
+    uint8_t reason;         // of the latest rebuild
+} HistoryEntry;
+
+
+// ==== Static variables ====
+
+static HistoryLog history = (HistoryLog)
+{
+    .dataPath = NULL,
+    .indexPath = NULL,
+    .startedAt = 0,
+    .run = {0},
+    .buffer = NULL,
+    .length = 0,
+    .capacity = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char* reasonNames[] = {"up to date", "missing", "input changed", "input rebuilt"};
+
+
+
+// ==== Internal Helpers ====
+
+//* "<directory>/<name>" on the heap
+static char* join_path(const char* directory, const char* name)
+{
+    size_t length = strlen(directory) + strlen(name) + 2;
+    char* path = (char*)malloc(length);
+    if(path != NULL) snprintf(path, length, "%s/%s", directory, name);
+    return path;
+}
+
+//* Whether <file> starts with a current header
+static bool read_header(FILE* file)
+{
+    HistoryHeader header;
+    return fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) == 0
+        && header.version == HISTORY_CACHE_VERSION;
+}
+
+/*
+ * Open <path> for appending, starting it over when its header is not
+ * current -> the file, positioned at its end, NULL on failure.
+*/
+static FILE* open_append(const char* path, bool* restarted)
+{
+    FILE* file = fopen(path, "rb+");
+    if(file != NULL && !read_header(file))
+    {
+        fclose(file);
+        file = NULL;
+    }
+    if(file == NULL)
+    {
+        *restarted = true;
+        file = fopen(path, "wb+");
+        if(file == NULL) return NULL;
+        HistoryHeader header = {HISTORY_MAGIC, HISTORY_CACHE_VERSION, 0};
+        if(fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            fclose(file);
+            return NULL;
+        }
+    }
+    fseek(file, 0, SEEK_END);
+    return file;
+}
+
+//* Room for <size> more bytes in the run's buffer. Lock must be held.
+static bool reserve(size_t size)
+{
+    if(history.length + size <= history.capacity) return true;
+
+    size_t capacity = history.capacity ? history.capacity : HISTORY_BUFFER_MIN;
+    while(capacity < history.length + size) capacity *= 2;
+    char* grown = (char*)realloc(history.buffer, capacity);
+    if(grown == NULL) return false;
+    history.buffer = grown;
+    history.capacity = capacity;
+    return true;
+}
+
+static void reset_history(void)
+{
+    free(history.dataPath);
+    free(history.indexPath);
+    free(history.buffer);
+    history.dataPath = NULL;
+    history.indexPath = NULL;
+    history.buffer = NULL;
+    history.length = 0;
+    history.capacity = 0;
+    memset(&history.run, 0, sizeof(HistoryRun));
+}
+
+//* Entry named <name> in <entries>, added if new -> NULL when out of space
+static HistoryEntry* find_entry(HistoryEntry** entries, size_t* count, size_t* capacity,
+                                const char* name, uint16_t length)
+{
+    for(size_t i = 0; i < *count; i++)
+        if((*entries)[i].length == length && memcmp((*entries)[i].name, name, length) == 0)
+            return &(*entries)[i];
+
+    if(*count == *capacity)
+    {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        HistoryEntry* list = (HistoryEntry*)realloc(*entries, grown * sizeof(HistoryEntry));
+        if(list == NULL) return NULL;
+        *entries = list;
+        *capacity = grown;
+    }
+    HistoryEntry* entry = &(*entries)[(*count)++];
+    *entry = (HistoryEntry){name, length, 0, 0, 0, 0, REBUILD_NONE};
+    return entry;
+}
+
+//* Order on name, then on sequence
+static int compare_names(const void* left, const void* right)
+{
+    const HistoryEntry* a = (const HistoryEntry*)left;
+    const HistoryEntry* b = (const HistoryEntry*)right;
+    int order = memcmp(a->name, b->name, a->length < b->length ? a->length : b->length);
+    if(order != 0) return order;
+    if(a->length != b->length) return a->length < b->length ? -1 : 1;
+    return (a->sequence > b->sequence) - (a->sequence < b->sequence);
+}
+
+//* Fold the sorted entries of equal names into one -> number of distinct names
+static size_t merge_names(HistoryEntry* entries, size_t count)
+{
+    size_t unique = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        HistoryEntry* last = unique > 0 ? &entries[unique - 1] : NULL;
+        if(last != NULL && last->length == entries[i].length && memcmp(last->name, entries[i].name, last->length) == 0)
+        {
+            last->jobs += entries[i].jobs;
+            last->total += entries[i].total;
+            last->reason = entries[i].reason;
+            continue;
+        }
+        entries[unique++] = entries[i];
+    }
+    return unique;
+}
+
+static int compare_total(const void* left, const void* right)
+{
+    uint64_t a = ((const HistoryEntry*)left)->total;
+    uint64_t b = ((const HistoryEntry*)right)->total;
+    return (a < b) - (a > b);   // largest first
+}
+
+static int compare_jobs(const void* left, const void* right)
+{
+    uint32_t a = ((const HistoryEntry*)left)->jobs;
+    uint32_t b = ((const HistoryEntry*)right)->jobs;
+    return (a < b) - (a > b);   // largest first
+}
+
+//* Nanoseconds as a short human duration
+static const char* format_duration(uint64_t duration, char* buffer, size_t size)
+{
+    double seconds = (double)duration / 1e9;
+    if(seconds < 1.0) snprintf(buffer, size, "%.0fms", seconds * 1e3);
+    else if(seconds < 120.0) snprintf(buffer, size, "%.2fs", seconds);
+    else snprintf(buffer, size, "%.1fmin", seconds / 60.0);
+    return buffer;
+}
+
+
+/*
+ * Ranks what the records of <runs> spent their time on. The records
+ * of consecutive runs are contiguous, so <data> holds them all.
+*/
+static void print_report(const HistoryRun* runs, size_t count, size_t total, const char* data, uint64_t begin)
+{
+    HistoryEntry* actions = NULL;
+    HistoryEntry* outputs = NULL;
+    size_t actionCount = 0, actionCapacity = 0;
+    size_t outputCount = 0, outputCapacity = 0;
+    uint64_t restored = 0, built = 0, failed = 0, upToDate = 0, runTotal = 0;
+    uint64_t direct = 0, shell = 0;
+
+    for(size_t r = 0; r < count; r++)
+    {
+        restored += runs[r].restored;
+        built += runs[r].built;
+        failed += runs[r].failed;
+        upToDate += runs[r].upToDate;
+        runTotal += runs[r].duration;
+
+        const char* cursor = &data[runs[r].offset - begin];
+        const char* end = cursor + runs[r].size;
+        while(cursor + sizeof(HistoryRecord) <= end)
+        {
+            HistoryRecord record;
+            memcpy(&record, cursor, sizeof(record));
+            const char* action = cursor + sizeof(record);
+            const char* output = action + record.actionLength;
+            cursor = output + record.outputLength;
+            if(cursor > end) break;
+            if(record.outcome != HISTORY_BUILT && record.outcome != HISTORY_FAILED) continue;
+            if(record.mode == HISTORY_MODE_DIRECT) direct++;
+            else if(record.mode == HISTORY_MODE_SHELL) shell++;
+
+            HistoryEntry* entry = find_entry(&actions, &actionCount, &actionCapacity, action, record.actionLength);
+            if(entry != NULL)
+            {
+                entry->jobs++;
+                entry->total += record.duration;
+                if(record.peakRss > entry->peakRss) entry->peakRss = record.peakRss;
+            }
+            // one entry per rebuild here, merged once sorted: there are many more outputs than actions
+            if(outputCount == outputCapacity)
+            {
+                size_t grown = outputCapacity ? outputCapacity * 2 : 256;
+                HistoryEntry* list = (HistoryEntry*)realloc(outputs, grown * sizeof(HistoryEntry));
+                if(list == NULL) continue;
+                outputs = list;
+                outputCapacity = grown;
+            }
+            outputs[outputCount] = (HistoryEntry){output, record.outputLength, 1, record.duration, 0, outputCount, record.reason};
+            outputCount++;
+        }
+    }
+
+    char when[64] = "?";
+    time_t startedAt = (time_t)runs[0].startedAt;
+    struct tm local;
+    if(localtime_r(&startedAt, &local) != NULL) strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &local);
+    printf("Build history: last %zu of %zu run(s), since %s\n\n", count, total, when);
+
+    uint64_t lookups = restored + built + failed;
+    printf("Cache: %ju restored, %ju built, %ju failed", (uintmax_t)restored, (uintmax_t)built, (uintmax_t)failed);
+    if(lookups > 0) printf(" -> %.1f%% hit ratio", 100.0 * (double)restored / (double)lookups);
+    printf(" (%ju up to date)\n", (uintmax_t)upToDate);
+    if(direct + shell > 0)
+        printf("Commands: %ju spawned directly, %ju through the shell\n", (uintmax_t)direct, (uintmax_t)shell);
+    printf("\n");
+
+    char text[32];
+    printf("Duration trend, oldest first:\n  ");
+    for(size_t r = 0; r < count; r++) printf("%s ", format_duration(runs[r].duration, text, sizeof(text)));
+    uint64_t mean = runTotal / count;
+    printf("\n  mean %s", format_duration(mean, text, sizeof(text)));
+    if(count > 1 && mean > 0)
+        printf(", last run %+.1f%%", 100.0 * ((double)runs[count - 1].duration - (double)mean) / (double)mean);
+    printf("\n\n");
+
+    qsort(actions, actionCount, sizeof(HistoryEntry), compare_total);
+    printf("Slowest actions (total, jobs, mean, peak RSS):\n");
+    for(size_t i = 0; i < actionCount && i < HISTORY_REPORT_TOP; i++)
+    {
+        char average[32], peak[32] = "?";
+        if(actions[i].peakRss > 0) snprintf(peak, sizeof(peak), "%.1fMB", (double)actions[i].peakRss / 1048576.0);
+        printf("  %-20.*s %10s %6u %10s %10s\n", (int)actions[i].length, actions[i].name,
+               format_duration(actions[i].total, text, sizeof(text)), actions[i].jobs,
+               format_duration(actions[i].total / actions[i].jobs, average, sizeof(average)), peak);
+    }
+    if(actionCount == 0) printf("  nothing was built\n");
+
+    qsort(outputs, outputCount, sizeof(HistoryEntry), compare_names);
+    outputCount = merge_names(outputs, outputCount);
+    qsort(outputs, outputCount, sizeof(HistoryEntry), compare_jobs);
+    printf("\nMost rebuilt outputs (rebuilds, last reason):\n");
+    for(size_t i = 0; i < outputCount && i < HISTORY_REPORT_TOP; i++)
+    {
+        const char* reason = outputs[i].reason < sizeof(reasonNames) / sizeof(reasonNames[0]) ? reasonNames[outputs[i].reason] : "?";
+        printf("  %-40.*s %6u  %s\n", (int)outputs[i].length, outputs[i].name, outputs[i].jobs, reason);
+    }
+    if(outputCount == 0) printf("  nothing was built\n");
+
+    free(actions);
+    free(outputs);
+}
+
+
+
+// ==== Interface ====
+
+bool open_history(const char* directory)
+{
+    if(directory == NULL) return false;
+    reset_history();
+
+    fileStat dirStat = stat_path(directory);
+    if(!dirStat.exists && !create_dir(directory)) return false;
+
+    history.dataPath = join_path(directory, HISTORY_CACHE);
+    history.indexPath = join_path(directory, HISTORY_INDEX);
+    if(history.dataPath == NULL || history.indexPath == NULL)
+    {
+        reset_history();
+        return false;
+    }
+    history.startedAt = monotonic_ns();
+    history.run.startedAt = (int64_t)time(NULL);
+    return true;
+}
+
+
+void record_history(const char* action, const char* output, HistoryOutcome outcome, RebuildReason reason,
+                    int exitCode, uint64_t duration, uint64_t peakRss, HistoryMode mode)
+{
+    if(action == NULL || output == NULL) return;
+
+    pthread_mutex_lock(&history.lock);
+    if(history.dataPath == NULL)
+    {
+        pthread_mutex_unlock(&history.lock);
+        return;
+    }
+
+    switch(outcome)
+    {
+    case HISTORY_UP_TO_DATE: history.run.upToDate++; break;
+    case HISTORY_RESTORED: history.run.restored++; break;
+    case HISTORY_BUILT: history.run.built++; break;
+    case HISTORY_FAILED: history.run.failed++; break;
+    case HISTORY_CANCELLED: history.run.cancelled++; break;
+    }
+
+    size_t actionLength = strnlen(action, UINT16_MAX);
+    size_t outputLength = strnlen(output, UINT16_MAX);
+    if(outcome != HISTORY_UP_TO_DATE && reserve(sizeof(HistoryRecord) + actionLength + outputLength))
+    {
+        HistoryRecord record;
+        memset(&record, 0, sizeof(record));
+        record.duration = duration;
+        record.peakRss = peakRss;
+        record.exitCode = exitCode;
+        record.outcome = (uint8_t)outcome;
+        record.reason = (uint8_t)reason;
+        record.actionLength = (uint16_t)actionLength;
+        record.outputLength = (uint16_t)outputLength;
+        record.mode = (uint8_t)mode;
+
+        char* at = &history.buffer[history.length];
+        memcpy(at, &record, sizeof(record));
+        memcpy(at + sizeof(record), action, actionLength);
+        memcpy(at + sizeof(record) + actionLength, output, outputLength);
+        history.length += sizeof(record) + actionLength + outputLength;
+        history.run.count++;
+    }
+    pthread_mutex_unlock(&history.lock);
+}
+
+
+/*
+ * Records are appended first, then the run's index entry pointing at
+ * them: a run cut short leaves unindexed bytes that no report reads.
+ * A stale or corrupt pair of files is started over.
+*/
+bool save_history(void)
+{
+    pthread_mutex_lock(&history.lock);
+    if(history.dataPath == NULL)
+    {
+        pthread_mutex_unlock(&history.lock);
+        return false;
+    }
+
+    bool restarted = false;
+    FILE* data = open_append(history.dataPath, &restarted);
+    FILE* index = data != NULL ? open_append(history.indexPath, &restarted) : NULL;
+    if(index != NULL && restarted)  // one of them was reset: the other no longer matches
+    {
+        fclose(data);
+        fclose(index);
+        remove(history.dataPath);
+        remove(history.indexPath);
+        data = open_append(history.dataPath, &restarted);
+        index = data != NULL ? open_append(history.indexPath, &restarted) : NULL;
+    }
+
+    bool saved = false;
+    if(index != NULL)   // drop a partial entry of an interrupted run, so that entries stay aligned
+    {
+        long size = ftell(index);
+        long whole = size < (long)sizeof(HistoryHeader) ? (long)sizeof(HistoryHeader)
+            : (long)(sizeof(HistoryHeader) + (size - sizeof(HistoryHeader)) / sizeof(HistoryRun) * sizeof(HistoryRun));
+        if(whole != size && (fflush(index) != 0 || ftruncate(fileno(index), whole) != 0 || fseek(index, 0, SEEK_END) != 0))
+        {
+            fclose(index);
+            index = NULL;
+        }
+    }
+    if(index != NULL)
+    {
+        long offset = ftell(data);
+        history.run.offset = offset > 0 ? (uint64_t)offset : 0;
+        history.run.size = history.length;
+        history.run.duration = monotonic_ns() - history.startedAt;
+        saved = offset > 0
+            && (history.length == 0 || fwrite(history.buffer, history.length, 1, data) == 1)
+            && fflush(data) == 0
+            && fwrite(&history.run, sizeof(HistoryRun), 1, index) == 1;
+    }
+    if(data != NULL) saved = fclose(data) == 0 && saved;
+    if(index != NULL) saved = fclose(index) == 0 && saved;
+    if(!saved) log_full("Could not save the build history.", WARNING, CACHE);
+
+    history.length = 0;     // saved once per run
+    memset(&history.run, 0, sizeof(HistoryRun));
+    pthread_mutex_unlock(&history.lock);
+    return saved;
+}
+
+
+void close_history(void)
+{
+    if(history.dataPath == NULL) return;
+    save_history();
+    pthread_mutex_lock(&history.lock);
+    reset_history();
+    pthread_mutex_unlock(&history.lock);
+}
+
+
+/*
+ * Only the index entries of the last <runs> runs are read, then their
+ * records in one read: the cost does not grow with the history.
+*/
+bool report_history(const char* directory, size_t runs)
+{
+    if(directory == NULL || runs == 0) return false;
+    char* indexPath = join_path(directory, HISTORY_INDEX);
+    char* dataPath = join_path(directory, HISTORY_CACHE);
+    FILE* index = indexPath != NULL ? fopen(indexPath, "rb") : NULL;
+    FILE* data = dataPath != NULL ? fopen(dataPath, "rb") : NULL;
+    free(indexPath);
+    free(dataPath);
+
+    HistoryRun* entries = NULL;
+    char* records = NULL;
+    bool reported = false;
+    if(index != NULL && data != NULL && read_header(index) && read_header(data))
+    {
+        fseek(index, 0, SEEK_END);
+        long size = ftell(index);
+        size_t total = size > (long)sizeof(HistoryHeader) ? ((size_t)size - sizeof(HistoryHeader)) / sizeof(HistoryRun) : 0;
+        size_t count = total < runs ? total : runs;
+        entries = (HistoryRun*)malloc((count + 1) * sizeof(HistoryRun));
+
+        bool valid = count > 0 && entries != NULL
+            && fseek(index, (long)(sizeof(HistoryHeader) + (total - count) * sizeof(HistoryRun)), SEEK_SET) == 0
+            && fread(entries, sizeof(HistoryRun), count, index) == count;
+
+        uint64_t begin = valid ? entries[0].offset : 0;
+        uint64_t end = valid ? entries[count - 1].offset + entries[count - 1].size : 0;
+        fseek(data, 0, SEEK_END);
+        long dataSize = ftell(data);
+        valid = valid && begin >= sizeof(HistoryHeader) && begin <= end && dataSize >= 0 && end <= (uint64_t)dataSize;
+        for(size_t r = 1; r < count && valid; r++)
+            valid = entries[r].offset >= entries[r - 1].offset + entries[r - 1].size && entries[r].offset + entries[r].size <= end;
+
+        if(valid) records = (char*)malloc(end - begin + 1);
+        valid = valid && records != NULL && fseek(data, (long)begin, SEEK_SET) == 0
+            && (end == begin || fread(records, end - begin, 1, data) == 1);
+        if(valid) print_report(entries, count, total, records, begin);
+        else if(count > 0) log_full("Build history is corrupt.", WARNING, CACHE);
+        reported = valid;
+    }
+    if(!reported) printf("No build history yet.\n");
+
+    if(index != NULL) fclose(index);
+    if(data != NULL) fclose(data);
+    free(entries);
+    free(records);
+    return reported;
+}
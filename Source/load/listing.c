@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include "load.h"
+
+#include "../util/util.h"
+#include "../util/hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+
+#define LISTING_MAGIC "PIPEDC\0"    // 8 bytes with the terminator
+#define LISTING_OVERLAY_MIN 64      // initial overlay slots, always a power of 2
+#define DENTS_BUFFER 32768          // getdents64 read size
+#define RACY_WINDOW_NS 1000000000ull    // listings of directories changed this recently are not kept
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t dataSize;
+} ListingHeader;
+
+typedef struct
+{
+    uint64_t key;           // hash of the directory path
+    uint64_t mtime;         // directory mtime (ns) the listing was taken at
+    uint64_t offset;        // into the data section
+    uint32_t size;
+    uint32_t count;
+} ListingEntry;
+
+typedef struct
+{
+    uint64_t key;           // 0 marks a free slot
+    uint64_t mtime;
+    char* data;
+    uint32_t size;
+    uint32_t count;
+} OverlayListing;
+
+typedef struct
+{
+    char* filePath;
+    void* mapping;
+    size_t mappingSize;
+    const ListingEntry* entries;
+    size_t count;
+    const char* data;
+
+    OverlayListing* overlay;
+    size_t overlaySize;
+    size_t overlayCount;
+
+    pthread_mutex_t lock;   // glob walkers list concurrently
+} ListingCache;
+
+// linux_dirent64, which glibc does not export
+typedef struct
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} RawDirent;
+
+
+// ==== Static variables ====
+
+static ListingCache listingCache = (ListingCache)
+{
+    .filePath = NULL,
+    .mapping = NULL,
+    .mappingSize = 0,
+    .entries = NULL,
+    .count = 0,
+    .data = NULL,
+    .overlay = NULL,
+    .overlaySize = 0,
+    .overlayCount = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+// ==== Internal Helpers ====
+
+static uint64_t listing_key(const char* path)
+{
+    char normal[MAX_PATH_SIZE];
+    uint64_t key = hash_string(normalize_path(path, normal, sizeof(normal)) != NULL ? normal : path);
+    return key == 0 ? 1 : key;  // 0 is reserved
+}
+
+
+//* Binary search of the mapped entries. Lock must be held.
+static const ListingEntry* find_mapped(uint64_t key)
+{
+    size_t low = 0;
+    size_t high = listingCache.count;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(listingCache.entries[middle].key < key) low = middle + 1;
+        else high = middle;
+    }
+    if(low < listingCache.count && listingCache.entries[low].key == key) return &listingCache.entries[low];
+    return NULL;
+}
+
+
+//* Slot of <key> in the overlay, or the free slot it would take. Lock must be held.
+static OverlayListing* find_overlay(uint64_t key)
+{
+    if(listingCache.overlay == NULL) return NULL;
+
+    size_t mask = listingCache.overlaySize - 1;
+    for(size_t slot = key & mask; ; slot = (slot + 1) & mask)
+    {
+        OverlayListing* entry = &listingCache.overlay[slot];
+        if(entry->key == 0 || entry->key == key) return entry;
+    }
+}
+
+
+//* Double the overlay once it is 70% full. Lock must be held.
+static bool grow_overlay(void)
+{
+    if(listingCache.overlay != NULL && (listingCache.overlayCount + 1) * 10 < listingCache.overlaySize * 7)
+        return true;
+
+    size_t oldSize = listingCache.overlaySize;
+    OverlayListing* old = listingCache.overlay;
+    size_t newSize = oldSize ? oldSize * 2 : LISTING_OVERLAY_MIN;
+    OverlayListing* grown = (OverlayListing*)calloc(newSize, sizeof(OverlayListing));
+    if(grown == NULL) return false;
+
+    listingCache.overlay = grown;
+    listingCache.overlaySize = newSize;
+    for(size_t slot = 0; slot < oldSize; slot++)
+        if(old[slot].key != 0) *find_overlay(old[slot].key) = old[slot];
+
+    free(old);
+    return true;
+}
+
+
+//* Every listing lies inside the data section
+static bool validate_listings(const ListingEntry* entries, size_t count, uint64_t dataSize)
+{
+    for(size_t i = 0; i < count; i++)
+        if(entries[i].offset > dataSize || entries[i].size > dataSize - entries[i].offset) return false;
+    return true;
+}
+
+
+//* <count> NUL-terminated records fill <size> bytes exactly, checked before a mapped listing is handed out
+static bool records_fit(const char* data, size_t size, uint32_t count)
+{
+    const char* end = data + size;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const char* terminator = data < end ? memchr(data, '\0', end - data) : NULL;
+        if(terminator == NULL) return false;
+        data = terminator + 1;
+    }
+    return data == end;
+}
+
+
+static int compare_listings(const void* left, const void* right)
+{
+    const ListingEntry* a = (const ListingEntry*)left;
+    const ListingEntry* b = (const ListingEntry*)right;
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+
+static void reset_listings(void)
+{
+    if(listingCache.mapping != NULL) munmap(listingCache.mapping, listingCache.mappingSize);
+    for(size_t slot = 0; slot < listingCache.overlaySize; slot++)
+        free(listingCache.overlay[slot].data);
+    free(listingCache.overlay);
+    free(listingCache.filePath);
+
+    listingCache.filePath = NULL;
+    listingCache.mapping = NULL;
+    listingCache.mappingSize = 0;
+    listingCache.entries = NULL;
+    listingCache.count = 0;
+    listingCache.data = NULL;
+    listingCache.overlay = NULL;
+    listingCache.overlaySize = 0;
+    listingCache.overlayCount = 0;
+}
+
+
+//* Type of a directory entry, following symlinks -> 0 to skip it (dangling link, ...)
+static uint8_t entry_type(int dirFd, const RawDirent* dirent)
+{
+    if(dirent->d_type == DT_DIR) return ENTRY_DIR;
+    if(dirent->d_type != DT_LNK && dirent->d_type != DT_UNKNOWN) return ENTRY_FILE;
+
+    struct stat info;
+    if(fstatat(dirFd, dirent->d_name, &info, 0) == -1) return 0;
+    if(!S_ISDIR(info.st_mode)) return ENTRY_FILE;
+    if(dirent->d_type == DT_UNKNOWN)
+    {
+        struct stat own;
+        if(fstatat(dirFd, dirent->d_name, &own, AT_SYMLINK_NOFOLLOW) == 0 && !S_ISLNK(own.st_mode)) return ENTRY_DIR;
+    }
+    return ENTRY_LINK_DIR;
+}
+
+
+//* Read the whole directory into [type][name]\0 records
+static bool read_listing(int dirFd, DirListing* listing)
+{
+    size_t capacity = 4096;
+    char* data = (char*)malloc(capacity);
+    if(data == NULL) return false;
+    size_t size = 0;
+    uint32_t count = 0;
+
+    char buffer[DENTS_BUFFER];
+    for(;;)
+    {
+        long read = syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+        if(read == 0) break;
+        if(read < 0)
+        {
+            free(data);
+            return false;
+        }
+
+        for(long at = 0; at < read; )
+        {
+            const RawDirent* dirent = (const RawDirent*)&buffer[at];
+            at += dirent->d_reclen;
+            const char* name = dirent->d_name;
+            if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            uint8_t type = entry_type(dirFd, dirent);
+            if(type == 0) continue;
+
+            size_t length = strlen(name) + 2;
+            if(size + length > capacity)
+            {
+                while(size + length > capacity) capacity *= 2;
+                char* grown = (char*)realloc(data, capacity);
+                if(grown == NULL)
+                {
+                    free(data);
+                    return false;
+                }
+                data = grown;
+            }
+            data[size] = (char)type;
+            memcpy(&data[size + 1], name, length - 1);
+            size += length;
+            count++;
+        }
+    }
+
+    listing->data = data;
+    listing->size = size;
+    listing->count = count;
+    listing->owned = data;
+    return true;
+}
+
+
+//* The directory changed too recently for its mtime to tell later changes apart
+static bool is_racy(uint64_t mtime)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t nowNs = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    return mtime + RACY_WINDOW_NS > nowNs;
+}
+
+
+
+// ==== Interface ====
+
+bool load_dir_cache(const char* directory)
+{
+    if(directory == NULL) return false;
+    reset_listings();
+
+    fileStat dirStat = stat_path(directory);
+    if(!dirStat.exists && !create_dir(directory)) return false;
+
+    size_t length = strlen(directory) + strlen(DIR_CACHE) + 2;
+    listingCache.filePath = (char*)malloc(length);
+    if(listingCache.filePath == NULL) return false;
+    snprintf(listingCache.filePath, length, "%s/%s", directory, DIR_CACHE);
+
+    int fd = open(listingCache.filePath, O_RDONLY);
+    if(fd == -1) return true;   // first run, nothing cached yet
+
+    struct stat fileInfo;
+    if(fstat(fd, &fileInfo) == -1 || (size_t)fileInfo.st_size < sizeof(ListingHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) return false;
+
+    const ListingHeader* header = (const ListingHeader*)mapping;
+    const ListingEntry* entries = (const ListingEntry*)(header + 1);
+    size_t expected = sizeof(ListingHeader) + (size_t)header->count * sizeof(ListingEntry) + header->dataSize;
+    if(memcmp(header->magic, LISTING_MAGIC, sizeof(header->magic)) != 0 ||
+       header->version != DIR_CACHE_VERSION || header->dataSize > (uint64_t)fileInfo.st_size ||
+       expected != (size_t)fileInfo.st_size || !validate_listings(entries, header->count, header->dataSize))
+    {
+        munmap(mapping, fileInfo.st_size);
+        log_full("Directory cache is stale or corrupt; starting from scratch.", WARNING, CACHE);
+        return false;
+    }
+
+    listingCache.mapping = mapping;
+    listingCache.mappingSize = fileInfo.st_size;
+    listingCache.entries = entries;
+    listingCache.count = header->count;
+    listingCache.data = (const char*)(listingCache.entries + listingCache.count);
+    return true;
+}
+
+
+/*
+ * A cached listing is reused while the directory mtime is unchanged,
+ * since creating, removing or renaming an entry always updates it.
+ * Fresh listings are handed to the cache, which then owns them.
+*/
+bool list_directory(int dirFd, const char* path, DirListing* listing)
+{
+    memset(listing, 0, sizeof(DirListing));
+    struct stat info;
+    if(fstat(dirFd, &info) == -1) return false;
+    uint64_t mtime = (uint64_t)info.st_mtim.tv_sec * 1000000000ull + (uint64_t)info.st_mtim.tv_nsec;
+    uint64_t key = listing_key(path);
+
+    pthread_mutex_lock(&listingCache.lock);
+    OverlayListing* fresh = find_overlay(key);
+    if(fresh != NULL && fresh->key == key && fresh->mtime == mtime)
+    {
+        *listing = (DirListing){fresh->data, fresh->size, fresh->count, NULL};
+        pthread_mutex_unlock(&listingCache.lock);
+        return true;
+    }
+    const ListingEntry* cached = fresh == NULL || fresh->key == 0 ? find_mapped(key) : NULL;
+    if(cached != NULL && cached->mtime == mtime && records_fit(&listingCache.data[cached->offset], cached->size, cached->count))
+    {
+        *listing = (DirListing){&listingCache.data[cached->offset], cached->size, cached->count, NULL};
+        pthread_mutex_unlock(&listingCache.lock);
+        return true;
+    }
+    pthread_mutex_unlock(&listingCache.lock);
+
+    if(!read_listing(dirFd, listing)) return false;
+    if(listingCache.filePath == NULL || is_racy(mtime)) return true;
+
+    pthread_mutex_lock(&listingCache.lock);
+    if(grow_overlay())
+    {
+        // a listing already handed out may still be read, so only fill free slots
+        OverlayListing* slot = find_overlay(key);
+        if(slot->key == 0)
+        {
+            *slot = (OverlayListing){key, mtime, listing->owned, (uint32_t)listing->size, listing->count};
+            listingCache.overlayCount++;
+            listing->owned = NULL;
+        }
+    }
+    pthread_mutex_unlock(&listingCache.lock);
+    return true;
+}
+
+
+void release_listing(DirListing* listing)
+{
+    free(listing->owned);
+    memset(listing, 0, sizeof(DirListing));
+}
+
+
+bool save_dir_cache(void)
+{
+    if(listingCache.filePath == NULL || listingCache.overlayCount == 0) return true;
+
+    pthread_mutex_lock(&listingCache.lock);
+    size_t count = 0;
+    size_t dataSize = 0;
+    ListingEntry* entries = (ListingEntry*)malloc((listingCache.count + listingCache.overlayCount) * sizeof(ListingEntry));
+    if(entries == NULL)
+    {
+        pthread_mutex_unlock(&listingCache.lock);
+        return false;
+    }
+
+    for(size_t i = 0; i < listingCache.count; i++)
+    {
+        OverlayListing* fresh = find_overlay(listingCache.entries[i].key);
+        if(fresh != NULL && fresh->key != 0) continue;
+        entries[count] = listingCache.entries[i];
+        entries[count++].offset = dataSize;
+        dataSize += listingCache.entries[i].size;
+    }
+    size_t mappedCount = count;
+    for(size_t slot = 0; slot < listingCache.overlaySize; slot++)
+    {
+        const OverlayListing* fresh = &listingCache.overlay[slot];
+        if(fresh->key == 0) continue;
+        entries[count++] = (ListingEntry){fresh->key, fresh->mtime, dataSize, fresh->size, fresh->count};
+        dataSize += fresh->size;
+    }
+
+    char* data = (char*)malloc(dataSize + 1);
+    if(data == NULL)
+    {
+        pthread_mutex_unlock(&listingCache.lock);
+        free(entries);
+        return false;
+    }
+    size_t mappedAt = 0;
+    for(size_t i = 0; i < listingCache.count; i++)
+    {
+        OverlayListing* fresh = find_overlay(listingCache.entries[i].key);
+        if(fresh != NULL && fresh->key != 0) continue;
+        memcpy(&data[mappedAt], &listingCache.data[listingCache.entries[i].offset], listingCache.entries[i].size);
+        mappedAt += listingCache.entries[i].size;
+    }
+    for(size_t i = mappedCount; i < count; i++)
+        memcpy(&data[entries[i].offset], find_overlay(entries[i].key)->data, entries[i].size);
+    pthread_mutex_unlock(&listingCache.lock);
+
+    qsort(entries, count, sizeof(ListingEntry), compare_listings);
+
+    ListingHeader header = {LISTING_MAGIC, DIR_CACHE_VERSION, (uint32_t)count, dataSize};
+    char tmpPath[MAX_PATH_SIZE];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", listingCache.filePath);
+    FILE* file = fopen(tmpPath, "wb");
+    bool written = file != NULL
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries, sizeof(ListingEntry), count, file) == count
+        && fwrite(data, 1, dataSize, file) == dataSize;
+    if(file != NULL && fclose(file) != 0) written = false;
+    free(entries);
+    free(data);
+
+    if(!written || rename(tmpPath, listingCache.filePath) == -1)
+    {
+        remove(tmpPath);
+        log_full("Could not write the directory cache.", WARNING, CACHE);
+        return false;
+    }
+    return true;
+}
+
+
+void close_dir_cache(void)
+{
+    save_dir_cache();
+    reset_listings();
+}
@@ -0,0 +1,253 @@
+#pragma once
+// Load manages the persistent state kept in the .pipe folder
+// between runs: file fingerprints for dependency evaluation, listings,
+// command timings and the artifacts outputs can be restored from, ...
+
+#include "../global.h"
+
+#include "../util/arena.h"
+#include "../util/path.h"
+
+#include <stdint.h>
+
+
+#define FILE_CACHE "files"          // file name of the fingerprint cache inside PIPE_DIRECTORY
+#define FILE_CACHE_VERSION 1
+#define DIR_CACHE "dirs"            // file name of the directory listing cache inside PIPE_DIRECTORY
+#define DIR_CACHE_VERSION 1
+#define TIMING_CACHE "timings"     // file name of the per-output duration, memory and input cache inside PIPE_DIRECTORY
+#define TIMING_CACHE_VERSION 2
+#define ARTIFACT_STORE "cas"        // content-addressed outputs inside PIPE_DIRECTORY
+#define ARTIFACT_STORE_VERSION 1
+#define SHARED_STORE "shared"       // artifacts served by the cache daemon, inside PIPE_DIRECTORY
+#define HISTORY_CACHE "history"     // build history records inside PIPE_DIRECTORY, indexed by HISTORY_INDEX
+#define HISTORY_INDEX "history.idx"
+#define HISTORY_CACHE_VERSION 1
+#define HISTORY_REPORT_RUNS 20      // runs looked at by the --status report
+#define HISTORY_REPORT_TOP 5        // lines per ranking of the report
+#define GLOB_MAX_SEGMENTS 64
+
+
+typedef struct
+{
+    uint64_t mtime;     // nanoseconds since the epoch
+    uint64_t size;
+    uint64_t inode;
+    uint64_t hash;      // content hash, 0 if never hashed
+} FileRecord;
+
+typedef enum
+{
+    REBUILD_NONE = 0,   // up to date
+    REBUILD_MISSING,    // the output does not exist
+    REBUILD_INPUT,      // an input is newer or its content changed
+    REBUILD_PRODUCER,   // an input is rebuilt first
+} RebuildReason;
+
+typedef enum
+{
+    HISTORY_UP_TO_DATE = 0,     // only counted, never stored
+    HISTORY_RESTORED,           // from the artifact store: a cache hit
+    HISTORY_BUILT,
+    HISTORY_FAILED,
+    HISTORY_CANCELLED,
+} HistoryOutcome;
+
+typedef enum
+{
+    HISTORY_MODE_NONE = 0,      // no command ran: restored, cancelled, or from an older history
+    HISTORY_MODE_SHELL,         // through a worker's persistent shell
+    HISTORY_MODE_DIRECT,        // spawned without a shell
+} HistoryMode;
+
+typedef enum
+{
+    ENTRY_FILE = 1,     // anything that is not a directory
+    ENTRY_DIR,
+    ENTRY_LINK_DIR,     // symlink to a directory, never followed by **
+} EntryType;
+
+typedef struct
+{
+    const char* data;   // <count> records of [EntryType byte][name]\0
+    size_t size;
+    uint32_t count;
+    char* owned;        // heap copy to release, NULL when the cache owns <data>
+} DirListing;
+
+typedef enum
+{
+    SEGMENT_LITERAL = 0,
+    SEGMENT_WILDCARD,   // contains '*'
+    SEGMENT_GLOBSTAR,   // exactly "**"
+} SegmentType;
+
+typedef struct
+{
+    SegmentType type;
+    const char* text;   // NUL-terminated, inside GlobPattern.text
+} GlobSegment;
+
+typedef struct
+{
+    char* text;                 // normalized copy of the pattern, split in place
+    GlobSegment segments[GLOB_MAX_SEGMENTS];
+    size_t count;
+    bool absolute;
+    bool allowEmpty;            // '?' policy: zero matches is not an error
+} GlobPattern;
+
+typedef struct
+{
+    const char** paths;         // sorted, without duplicates
+    PathID* ids;                // interned <paths>, same order
+    size_t count;
+    size_t capacity;
+    Arena arena;
+} GlobResult;
+
+
+
+// ==== File cache ====
+
+//* Map the fingerprint cache of <directory> (created if needed) -> false if unusable, cache then starts empty
+bool load_cache(const char* directory);
+//* Find the record of a path -> false if unknown
+bool cache_lookup(const char* path, FileRecord* record);
+//* Find the record of an interned path -> false if unknown
+bool cache_lookup_id(PathID id, FileRecord* record);
+//* Insert or replace the record of a path
+void cache_store(const char* path, const FileRecord* record);
+//* Insert or replace the record of an interned path
+void cache_store_id(PathID id, const FileRecord* record);
+//* Write the cache back atomically (temp file + rename) -> success
+bool save_cache(void);
+//* Save and unmap
+void close_cache(void);
+
+
+
+// ==== File hashing ====
+
+//* Hash a file's content -> false if it can't be read
+bool hash_file(const char* path, uint64_t* hash);
+//* Fingerprint <count> files on <threads> threads (0 = one per processor). Files whose
+//* (mtime, size, inode) match the cache keep their cached hash, the others are hashed
+//* and stored in the cache. <ids> (NULL if unknown) are the interned <paths>, the cache
+//* is then searched by id. Unreadable files get hash 0 -> number of files re-hashed
+size_t hash_files(const char* const* paths, const PathID* ids, size_t count, uint64_t* hashes, unsigned int threads);
+//* Combine the content hashes of a job's inputs, in order -> 0 if one of them is 0 (unreadable)
+uint64_t input_digest(const uint64_t* hashes, size_t count);
+
+
+
+// ==== Directory listings ====
+
+//* Map the directory listing cache of <directory> -> false if unusable, cache then starts empty
+bool load_dir_cache(const char* directory);
+//* Entries of the open directory <dirFd> found at <path>, from the cache while its mtime holds -> false on error
+bool list_directory(int dirFd, const char* path, DirListing* listing);
+//* Free a listing's own copy, if any
+void release_listing(DirListing* listing);
+//* Write the listing cache back atomically -> success
+bool save_dir_cache(void);
+//* Save and unmap
+void close_dir_cache(void);
+
+
+
+// ==== Command timings ====
+
+//* Read the duration cache of <directory> -> false if unusable, cache then starts empty
+bool load_timings(const char* directory);
+//* Key of an (action, output) pair, never 0
+uint64_t timing_key(const char* action, const char* output);
+//* Expected duration in nanoseconds -> 0 if never timed
+uint64_t get_timing(uint64_t key);
+//* Fold a measured duration into the estimate of <key>
+void record_timing(uint64_t key, uint64_t duration);
+//* Peak memory in bytes of the last measured run of <key> -> 0 if unknown
+uint64_t get_memory(uint64_t key);
+//* Remember the peak memory of a run of <key>, once timed
+void record_memory(uint64_t key, uint64_t memory);
+//* Digest of the inputs the last successful build of <key> read -> 0 if never built
+uint64_t get_input_digest(uint64_t key);
+//* Remember the inputs a successful build of <key> read (see input_digest)
+void record_input_digest(uint64_t key, uint64_t digest);
+//* Write the duration cache back atomically -> success
+bool save_timings(void);
+//* Save and release
+void close_timings(void);
+
+
+
+// ==== Build history ====
+
+//* Record this run in the history of <directory> -> false if unusable
+bool open_history(const char* directory);
+//* Note the outcome of one output; thread-safe. <duration> in ns, <peakRss> in bytes (0 if unknown).
+void record_history(const char* action, const char* output, HistoryOutcome outcome, RebuildReason reason,
+                    int exitCode, uint64_t duration, uint64_t peakRss, HistoryMode mode);
+//* Append this run's records to the history -> success
+bool save_history(void);
+//* Save and release
+void close_history(void);
+//* Print the slowest actions, most rebuilt outputs, cache hits and duration trend
+//* of the last <runs> runs in <directory> -> false if there is no history
+bool report_history(const char* directory, size_t runs);
+
+
+
+// ==== Artifact store ====
+
+//* Use the artifact store of <directory> (created if needed) -> false if unusable
+bool open_store(const char* directory);
+//* Whether open_store() succeeded
+bool store_enabled(void);
+//* Key of an output: the expanded command, the environment it reads and the input content hashes
+uint64_t artifact_key(const char* command, const uint64_t* inputHashes, size_t count);
+//* Whether the artifact of <key> is stored locally
+bool store_has(uint64_t key);
+//* Download the artifact of <key> from the cache daemon into the store -> false if it has none
+bool store_import(uint64_t key, const char* command);
+//* Put the stored artifact of <key> at <output> (reflink, hard link or copy) -> false if not stored
+bool store_restore(uint64_t key, const char* output);
+//* Keep <output> as the artifact of <key>, with the command that made it -> success
+bool store_save(uint64_t key, const char* output, const char* command);
+//* Unlink <output> if it shares its inode, so that a command cannot write into the store
+void store_detach(const char* output);
+//* Forget the store directory
+void close_store(void);
+
+
+
+// ==== Remote artifacts ====
+
+//* Use the cache daemon listening on the Unix socket <address> -> false if none given
+bool open_remote(const char* address);
+//* Whether a cache daemon is configured
+bool remote_enabled(void);
+//* Download the artifact of <key> to <path> -> false if missing or unreachable
+bool remote_fetch(uint64_t key, const char* path);
+//* Upload <path> as the artifact of <key> -> success
+bool remote_push(uint64_t key, const char* path);
+//* Forget the daemon
+void close_remote(void);
+//* Serve the artifacts of <directory> on the Unix socket <address>. Only returns on error.
+bool serve_cache(const char* address, const char* directory);
+
+
+
+// ==== Globbing ====
+
+//* Compile <pattern>: '*' within a name, '**' across directories,
+//* a '?' after a wildcard or at the end allows zero matches -> false if invalid
+bool compile_glob(const char* pattern, GlobPattern* glob);
+//* Release a compiled pattern
+void free_glob(GlobPattern* glob);
+//* Match a path against the pattern without touching the filesystem
+bool glob_match(const GlobPattern* glob, const char* path);
+//* Find matching files on <threads> threads (0 = one per processor) -> false on error
+bool run_glob(const GlobPattern* glob, unsigned int threads, GlobResult* result);
+//* Release the matched paths
+void free_glob_result(GlobResult* result);
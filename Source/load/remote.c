@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+#include "load.h"
+
+#include "../util/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <zlib.h>
+
+
+#define REMOTE_MAGIC "PRC1"             // 4 bytes, no terminator sent
+#define REMOTE_TIMEOUT_S 10             // socket send/receive timeout, client and daemon
+#define REMOTE_MAX_OBJECT (1ull << 30)  // larger artifacts are neither sent nor accepted
+#define REMOTE_LEVEL 1                  // zlib level: artifacts are sent once per build, favour speed
+#define STORED_PREFIX 10                // raw size and mode ahead of the zlib stream in the daemon's files
+
+typedef enum
+{
+    REMOTE_GET = 1,         // request: key -> artifact
+    REMOTE_PUT,             // request: key + artifact
+    REMOTE_OK = 0x10,       // response, carries the artifact for a GET
+    REMOTE_MISSING,
+    REMOTE_FAILED,
+} RemoteOp;
+
+//* Every message starts with this header, followed by <size> bytes of zlib data
+typedef struct
+{
+    char magic[4];
+    uint16_t op;            // RemoteOp
+    uint16_t mode;          // permission bits of the artifact
+    uint64_t key;
+    uint64_t size;          // compressed payload bytes
+    uint64_t rawSize;       // bytes once inflated
+} RemoteHeader;
+
+typedef struct
+{
+    char* address;          // Unix socket path, NULL when disabled
+} RemoteClient;
+
+
+// ==== Static variables ====
+
+static RemoteClient remote = (RemoteClient)
+{
+    .address = NULL,
+};
+
+static atomic_uint sequence = 0;    // unique temporary names
+
+
+
+// ==== Internal Helpers ====
+
+static bool send_all(int fd, const void* data, size_t size)
+{
+    const char* at = (const char*)data;
+    while(size > 0)
+    {
+        ssize_t sent = send(fd, at, size, MSG_NOSIGNAL);
+        if(sent <= 0 && errno != EINTR) return false;
+        if(sent <= 0) continue;
+        at += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool receive_all(int fd, void* data, size_t size)
+{
+    char* at = (char*)data;
+    while(size > 0)
+    {
+        ssize_t received = recv(fd, at, size, 0);
+        if(received == 0 || (received < 0 && errno != EINTR)) return false;
+        if(received < 0) continue;
+        at += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool send_message(int fd, RemoteOp op, uint16_t mode, uint64_t key, const void* payload, uint64_t size, uint64_t rawSize)
+{
+    RemoteHeader header;
+    memcpy(header.magic, REMOTE_MAGIC, sizeof(header.magic));
+    header.op = (uint16_t)op;
+    header.mode = mode;
+    header.key = key;
+    header.size = size;
+    header.rawSize = rawSize;
+    return send_all(fd, &header, sizeof(header)) && (size == 0 || send_all(fd, payload, size));
+}
+
+//* Header of the next message, with its payload in <payload> (malloc'd, NULL if empty) -> false on error
+static bool receive_message(int fd, RemoteHeader* header, unsigned char** payload)
+{
+    *payload = NULL;
+    if(!receive_all(fd, header, sizeof(RemoteHeader)) || memcmp(header->magic, REMOTE_MAGIC, 4) != 0) return false;
+    if(header->size == 0) return true;
+    if(header->size > compressBound(REMOTE_MAX_OBJECT) || header->rawSize > REMOTE_MAX_OBJECT) return false;
+
+    *payload = (unsigned char*)malloc(header->size);
+    if(*payload != NULL && receive_all(fd, *payload, header->size)) return true;
+    free(*payload);
+    *payload = NULL;
+    return false;
+}
+
+
+//* Whole file in memory -> NULL if unreadable or too large
+static unsigned char* read_whole(const char* path, size_t* size, uint16_t* mode)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return NULL;
+    struct stat info;
+    unsigned char* data = NULL;
+    if(fstat(fd, &info) == 0 && (uint64_t)info.st_size <= REMOTE_MAX_OBJECT)
+    {
+        data = (unsigned char*)malloc(info.st_size + 1);
+        *size = info.st_size;
+        if(mode != NULL) *mode = info.st_mode & 0777;
+        for(size_t done = 0; data != NULL && done < *size; )
+        {
+            ssize_t length = read(fd, &data[done], *size - done);
+            if(length <= 0)
+            {
+                free(data);
+                data = NULL;
+            }
+            else done += length;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+//* Write <data> to <path> through a temporary file and rename
+static bool write_whole(const char* path, const char* temporary, const void* data, size_t size, mode_t mode)
+{
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if(fd == -1) return false;
+    bool written = true;
+    for(size_t done = 0; done < size && written; )
+    {
+        ssize_t length = write(fd, (const char*)data + done, size - done);
+        written = length > 0;
+        if(written) done += length;
+    }
+    if(close(fd) != 0) written = false;
+    if(written && rename(temporary, path) == 0) return true;
+    unlink(temporary);
+    return false;
+}
+
+
+//* A peer that stalls fails the request instead of holding a thread forever
+static void set_timeouts(int fd)
+{
+    struct timeval timeout = {REMOTE_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+
+static int connect_remote(void)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if(strlen(remote.address) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, remote.address);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1) return -1;
+    set_timeouts(fd);
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+typedef struct
+{
+    int fd;
+    const char* directory;
+} Connection;
+
+static void stored_path(const char* directory, uint64_t key, char* buf, size_t size)
+{
+    snprintf(buf, size, "%s/%02x/%016llx.z", directory, (unsigned int)(key >> 56), (unsigned long long)key);
+}
+
+/*
+ * One request per connection. Objects are kept as received: the raw
+ * size and mode, then the zlib stream, so a GET is answered without
+ * inflating.
+*/
+static void* serve_connection(void* argument)
+{
+    Connection connection = *(Connection*)argument;
+    free(argument);
+    set_timeouts(connection.fd);
+
+    RemoteHeader request;
+    unsigned char* payload = NULL;
+    char path[MAX_PATH_SIZE];
+    if(receive_message(connection.fd, &request, &payload))
+    {
+        stored_path(connection.directory, request.key, path, sizeof(path));
+        if(request.op == REMOTE_GET)
+        {
+            size_t size = 0;
+            unsigned char* stored = read_whole(path, &size, NULL);
+            if(stored != NULL && size >= STORED_PREFIX)
+            {
+                uint64_t rawSize;
+                uint16_t mode;
+                memcpy(&rawSize, stored, sizeof(rawSize));
+                memcpy(&mode, stored + sizeof(rawSize), sizeof(mode));
+                send_message(connection.fd, REMOTE_OK, mode, request.key, stored + STORED_PREFIX, size - STORED_PREFIX, rawSize);
+            }
+            else send_message(connection.fd, REMOTE_MISSING, 0, request.key, NULL, 0, 0);
+            free(stored);
+        }
+        else if(request.op == REMOTE_PUT && payload != NULL)
+        {
+            char folder[MAX_PATH_SIZE];
+            snprintf(folder, sizeof(folder), "%s/%02x", connection.directory, (unsigned int)(request.key >> 56));
+            mkdir(folder, 0777);
+
+            unsigned char* stored = (unsigned char*)malloc(request.size + STORED_PREFIX);
+            char temporary[MAX_PATH_SIZE + 32];
+            snprintf(temporary, sizeof(temporary), "%s.%u.tmp", path, atomic_fetch_add(&sequence, 1));
+            bool kept = stored != NULL;
+            if(kept)
+            {
+                memcpy(stored, &request.rawSize, sizeof(uint64_t));
+                memcpy(stored + sizeof(uint64_t), &request.mode, sizeof(uint16_t));
+                memcpy(stored + STORED_PREFIX, payload, request.size);
+                kept = write_whole(path, temporary, stored, request.size + STORED_PREFIX, 0644);
+            }
+            free(stored);
+            send_message(connection.fd, kept ? REMOTE_OK : REMOTE_FAILED, 0, request.key, NULL, 0, 0);
+        }
+        else send_message(connection.fd, REMOTE_FAILED, 0, request.key, NULL, 0, 0);
+    }
+
+    free(payload);
+    close(connection.fd);
+    return NULL;
+}
+
+
+
+// ==== Interface ====
+
+bool open_remote(const char* address)
+{
+    close_remote();
+    if(address == NULL || address[0] == '\0') return false;
+    remote.address = strdup(address);
+    return remote.address != NULL;
+}
+
+
+bool remote_enabled(void)
+{
+    return remote.address != NULL;
+}
+
+
+bool remote_fetch(uint64_t key, const char* path)
+{
+    if(remote.address == NULL) return false;
+    int fd = connect_remote();
+    if(fd == -1) return false;
+
+    RemoteHeader response;
+    unsigned char* payload = NULL;
+    bool fetched = send_message(fd, REMOTE_GET, 0, key, NULL, 0, 0)
+        && receive_message(fd, &response, &payload)
+        && response.op == REMOTE_OK && response.key == key;
+    close(fd);
+
+    unsigned char* raw = fetched ? (unsigned char*)malloc(response.rawSize + 1) : NULL;
+    uLongf rawSize = fetched ? (uLongf)response.rawSize : 0;
+    fetched = raw != NULL && uncompress(raw, &rawSize, payload, (uLong)response.size) == Z_OK && rawSize == response.rawSize;
+
+    char temporary[MAX_PATH_SIZE + 32];
+    snprintf(temporary, sizeof(temporary), "%s.%u.fetch", path, atomic_fetch_add(&sequence, 1));
+    fetched = fetched && write_whole(path, temporary, raw, rawSize, response.mode != 0 ? response.mode : 0644);
+    free(payload);
+    free(raw);
+    return fetched;
+}
+
+
+bool remote_push(uint64_t key, const char* path)
+{
+    if(remote.address == NULL) return false;
+
+    size_t size = 0;
+    uint16_t mode = 0;
+    unsigned char* data = read_whole(path, &size, &mode);
+    if(data == NULL) return false;
+    uLongf packedSize = compressBound(size);
+    unsigned char* packed = (unsigned char*)malloc(packedSize);
+    bool pushed = packed != NULL && compress2(packed, &packedSize, data, size, REMOTE_LEVEL) == Z_OK;
+    free(data);
+
+    int fd = pushed ? connect_remote() : -1;
+    RemoteHeader response;
+    unsigned char* payload = NULL;
+    pushed = fd != -1
+        && send_message(fd, REMOTE_PUT, mode, key, packed, packedSize, size)
+        && receive_message(fd, &response, &payload)
+        && response.op == REMOTE_OK;
+    if(fd != -1) close(fd);
+    free(payload);
+    free(packed);
+    return pushed;
+}
+
+
+void close_remote(void)
+{
+    free(remote.address);
+    remote.address = NULL;
+}
+
+
+bool serve_cache(const char* address, const char* directory)
+{
+    struct sockaddr_un socketAddress = {.sun_family = AF_UNIX};
+    if(address == NULL || strlen(address) >= sizeof(socketAddress.sun_path)) return false;
+    strcpy(socketAddress.sun_path, address);
+
+    char folder[MAX_PATH_SIZE];
+    snprintf(folder, sizeof(folder), "%s/", directory);
+    for(char* slash = strchr(folder + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if(!stat_path(folder).exists && !create_dir(folder)) return false;
+        *slash = '/';
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listener == -1) return false;
+    unlink(address);    // a stale socket of an earlier daemon
+    if(bind(listener, (struct sockaddr*)&socketAddress, sizeof(socketAddress)) == -1 || listen(listener, 64) == -1)
+    {
+        close(listener);
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    char buf[MAX_PATH_SIZE + 64];
+    snprintf(buf, sizeof(buf), "Serving artifacts of '%s' on '%s'.", directory, address);
+    log_full(buf, INFO, CACHE);
+
+    while(true)
+    {
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if(fd == -1)
+        {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        Connection* connection = (Connection*)malloc(sizeof(Connection));
+        pthread_t thread;
+        if(connection == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        *connection = (Connection){fd, directory};
+        if(pthread_create(&thread, NULL, serve_connection, connection) != 0)
+        {
+            free(connection);
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(listener);
+    return false;
+}
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+#include "load.h"
+
+#include "../util/util.h"
+#include "../util/hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+
+#define COPY_CHUNK 65536    // bytes per read when the file can't be cloned (nor linked)
+
+typedef struct
+{
+    char* directory;        // <PIPE_DIRECTORY>/<ARTIFACT_STORE>, NULL when closed
+} ArtifactStore;
+
+
+// ==== Static variables ====
+
+static ArtifactStore store = (ArtifactStore)
+{
+    .directory = NULL,
+};
+
+
+
+// ==== Internal Helpers ====
+
+static void object_path(uint64_t key, char* buf, size_t size)
+{
+    snprintf(buf, size, "%s/%02x/%016llx", store.directory, (unsigned int)(key >> 56), (unsigned long long)key);
+}
+
+
+static bool copy_contents(int from, int to)
+{
+    char* buffer = (char*)malloc(COPY_CHUNK);
+    if(buffer == NULL) return false;
+
+    bool copied = true;
+    ssize_t length;
+    while((length = read(from, buffer, COPY_CHUNK)) > 0)
+        for(ssize_t done = 0; done < length && copied; )
+        {
+            ssize_t written = write(to, &buffer[done], length - done);
+            if(written <= 0) copied = false;
+            else done += written;
+        }
+    free(buffer);
+    return copied && length == 0;
+}
+
+/*
+ * A reflink shares the blocks until either side is written (btrfs,
+ * xfs). A hard link shares the file itself, which is why outputs
+ * linked to the store are detached before their action runs again.
+ * Only restores may link (<mayLink>): a live output linked into the store would
+ * take the object with it when something edits it in place. A copy is
+ * the last resort, e.g. across file systems.
+*/
+static bool place_file(const char* from, const char* to, bool mayLink)
+{
+    unlink(to);
+
+    int source = open(from, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(source == -1 || fstat(source, &info) == -1)
+    {
+        if(source != -1) close(source);
+        return false;
+    }
+    mode_t mode = info.st_mode & 0777;     // keeps executables executable
+    int target = open(to, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if(target != -1 && ioctl(target, FICLONE, source) == 0)
+    {
+        close(source);
+        return close(target) == 0;
+    }
+    if(target != -1)
+    {
+        close(target);
+        unlink(to);
+    }
+    if(mayLink && link(from, to) == 0)
+    {
+        close(source);
+        return true;
+    }
+
+    target = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    bool copied = target != -1 && copy_contents(source, target);
+    if(target != -1 && close(target) != 0) copied = false;
+    close(source);
+    if(!copied) unlink(to);
+    return copied;
+}
+
+
+//* Add the value of $NAME or ${NAME} references of the command to the key
+static void hash_environment(HashState* state, const char* command)
+{
+    const char* path = getenv("PATH");
+    hash_update(state, "PATH=", 5);
+    if(path != NULL) hash_update(state, path, strlen(path) + 1);
+
+    for(const char* at = strchr(command, '$'); at != NULL; at = strchr(at + 1, '$'))
+    {
+        const char* name = at + 1;
+        if(*name == '{') name++;
+        size_t length = 0;
+        while(name[length] == '_' || (name[length] >= 'A' && name[length] <= 'Z') ||
+              (name[length] >= 'a' && name[length] <= 'z') || (length > 0 && name[length] >= '0' && name[length] <= '9'))
+            length++;
+        if(length == 0 || length >= 128) continue;
+
+        char key[128];
+        memcpy(key, name, length);
+        key[length] = '\0';
+        const char* value = getenv(key);
+        hash_update(state, key, length + 1);
+        if(value != NULL) hash_update(state, value, strlen(value) + 1);
+    }
+}
+
+
+
+// ==== Interface ====
+
+bool open_store(const char* directory)
+{
+    if(directory == NULL) return false;
+    close_store();
+
+    fileStat dirStat = stat_path(directory);
+    if(!dirStat.exists && !create_dir(directory)) return false;
+
+    size_t length = strlen(directory) + strlen(ARTIFACT_STORE) + 2;
+    store.directory = (char*)malloc(length);
+    if(store.directory == NULL) return false;
+    snprintf(store.directory, length, "%s/%s", directory, ARTIFACT_STORE);
+
+    if(!stat_path(store.directory).exists && !create_dir(store.directory))
+    {
+        close_store();
+        return false;
+    }
+    return true;
+}
+
+
+bool store_enabled(void)
+{
+    return store.directory != NULL;
+}
+
+
+bool store_has(uint64_t key)
+{
+    if(store.directory == NULL || key == 0) return false;
+    char object[MAX_PATH_SIZE];
+    object_path(key, object, sizeof(object));
+    return access(object, R_OK) == 0;
+}
+
+
+uint64_t artifact_key(const char* command, const uint64_t* inputHashes, size_t count)
+{
+    HashState state;
+    hash_init(&state, ARTIFACT_STORE_VERSION);
+    hash_update(&state, command, strlen(command) + 1);
+    hash_environment(&state, command);
+    hash_update(&state, inputHashes, count * sizeof(uint64_t));
+    uint64_t key = hash_digest(&state);
+    return key == 0 ? 1 : key;  // 0 is reserved
+}
+
+
+bool store_restore(uint64_t key, const char* output)
+{
+    if(store.directory == NULL || key == 0) return false;
+
+    char object[MAX_PATH_SIZE];
+    object_path(key, object, sizeof(object));
+    if(access(object, R_OK) != 0) return false;
+
+    char temporary[MAX_PATH_SIZE];
+    snprintf(temporary, sizeof(temporary), "%s.restore", output);
+    if(!place_file(object, temporary, true)) return false;
+    if(rename(temporary, output) == -1)
+    {
+        unlink(temporary);
+        return false;
+    }
+
+    // a restored output is as new as a rebuilt one
+    utimensat(AT_FDCWD, output, NULL, 0);
+    return true;
+}
+
+
+bool store_save(uint64_t key, const char* output, const char* command)
+{
+    if(store.directory == NULL || key == 0) return false;
+
+    char object[MAX_PATH_SIZE];
+    object_path(key, object, sizeof(object));
+    if(access(object, F_OK) == 0) return true;
+
+    char folder[MAX_PATH_SIZE];
+    snprintf(folder, sizeof(folder), "%s/%02x", store.directory, (unsigned int)(key >> 56));
+    if(!stat_path(folder).exists && !create_dir(folder) && errno != EEXIST) return false;
+
+    char temporary[MAX_PATH_SIZE + 8];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", object);
+    if(!place_file(output, temporary, false)) return false;
+    if(rename(temporary, object) == -1)
+    {
+        unlink(temporary);
+        return false;
+    }
+
+    // provenance: what produced the object
+    char provenance[MAX_PATH_SIZE + 8];
+    snprintf(provenance, sizeof(provenance), "%s.txt", object);
+    FILE* file = fopen(provenance, "w");
+    if(file != NULL)
+    {
+        const char* path = getenv("PATH");
+        fprintf(file, "output: %s\ncommand: %s\nPATH=%s\n", output, command, path != NULL ? path : "");
+        fclose(file);
+    }
+    return true;
+}
+
+
+bool store_import(uint64_t key, const char* command)
+{
+    if(store.directory == NULL || key == 0 || !remote_enabled()) return false;
+
+    char folder[MAX_PATH_SIZE];
+    snprintf(folder, sizeof(folder), "%s/%02x", store.directory, (unsigned int)(key >> 56));
+    if(!stat_path(folder).exists && !create_dir(folder) && errno != EEXIST) return false;
+
+    char object[MAX_PATH_SIZE];
+    object_path(key, object, sizeof(object));
+    if(!remote_fetch(key, object)) return false;
+
+    char provenance[MAX_PATH_SIZE + 8];
+    snprintf(provenance, sizeof(provenance), "%s.txt", object);
+    FILE* file = fopen(provenance, "w");
+    if(file != NULL)
+    {
+        fprintf(file, "fetched from the cache daemon\ncommand: %s\n", command);
+        fclose(file);
+    }
+    return true;
+}
+
+
+void store_detach(const char* output)
+{
+    struct stat info;
+    if(lstat(output, &info) == 0 && S_ISREG(info.st_mode) && info.st_nlink > 1) unlink(output);
+}
+
+
+void close_store(void)
+{
+    free(store.directory);
+    store.directory = NULL;
+}
@@ -0,0 +1,311 @@
+#include "load.h"
+
+#include "../util/util.h"
+#include "../util/hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+#define TIMING_MAGIC "PIPETM\0"     // 8 bytes with the terminator
+#define TIMING_SLOTS_MIN 256        // initial table slots, always a power of 2
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+} TimingHeader;
+
+typedef struct
+{
+    uint64_t key;           // 0 marks a free slot
+    uint64_t duration;      // nanoseconds
+    uint64_t memory;        // peak bytes of the last measured run, 0 if unknown
+    uint64_t inputs;        // digest of the inputs the last successful build read, 0 if unknown
+} TimingEntry;
+
+typedef struct
+{
+    char* filePath;
+    TimingEntry* slots;
+    size_t slotCount;
+    size_t count;
+    bool dirty;
+
+    pthread_mutex_t lock;   // durations are recorded from worker callbacks
+} TimingTable;
+
+
+// ==== Static variables ====
+
+static TimingTable timings = (TimingTable)
+{
+    .filePath = NULL,
+    .slots = NULL,
+    .slotCount = 0,
+    .count = 0,
+    .dirty = false,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+// ==== Internal Helpers ====
+
+//* Slot of <key>, or the free slot it would take. Lock must be held.
+static TimingEntry* find_slot(uint64_t key)
+{
+    if(timings.slots == NULL) return NULL;
+
+    size_t mask = timings.slotCount - 1;
+    for(size_t slot = key & mask; ; slot = (slot + 1) & mask)
+    {
+        TimingEntry* entry = &timings.slots[slot];
+        if(entry->key == 0 || entry->key == key) return entry;
+    }
+}
+
+//* Double the table once it is 70% full. Lock must be held.
+static bool grow_table(void)
+{
+    if(timings.slots != NULL && (timings.count + 1) * 10 < timings.slotCount * 7) return true;
+
+    size_t oldCount = timings.slotCount;
+    TimingEntry* old = timings.slots;
+    size_t newCount = oldCount ? oldCount * 2 : TIMING_SLOTS_MIN;
+    TimingEntry* grown = (TimingEntry*)calloc(newCount, sizeof(TimingEntry));
+    if(grown == NULL) return false;
+
+    timings.slots = grown;
+    timings.slotCount = newCount;
+    for(size_t slot = 0; slot < oldCount; slot++)
+        if(old[slot].key != 0) *find_slot(old[slot].key) = old[slot];
+    free(old);
+    return true;
+}
+
+static void reset_timings(void)
+{
+    free(timings.filePath);
+    free(timings.slots);
+    timings.filePath = NULL;
+    timings.slots = NULL;
+    timings.slotCount = 0;
+    timings.count = 0;
+    timings.dirty = false;
+}
+
+static int compare_timings(const void* left, const void* right)
+{
+    uint64_t a = ((const TimingEntry*)left)->key;
+    uint64_t b = ((const TimingEntry*)right)->key;
+    return (a > b) - (a < b);
+}
+
+
+
+// ==== Interface ====
+
+bool load_timings(const char* directory)
+{
+    if(directory == NULL) return false;
+    reset_timings();
+
+    fileStat dirStat = stat_path(directory);
+    if(!dirStat.exists && !create_dir(directory)) return false;
+
+    size_t length = strlen(directory) + strlen(TIMING_CACHE) + 2;
+    timings.filePath = (char*)malloc(length);
+    if(timings.filePath == NULL) return false;
+    snprintf(timings.filePath, length, "%s/%s", directory, TIMING_CACHE);
+
+    FILE* file = fopen(timings.filePath, "rb");
+    if(file == NULL) return true;   // first run, nothing timed yet
+
+    TimingHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, TIMING_MAGIC, sizeof(header.magic)) == 0
+        && header.version == TIMING_CACHE_VERSION;
+    for(uint32_t i = 0; valid && i < header.count; i++)
+    {
+        TimingEntry entry;
+        valid = fread(&entry, sizeof(entry), 1, file) == 1 && entry.key != 0 && grow_table();
+        if(!valid) break;
+        TimingEntry* slot = find_slot(entry.key);
+        if(slot->key == 0) timings.count++;
+        *slot = entry;
+    }
+    fclose(file);
+
+    if(!valid)
+    {
+        free(timings.slots);
+        timings.slots = NULL;
+        timings.slotCount = 0;
+        timings.count = 0;
+        log_full("Timing cache is stale or corrupt; starting from scratch.", WARNING, CACHE);
+        return false;
+    }
+    return true;
+}
+
+
+uint64_t timing_key(const char* action, const char* output)
+{
+    HashState state;
+    hash_init(&state, 0);
+    hash_update(&state, action, strlen(action) + 1);
+    hash_update(&state, output, strlen(output));
+    uint64_t key = hash_digest(&state);
+    return key == 0 ? 1 : key;  // 0 is reserved
+}
+
+
+uint64_t get_timing(uint64_t key)
+{
+    pthread_mutex_lock(&timings.lock);
+    TimingEntry* entry = find_slot(key);
+    uint64_t duration = entry != NULL && entry->key != 0 ? entry->duration : 0;
+    pthread_mutex_unlock(&timings.lock);
+    return duration;
+}
+
+
+/*
+ * A new sample moves the estimate half way, so one slow run (a cold
+ * disk cache, a busy machine) does not reorder the next build on its
+ * own, while real changes in cost settle within a few runs.
+*/
+void record_timing(uint64_t key, uint64_t duration)
+{
+    if(key == 0) return;
+    if(duration == 0) duration = 1;
+
+    pthread_mutex_lock(&timings.lock);
+    if(grow_table())
+    {
+        TimingEntry* entry = find_slot(key);
+        if(entry->key == 0)
+        {
+            *entry = (TimingEntry){.key = key, .duration = duration};
+            timings.count++;
+        }
+        else if(entry->duration == 0) entry->duration = duration;  // only its inputs were known
+        else entry->duration = (entry->duration + duration) / 2;
+        timings.dirty = true;
+    }
+    pthread_mutex_unlock(&timings.lock);
+}
+
+
+uint64_t get_memory(uint64_t key)
+{
+    pthread_mutex_lock(&timings.lock);
+    TimingEntry* entry = find_slot(key);
+    uint64_t memory = entry != NULL && entry->key != 0 ? entry->memory : 0;
+    pthread_mutex_unlock(&timings.lock);
+    return memory;
+}
+
+
+/*
+ * Peaks are kept as measured, not averaged: admission has to plan for
+ * the largest a job needs, and the last run is the best guess of it.
+*/
+void record_memory(uint64_t key, uint64_t memory)
+{
+    if(key == 0 || memory == 0) return;
+
+    pthread_mutex_lock(&timings.lock);
+    TimingEntry* entry = find_slot(key);
+    if(entry != NULL && entry->key != 0 && entry->memory != memory)
+    {
+        entry->memory = memory;
+        timings.dirty = true;
+    }
+    pthread_mutex_unlock(&timings.lock);
+}
+
+
+uint64_t get_input_digest(uint64_t key)
+{
+    pthread_mutex_lock(&timings.lock);
+    TimingEntry* entry = find_slot(key);
+    uint64_t digest = entry != NULL && entry->key != 0 ? entry->inputs : 0;
+    pthread_mutex_unlock(&timings.lock);
+    return digest;
+}
+
+
+/*
+ * Kept per output rather than per input file, so that a job which
+ * failed or never ran still compares against what it was built from,
+ * whatever its siblings reading the same files recorded since.
+*/
+void record_input_digest(uint64_t key, uint64_t digest)
+{
+    if(key == 0) return;
+
+    pthread_mutex_lock(&timings.lock);
+    if(grow_table())
+    {
+        TimingEntry* entry = find_slot(key);
+        if(entry->key == 0)
+        {
+            *entry = (TimingEntry){.key = key};
+            timings.count++;
+        }
+        if(entry->inputs != digest)
+        {
+            entry->inputs = digest;
+            timings.dirty = true;
+        }
+    }
+    pthread_mutex_unlock(&timings.lock);
+}
+
+
+bool save_timings(void)
+{
+    if(timings.filePath == NULL || !timings.dirty) return true;
+
+    pthread_mutex_lock(&timings.lock);
+    size_t count = 0;
+    TimingEntry* entries = (TimingEntry*)malloc((timings.count + 1) * sizeof(TimingEntry));
+    for(size_t slot = 0; entries != NULL && slot < timings.slotCount; slot++)
+        if(timings.slots[slot].key != 0) entries[count++] = timings.slots[slot];
+    pthread_mutex_unlock(&timings.lock);
+    if(entries == NULL) return false;
+
+    // sorted, so unchanged timings give an identical file
+    qsort(entries, count, sizeof(TimingEntry), compare_timings);
+
+    TimingHeader header = {TIMING_MAGIC, TIMING_CACHE_VERSION, (uint32_t)count};
+    char tmpPath[MAX_PATH_SIZE];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", timings.filePath);
+    FILE* file = fopen(tmpPath, "wb");
+    bool written = file != NULL
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries, sizeof(TimingEntry), count, file) == count;
+    if(file != NULL && fclose(file) != 0) written = false;
+    free(entries);
+
+    if(!written || rename(tmpPath, timings.filePath) == -1)
+    {
+        remove(tmpPath);
+        log_full("Could not write the timing cache.", WARNING, CACHE);
+        return false;
+    }
+    timings.dirty = false;
+    return true;
+}
+
+
+void close_timings(void)
+{
+    save_timings();
+    reset_timings();
+}
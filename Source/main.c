@@ -1,75 +1,144 @@
-#include "util/util.h"
-
-// #include "load/load.h"
-// #include "read/read.h"
-// #include "process/process.h"
-#include "execute/execute.h"
-
-#include <stdio.h>
-#include <stdlib.h>
-
-
-void runPipe()
-{
-    printf("RUNNING PIPE\n");
-
-    return;
-}
-
-
-
-int main(int argc, char* argv[])
-{
-    // register before parsing; no need to clear this job
-    register_cleanup(clear_config);
-    const Config* settings = parse_settings(argc, (const char* const*)argv);
-
-    // Step 0: Prepare
-    if(settings->verbose) set_verbosity(VERBOSE);
-    if(settings->help) print_help();
-    if(settings->statuses) printf("Statuses to print: %s\n", settings->statuses);
-    const char* pipeline = DEFAULT_PIPELINE;
-    if(settings->inputFile) pipeline = settings->inputFile;
-
-    // Step 1: Load
-
-    // Step 2: Read
-
-    // Step 3: Process
-
-    // Step 4: Execute
-    init_workers(settings->jobs);
-    register_cleanup(close_workers);
-    ShellCommand newCommand = (ShellCommand){"cd build", "./", 0};
-    runCommand(newCommand);
-    // runPipe();
-
-
-    const char* groupString = get_host_group_name();
-    printf("Hosting group is: %s\n", groupString);
-
-    close_workers();
-    clear_config(settings);
-    close_logging();
-    return 0;
-}
-
-/*
- * Plan of execution:
- * - Build minimal executor: pass direct pipeline commands to execution
- * - Build minimal reader: elementary processing of pipeline file -> minimal cachable state
- * - 
- * 
- * 
- * The full pipeline execution model is as follows:
- * - 1. Load: Load the cache (if any) and use it to configure default pipe behavior
- * - 2. Read: Read the pipeline file and determine the extent of it's validity (has it been renewed?)
- *            Also includes the interpretation and caching of the file if it is new, to create a cachable state.
- * - 3. Process: Process the cache data in order to determine the build graph and it's execution pipeline.
- * - 4. Execute: Execute the appropriate commands in the appropriate order, determined by the processing state.
- * 
- * need to define structs for actions, pipes and flows.
- * executor takes in a string-like command and simply, naively executes it, prints result, fails, checks and makes sure execution is a-ok.
- * Process is the one that takes an action and uses pipe struct to determine variables mappings and transforms them into string-commands.
- * Read is the one that parses and creates action, pipe and flow structs.
+#include "util/util.h"
+
+#include "load/load.h"
+#include "read/read.h"
+#include "process/process.h"
+#include "execute/execute.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+int main(int argc, char* argv[])
+{
+    // register before parsing; no need to clear this job
+    register_cleanup(clear_config);
+    const Config* settings = parse_settings(argc, (const char* const*)argv);
+
+    // Step 0: Prepare
+    if(settings->verbose) set_verbosity(VERBOSE);
+    if(settings->help) print_help();
+    const char* pipeline = DEFAULT_PIPELINE;
+    if(settings->inputFile) pipeline = settings->inputFile;
+
+    // The cache daemon serves artifacts instead of building
+    if(settings->serveCache)
+    {
+        serve_cache(settings->serveCache, PIPE_DIRECTORY "/" SHARED_STORE);
+        log_fatal("Could not serve the artifact cache.", CACHE);
+    }
+
+    // Status reports only read what earlier runs left in the cache
+    if(settings->statuses)
+    {
+        for(const char* status = settings->statuses; *status != '\0'; status++)
+        {
+            if(*status == 'a' || *status == 'h') report_history(PIPE_DIRECTORY, HISTORY_REPORT_RUNS);
+            else log_l("Unknown status; try 'history'.", WARNING);
+        }
+        clear_config();
+        close_logging();
+        return 0;
+    }
+
+    // Step 1: Load
+    load_cache(PIPE_DIRECTORY);
+    register_cleanup(close_cache);
+    set_log_file(PIPE_DIRECTORY "/" PIPE_LOG, true);
+    load_dir_cache(PIPE_DIRECTORY);
+    register_cleanup(close_dir_cache);
+    load_timings(PIPE_DIRECTORY);
+    register_cleanup(close_timings);
+    open_history(PIPE_DIRECTORY);
+    register_cleanup(close_history);
+    if(!settings->atomic) open_store(PIPE_DIRECTORY);
+    register_cleanup(close_store);
+
+    // Step 2: Read
+    // The pipe cache is skipped when asked to reconfigure or to run atomically
+    PipeFile pipeFile;
+    bool useImage = !settings->doConfig && !settings->atomic;
+    if(!useImage || !load_pipe_image(PIPE_DIRECTORY, pipeline, settings->defines, settings->define_count, &pipeFile))
+    {
+        if(!read_pipefile(pipeline, &pipeFile)) log_fatal("Could not read the pipe file.", READ);
+        if(!resolve_config(&pipeFile, settings->defines, settings->define_count))
+            log_fatal("Could not configure the pipe file.", READ);
+        if(!settings->atomic) save_pipe_image(PIPE_DIRECTORY, pipeline, settings->defines, settings->define_count, &pipeFile);
+    }
+    if(!settings->atomic) open_remote(get_variable(&pipeFile, "!remote_cache"));
+    register_cleanup(close_remote);
+
+    // Step 3: Process
+    // Flows given on the command line run in order, else the default one
+    char defaultFlow[256];
+    const char* const* flows = settings->flows;
+    size_t flowCount = settings->flow_count;
+    const char* fallback = NULL;
+    if(flowCount == 0)
+    {
+        fallback = default_flow(&pipeFile, defaultFlow, sizeof(defaultFlow));
+        if(fallback == NULL) log_fatal("The pipe file defines no flow to run.", PROCESS);
+        flows = &fallback;
+        flowCount = 1;
+    }
+
+    // Step 4: Execute
+    if(settings->traceFile) open_trace(settings->traceFile);
+    init_cgroups(get_variable(&pipeFile, "!job_cgroup"));
+    init_workers(settings->jobs);
+    register_cleanup(close_workers);
+    init_throttle(worker_count(), settings->autoJobs);
+    size_t failed = 0;
+    for(size_t i = 0; i < flowCount && failed == 0; i++)
+    {
+        char spanName[128];
+        snprintf(spanName, sizeof(spanName), "Flow %s", flows[i]);
+        LogSpan span = span_begin(spanName, PROCESS);
+
+        BuildPlan plan;
+        if(!plan_flow(&pipeFile, flows[i], &plan))
+        {
+            free_plan(&plan);
+            log_fatal("Could not plan the flow.", PROCESS);
+        }
+        check_plan(&plan);
+        failed = run_plan(&plan);
+        free_plan(&plan);
+        uint64_t elapsed = span_end(&span);
+        trace_slice(TRACE_FLOW_TRACK, spanName, "flow", span.begin, span.begin + elapsed, NULL);
+    }
+
+    close_workers();
+    close_trace();
+    close_pipefile(&pipeFile);
+    close_remote();
+    close_store();
+    close_timings();
+    close_history();
+    close_dir_cache();
+    close_cache();
+    close_paths();
+    clear_config(settings);
+    close_logging();
+    return failed == 0 ? 0 : 1;
+}
+
+/*
+ * Plan of execution:
+ * - Build minimal executor: pass direct pipeline commands to execution
+ * - Build minimal reader: elementary processing of pipeline file -> minimal cachable state
+ * - 
+ * 
+ * 
+ * The full pipeline execution model is as follows:
+ * - 1. Load: Load the cache (if any) and use it to configure default pipe behavior
+ * - 2. Read: Read the pipeline file and determine the extent of it's validity (has it been renewed?)
+ *            Also includes the interpretation and caching of the file if it is new, to create a cachable state.
+ * - 3. Process: Process the cache data in order to determine the build graph and it's execution pipeline.
+ * - 4. Execute: Execute the appropriate commands in the appropriate order, determined by the processing state.
+ * 
+ * need to define structs for actions, pipes and flows.
+ * executor takes in a string-like command and simply, naively executes it, prints result, fails, checks and makes sure execution is a-ok.
+ * Process is the one that takes an action and uses pipe struct to determine variables mappings and transforms them into string-commands.
+ * Read is the one that parses and creates action, pipe and flow structs.
  */
\ No newline at end of file
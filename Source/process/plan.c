@@ -0,0 +1,1127 @@
+#define _GNU_SOURCE     // memmem
+
+#include "process.h"
+
+#include "../util/util.h"
+#include "../util/statbatch.h"
+#include "../load/load.h"
+#include "../execute/execute.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define OUTPUT_SLOTS_MIN 256    // initial output table slots, always a power of 2
+#define MATCH_SLOTS_MIN 64      // initial matched-id set slots, always a power of 2
+
+typedef struct
+{
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} Text;
+
+typedef struct
+{
+    PathID id;
+    const char* path;       // canonical
+} Match;
+
+typedef struct
+{
+    Match* matches;
+    size_t count;
+    size_t capacity;
+    uint32_t* slots;        // PathID -> match index + 1, open addressing
+    size_t slotCount;
+} MatchList;
+
+//* Values only known once a mapping is expanded
+typedef struct
+{
+    const char* in;
+    const char* out;
+    const char* stem;
+} Expansion;
+
+typedef struct
+{
+    const PipeFile* file;
+    BuildPlan* plan;
+    const Node* pipe;
+    const Node* action;
+    const char* pipeName;
+    uint32_t pipeIndex;
+    size_t plannedLimit;    // only outputs of earlier pipes may be inputs
+    CheckMode check;
+    const char* actionName; // in the plan arena
+    uint64_t memory;        // per-job weight of the action
+    uint32_t cpu;           // thousandths of a CPU a job may use, 0 for no limit
+    uint32_t pool;          // BuildPlan.pools index + 1, 0 for none
+    const char* command;    // action template, in the plan arena
+    char inRoot[MAX_PATH_SIZE];
+    char outRoot[MAX_PATH_SIZE];
+} PipeScope;
+
+
+
+// ==== Internal Helpers ====
+
+static void text_append(Text* text, const char* data, size_t length)
+{
+    if(text->failed) return;
+    if(text->length + length + 1 > text->capacity)
+    {
+        size_t capacity = text->capacity ? text->capacity : 128;
+        while(text->length + length + 1 > capacity) capacity *= 2;
+        char* grown = (char*)realloc(text->data, capacity);
+        if(grown == NULL)
+        {
+            text->failed = true;
+            return;
+        }
+        text->data = grown;
+        text->capacity = capacity;
+    }
+    memcpy(&text->data[text->length], data, length);
+    text->length += length;
+    text->data[text->length] = '\0';
+}
+
+static void text_string(Text* text, const char* str)
+{
+    text_append(text, str, strlen(str));
+}
+
+static void text_free(Text* text)
+{
+    free(text->data);
+    memset(text, 0, sizeof(Text));
+}
+
+//* Append <path>, single-quoted if the shell would split or expand it
+static void text_path(Text* text, const char* path)
+{
+    bool plain = path[0] != '\0';
+    for(const char* c = path; *c != '\0' && plain; c++)
+        plain = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || strchr("_./+-=,:@%", *c) != NULL;
+    if(plain)
+    {
+        text_string(text, path);
+        return;
+    }
+
+    text_append(text, "'", 1);
+    for(const char* c = path; *c != '\0'; c++)
+    {
+        if(*c == '\'') text_append(text, "'\\''", 4);
+        else text_append(text, c, 1);
+    }
+    text_append(text, "'", 1);
+}
+
+
+static void plan_error(const PipeScope* scope, uint32_t line, const char* format, ...)
+{
+    char detail[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(detail, sizeof(detail), format, args);
+    va_end(args);
+
+    char buf[768];
+    if(scope != NULL && scope->pipeName != NULL)
+        snprintf(buf, sizeof(buf), "Pipe file, line %u (pipe '%s'): %s", line, scope->pipeName, detail);
+    else snprintf(buf, sizeof(buf), "Pipe file, line %u: %s", line, detail);
+    log_full(buf, CRITICAL, PROCESS);
+}
+
+
+static const Node* find_block(const PipeFile* file, NodeKind kind, const char* name, size_t length)
+{
+    const Node* found = NULL;
+    for(const Node* node = get_node(file, file->nodes[0].child); node != NULL; node = get_node(file, node->next))
+        if(node->kind == kind && node->name.length == length && memcmp(&file->source[node->name.offset], name, length) == 0)
+            found = node;   // later definitions win
+    return found;
+}
+
+//* Name of an assignment without its '@' parameter marker
+static bool assign_named(const PipeFile* file, const Node* node, const char* name, size_t length)
+{
+    Slice slice = node->name;
+    if(slice.length > 0 && file->source[slice.offset] == '@')
+    {
+        slice.offset++;
+        slice.length--;
+    }
+    return slice.length == length && memcmp(&file->source[slice.offset], name, length) == 0;
+}
+
+//* Last assignment of <name> directly in <block> with the given "default" flag
+static const Node* find_assign(const PipeFile* file, const Node* block, const char* name, size_t length, bool isDefault)
+{
+    if(block == NULL) return NULL;
+
+    const Node* found = NULL;
+    for(const Node* node = get_node(file, block->child); node != NULL; node = get_node(file, node->next))
+        if(node->kind == NODE_ASSIGN && (bool)node->isDefault == isDefault && assign_named(file, node, name, length))
+            found = node;
+    return found;
+}
+
+
+/*
+ * Precedence (pipe.rst 3.3): explicit assignments of the pipe, then of
+ * the action, then the configuration, then defaults of the pipe and of
+ * the action. Values are used as written: no recursive expansion.
+*/
+static bool lookup_variable(const PipeScope* scope, const char* name, size_t length, Text* out)
+{
+    const Node* candidates[2][2] = {{scope->pipe, scope->action}, {scope->pipe, scope->action}};
+    for(int i = 0; i < 2; i++)
+    {
+        const Node* node = find_assign(scope->file, candidates[0][i], name, length, false);
+        if(node == NULL) continue;
+        text_append(out, &scope->file->source[node->value.offset], node->value.length);
+        return true;
+    }
+
+    char key[256];
+    if(length < sizeof(key))
+    {
+        memcpy(key, name, length);
+        key[length] = '\0';
+        const char* value = get_variable(scope->file, key);
+        if(value != NULL)
+        {
+            text_string(out, value);
+            return true;
+        }
+    }
+
+    for(int i = 0; i < 2; i++)
+    {
+        const Node* node = find_assign(scope->file, candidates[1][i], name, length, true);
+        if(node == NULL) continue;
+        text_append(out, &scope->file->source[node->value.offset], node->value.length);
+        return true;
+    }
+    return false;
+}
+
+//* Replace $(name) references in <text> -> false on an unknown variable (already logged)
+static bool expand(const PipeScope* scope, uint32_t line, const char* text, size_t length,
+                   const Expansion* expansion, Text* out)
+{
+    for(size_t at = 0; at < length; )
+    {
+        if(text[at] != '$' || at + 1 >= length || text[at + 1] != '(')
+        {
+            text_append(out, &text[at++], 1);
+            continue;
+        }
+
+        const char* name = &text[at + 2];
+        const char* close = memchr(name, ')', length - at - 2);
+        if(close == NULL)
+        {
+            plan_error(scope, line, "unterminated variable reference.");
+            return false;
+        }
+        size_t nameLength = close - name;
+        at = close - text + 1;
+
+        const char* special = NULL;
+        if(expansion != NULL && nameLength == 2 && memcmp(name, "in", 2) == 0) special = expansion->in;
+        if(expansion != NULL && nameLength == 3 && memcmp(name, "out", 3) == 0) special = expansion->out;
+        if(expansion != NULL && nameLength == 4 && memcmp(name, "stem", 4) == 0) special = expansion->stem;
+        if(special != NULL) text_string(out, special);
+        else if(!lookup_variable(scope, name, nameLength, out))
+        {
+            plan_error(scope, line, "unknown variable '%.*s'.", (int)nameLength, name);
+            return false;
+        }
+    }
+    return !out->failed;
+}
+
+
+static uint64_t output_slot(PathID id)
+{
+    return (uint64_t)id * 0x9E3779B97F4A7C15ull;
+}
+
+//* Job index + 1 producing <id>, 0 if none
+static uint32_t find_output(const BuildPlan* plan, PathID id)
+{
+    if(plan->outputSlots == NULL) return 0;
+    size_t mask = plan->slotCount - 1;
+    for(size_t slot = (output_slot(id) >> 32) & mask; plan->outputSlots[slot] != 0; slot = (slot + 1) & mask)
+        if(plan->jobs[plan->outputSlots[slot] - 1].output == id) return plan->outputSlots[slot];
+    return 0;
+}
+
+static bool insert_output(BuildPlan* plan, PathID id, uint32_t index)
+{
+    if(plan->outputSlots == NULL || (plan->count + 1) * 10 >= plan->slotCount * 7)
+    {
+        size_t oldCount = plan->slotCount;
+        uint32_t* old = plan->outputSlots;
+        size_t newCount = oldCount ? oldCount * 2 : OUTPUT_SLOTS_MIN;
+        uint32_t* grown = (uint32_t*)calloc(newCount, sizeof(uint32_t));
+        if(grown == NULL) return false;
+
+        plan->outputSlots = grown;
+        plan->slotCount = newCount;
+        for(size_t slot = 0; slot < oldCount; slot++)
+        {
+            if(old[slot] == 0) continue;
+            size_t mask = newCount - 1;
+            size_t at = (output_slot(plan->jobs[old[slot] - 1].output) >> 32) & mask;
+            while(grown[at] != 0) at = (at + 1) & mask;
+            grown[at] = old[slot];
+        }
+        free(old);
+    }
+
+    size_t mask = plan->slotCount - 1;
+    size_t slot = (output_slot(id) >> 32) & mask;
+    while(plan->outputSlots[slot] != 0) slot = (slot + 1) & mask;
+    plan->outputSlots[slot] = index + 1;
+    return true;
+}
+
+
+//* Slot of <id> in the list's set, or the free slot it would take
+static uint32_t* find_match(const MatchList* list, PathID id)
+{
+    size_t mask = list->slotCount - 1;
+    for(size_t slot = (output_slot(id) >> 32) & mask; ; slot = (slot + 1) & mask)
+        if(list->slots[slot] == 0 || list->matches[list->slots[slot] - 1].id == id) return &list->slots[slot];
+}
+
+//* Append a match unless its path is already in the list
+static bool add_match(MatchList* list, PathID id, const char* path)
+{
+    if(list->slots == NULL || (list->count + 1) * 10 >= list->slotCount * 7)
+    {
+        size_t oldCount = list->slotCount;
+        uint32_t* old = list->slots;
+        size_t newCount = oldCount ? oldCount * 2 : MATCH_SLOTS_MIN;
+        list->slots = (uint32_t*)calloc(newCount, sizeof(uint32_t));
+        if(list->slots == NULL)
+        {
+            list->slots = old;
+            return false;
+        }
+        list->slotCount = newCount;
+        for(size_t slot = 0; slot < oldCount; slot++)
+            if(old[slot] != 0) *find_match(list, list->matches[old[slot] - 1].id) = old[slot];
+        free(old);
+    }
+
+    uint32_t* slot = find_match(list, id);
+    if(*slot != 0) return true;
+
+    if(list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        Match* grown = (Match*)realloc(list->matches, capacity * sizeof(Match));
+        if(grown == NULL) return false;
+        list->matches = grown;
+        list->capacity = capacity;
+    }
+    list->matches[list->count++] = (Match){id, path};
+    *slot = (uint32_t)list->count;
+    return true;
+}
+
+static void free_matches(MatchList* list)
+{
+    free(list->matches);
+    free(list->slots);
+    memset(list, 0, sizeof(MatchList));
+}
+
+static int compare_matches(const void* left, const void* right)
+{
+    return strcmp(((const Match*)left)->path, ((const Match*)right)->path);
+}
+
+//* <root>/<path>, or <path> alone when the root is the current directory
+static void join_root(const char* root, const char* path, size_t length, char* buf, size_t size)
+{
+    if(strcmp(root, ".") == 0) snprintf(buf, size, "%.*s", (int)length, path);
+    else snprintf(buf, size, "%s/%.*s", root, (int)length, path);
+}
+
+
+//* Part of <path> standing for '*' in the output: relative to <root>, without <suffix>
+static void compute_stem(const char* root, const char* path, const char* suffix, char* buf, size_t size)
+{
+    size_t rootLength = strlen(root);
+    if(strcmp(root, ".") != 0 && strncmp(path, root, rootLength) == 0 && path[rootLength] == '/')
+        path += rootLength + 1;
+
+    size_t length = strlen(path);
+    size_t suffixLength = strlen(suffix);
+    if(suffixLength <= length && strcmp(&path[length - suffixLength], suffix) == 0) length -= suffixLength;
+    snprintf(buf, size, "%.*s", (int)length, path);
+}
+
+//* Literal tail of the pattern's last component: after the last '*', or the extension of a plain name
+static const char* pattern_suffix(const char* pattern)
+{
+    const char* last = strrchr(pattern, '/');
+    last = last != NULL ? last + 1 : pattern;
+    const char* star = strrchr(last, '*');
+    if(star != NULL)
+    {
+        star++;
+        while(*star == '?') star++;     // allow-empty marker
+        return star;
+    }
+    const char* dot = strrchr(last, '.');
+    return dot != NULL ? dot : "";
+}
+
+static bool input_exists(const PipeScope* scope, PathID id, const char* path)
+{
+    uint32_t producer = find_output(scope->plan, id);
+    if(producer != 0 && producer - 1 < scope->plannedLimit) return true;
+    return stat_path(path).exists;
+}
+
+
+//* Files matched by the mapping's input side, on disk or planned by earlier pipes
+static bool collect_inputs(PipeScope* scope, uint32_t line, const char* input, MatchList* list)
+{
+    BuildPlan* plan = scope->plan;
+    char pattern[MAX_PATH_SIZE];
+    join_root(scope->inRoot, input, strlen(input), pattern, sizeof(pattern));
+
+    if(strchr(input, '*') == NULL)
+    {
+        PathID id = intern_path(pattern);
+        char path[MAX_PATH_SIZE];
+        if(id == PATH_NONE || path_string(id, path, sizeof(path)) == 0 || !input_exists(scope, id, path))
+        {
+            plan_error(scope, line, "input '%s' does not exist.", pattern);
+            return false;
+        }
+        return add_match(list, id, arena_strndup(&plan->arena, path, strlen(path)));
+    }
+
+    GlobPattern glob;
+    if(!compile_glob(pattern, &glob))
+    {
+        plan_error(scope, line, "invalid pattern '%s'.", pattern);
+        return false;
+    }
+
+    GlobResult found;
+    bool ok = run_glob(&glob, 0, &found);
+    for(size_t i = 0; ok && i < found.count; i++)
+        ok = add_match(list, found.ids[i], arena_strndup(&plan->arena, found.paths[i], strlen(found.paths[i])));
+    for(size_t i = 0; ok && i < scope->plannedLimit; i++)
+        if(glob_match(&glob, plan->jobs[i].outputPath)) ok = add_match(list, plan->jobs[i].output, plan->jobs[i].outputPath);
+    free_glob_result(&found);
+
+    bool allowEmpty = glob.allowEmpty;
+    free_glob(&glob);
+    if(!ok)
+    {
+        log_full("Could not allocate the matched inputs.", CRITICAL, PROCESS);
+        return false;
+    }
+    if(list->count == 0 && !allowEmpty)
+    {
+        plan_error(scope, line, "'%s' matches no file (append '?' to allow that).", pattern);
+        return false;
+    }
+    qsort(list->matches, list->count, sizeof(Match), compare_matches);
+    return true;
+}
+
+//* Extra dependencies after the mapping's ':' ("-" for none)
+static bool collect_extras(PipeScope* scope, uint32_t line, const char* extras, MatchList* list)
+{
+    for(const char* word = extras; *word != '\0'; )
+    {
+        while(*word == ' ' || *word == '\t') word++;
+        size_t length = strcspn(word, " \t");
+        if(length == 0) break;
+        const char* name = word;
+        word += length;
+
+        while(length > 0 && (*name == '!' || *name == '+'))
+        {
+            name++;
+            length--;
+        }
+        if(length == 0 || (length == 1 && *name == '-') || memchr(name, '<', length) != NULL) continue;
+
+        char path[MAX_PATH_SIZE];
+        snprintf(path, sizeof(path), "%.*s", (int)length, name);
+        PathID id = intern_path(path);
+        char canonical[MAX_PATH_SIZE];
+        if(id == PATH_NONE || path_string(id, canonical, sizeof(canonical)) == 0 || !input_exists(scope, id, canonical))
+        {
+            plan_error(scope, line, "dependency '%s' does not exist.", path);
+            return false;
+        }
+        if(!add_match(list, id, arena_strndup(&scope->plan->arena, canonical, strlen(canonical)))) return false;
+    }
+    return true;
+}
+
+
+static bool add_job(PipeScope* scope, uint32_t line, const char* output, const Match* inputs, size_t count,
+                    const MatchList* extras, const char* stem)
+{
+    BuildPlan* plan = scope->plan;
+    PathID id = intern_path(output);
+    char path[MAX_PATH_SIZE];
+    if(id == PATH_NONE || path_string(id, path, sizeof(path)) == 0)
+    {
+        plan_error(scope, line, "invalid output '%s'.", output);
+        return false;
+    }
+    uint32_t previous = find_output(plan, id);
+    if(previous != 0)
+    {
+        plan_error(scope, line, "'%s' is already produced by pipe '%s'.", path, plan->pipes[plan->jobs[previous - 1].pipe]);
+        return false;
+    }
+
+    Text in = {0};
+    for(size_t i = 0; i < count; i++)
+    {
+        if(i > 0) text_append(&in, " ", 1);
+        text_path(&in, inputs[i].path);
+    }
+    for(size_t i = 0; i < extras->count; i++)
+    {
+        text_append(&in, " ", 1);
+        text_path(&in, extras->matches[i].path);
+    }
+    Text out = {0};
+    text_path(&out, path);
+
+    Text command = {0};
+    Expansion expansion = {in.data != NULL ? in.data : "", out.data, stem};
+    bool expanded = expand(scope, line, scope->command, strlen(scope->command), &expansion, &command);
+    text_free(&in);
+    text_free(&out);
+    if(!expanded)
+    {
+        text_free(&command);
+        return false;
+    }
+
+    if(plan->count == plan->capacity)
+    {
+        size_t capacity = plan->capacity ? plan->capacity * 2 : 64;
+        PlanJob* grown = (PlanJob*)realloc(plan->jobs, capacity * sizeof(PlanJob));
+        if(grown == NULL)
+        {
+            text_free(&command);
+            return false;
+        }
+        plan->jobs = grown;
+        plan->capacity = capacity;
+    }
+
+    PlanJob* job = &plan->jobs[plan->count];
+    memset(job, 0, sizeof(PlanJob));
+    job->output = id;
+    job->outputPath = arena_strndup(&plan->arena, path, strlen(path));
+    job->inputCount = (uint32_t)(count + extras->count);
+    job->inputs = (PathID*)arena_alloc(&plan->arena, (job->inputCount + 1) * sizeof(PathID));
+    job->command = arena_strndup(&plan->arena, command.data, command.length);
+    job->pipe = scope->pipeIndex;
+    job->action = scope->actionName;
+    job->check = scope->check;
+    job->timingKey = timing_key(scope->actionName, path);
+    job->memory = scope->memory;
+    job->cpu = scope->cpu;
+    job->pool = scope->pool;
+    text_free(&command);
+    if(job->outputPath == NULL || job->inputs == NULL || job->command == NULL) return false;
+
+    for(size_t i = 0; i < count; i++) job->inputs[i] = inputs[i].id;
+    for(size_t i = 0; i < extras->count; i++) job->inputs[count + i] = extras->matches[i].id;
+    if(!insert_output(plan, id, (uint32_t)plan->count)) return false;
+    plan->count++;
+    return true;
+}
+
+
+/*
+ * "in -> out [: extras]": a pattern gives one job per matched file and
+ * '*' in the output stands for the file's stem; list(pattern) gives a
+ * single job taking every match.
+*/
+static bool plan_mapping(PipeScope* scope, const Node* mapping)
+{
+    const PipeFile* file = scope->file;
+    Text input = {0};
+    Text output = {0};
+    Text extra = {0};
+    MatchList inputs = {0};
+    MatchList extras = {0};
+    bool ok = expand(scope, mapping->line, &file->source[mapping->name.offset], mapping->name.length, NULL, &input)
+        && expand(scope, mapping->line, &file->source[mapping->value.offset], mapping->value.length, NULL, &output)
+        && expand(scope, mapping->line, &file->source[mapping->extra.offset], mapping->extra.length, NULL, &extra);
+
+    const char* inText = input.data != NULL ? input.data : "";
+    const char* outText = output.data != NULL ? output.data : "";
+    bool many = ok && strncmp(inText, "list(", 5) == 0 && input.length > 6 && inText[input.length - 1] == ')';
+    if(many)
+    {
+        input.data[input.length - 1] = '\0';
+        inText += 5;
+    }
+    if(ok && (strchr(inText, '(') != NULL || strchr(outText, '(') != NULL))
+    {
+        plan_error(scope, mapping->line, "directives other than list() are not supported in mappings yet.");
+        ok = false;
+    }
+    if(ok && (outText[0] == '\0' || (many && strchr(outText, '*') != NULL)))
+    {
+        plan_error(scope, mapping->line, many ? "list() maps to a single output, '*' has no stem." : "mapping without an output.");
+        ok = false;
+    }
+
+    ok = ok && collect_inputs(scope, mapping->line, inText, &inputs)
+            && collect_extras(scope, mapping->line, extra.data != NULL ? extra.data : "", &extras);
+
+    char target[MAX_PATH_SIZE];
+    if(ok && many && inputs.count > 0)
+    {
+        join_root(scope->outRoot, outText, strlen(outText), target, sizeof(target));
+        ok = add_job(scope, mapping->line, target, inputs.matches, inputs.count, &extras, "");
+    }
+    const char* suffix = pattern_suffix(inText);
+    for(size_t i = 0; ok && !many && i < inputs.count; i++)
+    {
+        char stem[MAX_PATH_SIZE];
+        compute_stem(scope->inRoot, inputs.matches[i].path, suffix, stem, sizeof(stem));
+
+        Text name = {0};
+        for(const char* c = outText; *c != '\0'; c++)
+        {
+            if(*c == '*') text_string(&name, stem);
+            else text_append(&name, c, 1);
+        }
+        ok = !name.failed;
+        if(ok) join_root(scope->outRoot, name.data, name.length, target, sizeof(target));
+        text_free(&name);
+        ok = ok && add_job(scope, mapping->line, target, &inputs.matches[i], 1, &extras, stem);
+    }
+
+    free_matches(&inputs);
+    free_matches(&extras);
+    text_free(&input);
+    text_free(&output);
+    text_free(&extra);
+    return ok;
+}
+
+
+//* "in -> out" search roots, from the pipe header or its search: assignment
+static bool set_roots(PipeScope* scope, uint32_t line, const char* text, size_t length)
+{
+    Text expanded = {0};
+    if(!expand(scope, line, text, length, NULL, &expanded))
+    {
+        text_free(&expanded);
+        return false;
+    }
+
+    const char* arrow = strstr(expanded.data, "->");
+    if(arrow == NULL)
+    {
+        plan_error(scope, line, "search expects '<input dir> -> <output dir>'.");
+        text_free(&expanded);
+        return false;
+    }
+
+    char left[MAX_PATH_SIZE];
+    char right[MAX_PATH_SIZE];
+    const char* from = expanded.data;
+    const char* to = arrow + 2;
+    while(*from == ' ' || *from == '\t') from++;
+    while(*to == ' ' || *to == '\t') to++;
+    size_t fromLength = arrow - from;
+    while(fromLength > 0 && (from[fromLength - 1] == ' ' || from[fromLength - 1] == '\t')) fromLength--;
+    snprintf(left, sizeof(left), "%.*s", (int)fromLength, from);
+    snprintf(right, sizeof(right), "%s", to);
+    text_free(&expanded);
+
+    if(normalize_path(left, scope->inRoot, sizeof(scope->inRoot)) == NULL ||
+       normalize_path(right, scope->outRoot, sizeof(scope->outRoot)) == NULL)
+    {
+        plan_error(scope, line, "search directories are too long.");
+        return false;
+    }
+    return true;
+}
+
+
+static bool plan_pipe(PipeScope* scope)
+{
+    const PipeFile* file = scope->file;
+    const Node* pipe = scope->pipe;
+    strcpy(scope->inRoot, ".");
+    strcpy(scope->outRoot, ".");
+
+    // header: "<action> [atomic]" or "<input dir> -> <output dir>"
+    const char* actionName = NULL;
+    size_t actionLength = 0;
+    const char* header = &file->source[pipe->header.offset];
+    if(pipe->header.length > 0 && memmem(header, pipe->header.length, "->", 2) != NULL)
+    {
+        if(!set_roots(scope, pipe->line, header, pipe->header.length)) return false;
+    }
+    else
+    {
+        for(size_t at = 0; at < pipe->header.length; )
+        {
+            while(at < pipe->header.length && (header[at] == ' ' || header[at] == '\t')) at++;
+            size_t end = at;
+            while(end < pipe->header.length && header[end] != ' ' && header[end] != '\t') end++;
+            if(end > at && !(end - at == 6 && memcmp(&header[at], "atomic", 6) == 0))
+            {
+                actionName = &header[at];
+                actionLength = end - at;
+            }
+            at = end;
+        }
+    }
+
+    const Node* search = find_assign(file, pipe, "search", 6, false);
+    if(search != NULL && !set_roots(scope, search->line, &file->source[search->value.offset], search->value.length))
+        return false;
+    const Node* actionAssign = find_assign(file, pipe, "action", 6, false);
+    if(actionAssign != NULL)
+    {
+        actionName = &file->source[actionAssign->value.offset];
+        actionLength = actionAssign->value.length;
+    }
+    for(const Node* node = get_node(file, pipe->child); node != NULL && actionName == NULL; node = get_node(file, node->next))
+        if(node->kind == NODE_ITEM && find_block(file, NODE_ACTION, &file->source[node->name.offset], node->name.length) != NULL)
+        {
+            actionName = &file->source[node->name.offset];
+            actionLength = node->name.length;
+        }
+
+    if(actionName == NULL)
+    {
+        plan_error(scope, pipe->line, "no action to run.");
+        return false;
+    }
+    scope->action = find_block(file, NODE_ACTION, actionName, actionLength);
+    if(scope->action == NULL)
+    {
+        plan_error(scope, pipe->line, "unknown action '%.*s'.", (int)actionLength, actionName);
+        return false;
+    }
+
+    const Node* action = scope->action;
+    scope->actionName = arena_strndup(&scope->plan->arena, actionName, actionLength);
+    if(scope->actionName == NULL) return false;
+    const char* actionHeader = &file->source[action->header.offset];
+    scope->check = CHECK_TIME;
+    if(memmem(actionHeader, action->header.length, "static", 6) != NULL) scope->check = CHECK_STATIC;
+    if(memmem(actionHeader, action->header.length, "hash", 4) != NULL) scope->check = CHECK_HASH;
+
+    // memory: <size> weighs each job against the memory left on the host
+    const Node* memory = find_assign(file, action, "memory", 6, false);
+    if(memory != NULL)
+    {
+        char size[64];
+        scope->memory = parse_size(slice_copy(file, memory->value, size, sizeof(size)));
+        if(scope->memory == 0)
+        {
+            plan_error(scope, memory->line, "invalid memory size '%.*s'.", (int)memory->value.length, &file->source[memory->value.offset]);
+            return false;
+        }
+    }
+
+    // cpu: <cores> caps each job, enforced when jobs run in cgroups
+    const Node* cpu = find_assign(file, action, "cpu", 3, false);
+    if(cpu != NULL)
+    {
+        char cores[64];
+        char* end = NULL;
+        double parsed = strtod(slice_copy(file, cpu->value, cores, sizeof(cores)), &end);
+        if(end == cores || *end != '\0' || parsed < 0.001 || parsed > 4096.0)
+        {
+            plan_error(scope, cpu->line, "invalid cpu count '%.*s'.", (int)cpu->value.length, &file->source[cpu->value.offset]);
+            return false;
+        }
+        scope->cpu = (uint32_t)(parsed * 1000.0 + 0.5);
+    }
+
+    // pool: <name> shares the pool's capacity with every other action in it
+    const Node* pool = find_assign(file, action, "pool", 4, false);
+    for(size_t i = 0; pool != NULL && i < scope->plan->poolCount && scope->pool == 0; i++)
+        if(slice_equals(file, pool->value, scope->plan->pools[i].name)) scope->pool = (uint32_t)i + 1;
+    if(pool != NULL && scope->pool == 0)
+    {
+        plan_error(scope, pool->line, "unknown pool '%.*s'.", (int)pool->value.length, &file->source[pool->value.offset]);
+        return false;
+    }
+
+    const Node* command = find_assign(file, action, "command", 7, false);
+    Slice commandText = command != NULL ? command->value : (Slice){0, 0};
+    for(const Node* node = get_node(file, action->child); node != NULL && command == NULL; node = get_node(file, node->next))
+        if(node->kind == NODE_ITEM)
+        {
+            commandText = node->name;
+            break;
+        }
+    if(commandText.length == 0)
+    {
+        plan_error(scope, action->line, "action '%.*s' has no command.", (int)actionLength, actionName);
+        return false;
+    }
+    scope->command = arena_strndup(&scope->plan->arena, &file->source[commandText.offset], commandText.length);
+    if(scope->command == NULL) return false;
+
+    // mappings sit in the pipe or in its map block
+    for(const Node* node = get_node(file, pipe->child); node != NULL; node = get_node(file, node->next))
+    {
+        if(node->kind == NODE_MAPPING && !plan_mapping(scope, node)) return false;
+        if(node->kind != NODE_BLOCK || !slice_equals(file, node->name, "map")) continue;
+        for(const Node* entry = get_node(file, node->child); entry != NULL; entry = get_node(file, entry->next))
+            if(entry->kind == NODE_MAPPING && !plan_mapping(scope, entry)) return false;
+    }
+    return true;
+}
+
+
+/*
+ * pool <name>: <capacity> { } or pool <name> { capacity: <n> }. Pools
+ * are global, so they are read whichever flow runs.
+*/
+static bool load_pools(const PipeFile* file, BuildPlan* plan)
+{
+    size_t count = 0;
+    for(const Node* node = get_node(file, file->nodes[0].child); node != NULL; node = get_node(file, node->next))
+        if(node->kind == NODE_POOL) count++;
+    plan->pools = (PlanPool*)arena_alloc(&plan->arena, (count + 1) * sizeof(PlanPool));
+    if(plan->pools == NULL) return false;
+
+    for(const Node* node = get_node(file, file->nodes[0].child); node != NULL; node = get_node(file, node->next))
+    {
+        if(node->kind != NODE_POOL) continue;
+        Slice value = node->header;
+        const Node* capacity = find_assign(file, node, "capacity", 8, false);
+        if(capacity != NULL) value = capacity->value;
+
+        char text[32];
+        char* end = NULL;
+        unsigned long parsed = strtoul(slice_copy(file, value, text, sizeof(text)), &end, 10);
+        if(value.length == 0 || value.length >= sizeof(text) || *end != '\0' || parsed == 0 || parsed > UINT32_MAX)
+        {
+            plan_error(NULL, node->line, "pool '%.*s' needs a capacity of at least 1.", (int)node->name.length, &file->source[node->name.offset]);
+            return false;
+        }
+
+        PlanPool* pool = &plan->pools[plan->poolCount++];
+        pool->name = arena_strndup(&plan->arena, &file->source[node->name.offset], node->name.length);
+        pool->capacity = (uint32_t)parsed;
+        if(pool->name == NULL) return false;
+    }
+    return true;
+}
+
+
+//* Record which jobs read each output, as one shared array
+static bool link_jobs(BuildPlan* plan)
+{
+    size_t edges = 0;
+    for(size_t j = 0; j < plan->count; j++)
+        for(uint32_t i = 0; i < plan->jobs[j].inputCount; i++)
+        {
+            uint32_t producer = find_output(plan, plan->jobs[j].inputs[i]);
+            if(producer != 0 && producer - 1 != j)
+            {
+                plan->jobs[producer - 1].dependentCount++;
+                edges++;
+            }
+        }
+
+    uint32_t* dependents = (uint32_t*)arena_alloc(&plan->arena, (edges + 1) * sizeof(uint32_t));
+    if(dependents == NULL) return false;
+    for(size_t j = 0; j < plan->count; j++)
+    {
+        plan->jobs[j].dependents = dependents;
+        dependents += plan->jobs[j].dependentCount;
+        plan->jobs[j].dependentCount = 0;
+    }
+
+    for(size_t j = 0; j < plan->count; j++)
+        for(uint32_t i = 0; i < plan->jobs[j].inputCount; i++)
+        {
+            uint32_t producer = find_output(plan, plan->jobs[j].inputs[i]);
+            if(producer == 0 || producer - 1 == j) continue;
+            PlanJob* from = &plan->jobs[producer - 1];
+            from->dependents[from->dependentCount++] = (uint32_t)j;
+        }
+    return true;
+}
+
+
+static int compare_ids(const void* left, const void* right)
+{
+    PathID a = *(const PathID*)left;
+    PathID b = *(const PathID*)right;
+    return (a > b) - (a < b);
+}
+
+static size_t find_id(const PathID* ids, size_t count, PathID id)
+{
+    size_t low = 0;
+    size_t high = count;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(ids[middle] < id) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+
+/*
+ * Content hashes of the existing inputs of hash-mode jobs whose output
+ * exists, indexed like <ids>. A file whose batched stat matches the file
+ * cache keeps its cached hash; the others are read once, however many
+ * jobs use them, on every processor -> NULL on allocation failure.
+*/
+static uint64_t* hash_checked_inputs(const BuildPlan* plan, const PathID* ids, const char** paths, size_t count,
+                                     const StatBatch* batch)
+{
+    uint64_t* hashes = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+    size_t* wanted = (size_t*)malloc((count + 1) * sizeof(size_t));
+    const char** files = (const char**)malloc((count + 1) * sizeof(const char*));
+    PathID* fileIds = (PathID*)malloc((count + 1) * sizeof(PathID));
+    uint64_t* found = (uint64_t*)malloc((count + 1) * sizeof(uint64_t));
+    if(hashes == NULL || wanted == NULL || files == NULL || fileIds == NULL || found == NULL)
+    {
+        free(hashes);
+        free(wanted);
+        free(files);
+        free(fileIds);
+        free(found);
+        return NULL;
+    }
+
+    for(size_t j = 0; j < plan->count; j++)
+    {
+        const PlanJob* job = &plan->jobs[j];
+        if(job->check != CHECK_HASH || batch->type[find_id(ids, count, job->output)] == FILE_TYPE_NONE) continue;
+        for(uint32_t i = 0; i < job->inputCount; i++)
+        {
+            size_t in = find_id(ids, count, job->inputs[i]);
+            if(batch->type[in] != FILE_TYPE_NONE) hashes[in] = 1;     // wanted, hashed below
+        }
+    }
+
+    size_t wantedCount = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        if(hashes[i] == 0) continue;
+        FileRecord cached;
+        if(cache_lookup_id(ids[i], &cached) && cached.hash != 0 && cached.mtime == batch->mtime[i] &&
+           cached.size == batch->size[i] && cached.inode == batch->inode[i])
+        {
+            hashes[i] = cached.hash;
+            continue;
+        }
+        wanted[wantedCount] = i;
+        fileIds[wantedCount] = ids[i];
+        files[wantedCount++] = paths[i];
+    }
+    hash_files(files, fileIds, wantedCount, found, 0);
+    for(size_t k = 0; k < wantedCount; k++) hashes[wanted[k]] = found[k];
+
+    free(wanted);
+    free(files);
+    free(fileIds);
+    free(found);
+    return hashes;
+}
+
+
+
+// ==== Interface ====
+
+bool plan_flow(const PipeFile* file, const char* flow, BuildPlan* plan)
+{
+    memset(plan, 0, sizeof(BuildPlan));
+    arena_init(&plan->arena, 0);
+    plan->file = file;
+
+    const Node* flowNode = find_block(file, NODE_FLOW, flow, strlen(flow));
+    if(flowNode == NULL)
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "No flow named '%s' in the pipe file.", flow);
+        log_full(buf, CRITICAL, PROCESS);
+        return false;
+    }
+
+    if(!load_pools(file, plan)) return false;
+
+    size_t steps = 0;
+    for(const Node* node = get_node(file, flowNode->child); node != NULL; node = get_node(file, node->next)) steps++;
+    plan->pipes = (const char**)arena_alloc(&plan->arena, (steps + 1) * sizeof(const char*));
+    if(plan->pipes == NULL) return false;
+
+    for(const Node* node = get_node(file, flowNode->child); node != NULL; node = get_node(file, node->next))
+    {
+        if(node->kind != NODE_ITEM) continue;
+        Slice name = node->name;
+        if(name.length > 1 && file->source[name.offset] == '#')
+        {
+            name.offset++;
+            name.length--;
+        }
+
+        PipeScope scope;
+        memset(&scope, 0, sizeof(PipeScope));
+        scope.file = file;
+        scope.plan = plan;
+        scope.pipe = find_block(file, NODE_PIPE, &file->source[name.offset], name.length);
+        if(scope.pipe == NULL)
+        {
+            plan_error(NULL, node->line, "flow '%s' runs unknown pipe '%.*s'.", flow, (int)name.length, &file->source[name.offset]);
+            return false;
+        }
+        scope.pipeIndex = (uint32_t)plan->pipeCount;
+        scope.pipeName = arena_strndup(&plan->arena, &file->source[name.offset], name.length);
+        scope.plannedLimit = plan->count;
+        plan->pipes[plan->pipeCount++] = scope.pipeName;
+        if(scope.pipeName == NULL || !plan_pipe(&scope)) return false;
+    }
+
+    if(!link_jobs(plan))
+    {
+        log_full("Could not allocate the build graph.", CRITICAL, PROCESS);
+        return false;
+    }
+    return true;
+}
+
+
+const char* default_flow(const PipeFile* file, char* buf, size_t size)
+{
+    const char* configured = get_variable(file, "!default_flow");
+    if(configured != NULL && configured[0] != '\0')
+    {
+        snprintf(buf, size, "%s", configured);
+        return buf;
+    }
+
+    for(const Node* node = get_node(file, file->nodes[0].child); node != NULL; node = get_node(file, node->next))
+        if(node->kind == NODE_FLOW) return slice_copy(file, node->name, buf, size);
+    return NULL;
+}
+
+
+/*
+ * Every input and output is stated in one batch, and the inputs of
+ * hash-mode jobs hashed in one parallel pass. Jobs come in flow order,
+ * so a producer's decision is known before its readers look.
+*/
+void check_plan(BuildPlan* plan)
+{
+    size_t total = plan->count;
+    for(size_t j = 0; j < plan->count; j++) total += plan->jobs[j].inputCount;
+
+    PathID* ids = (PathID*)malloc((total + 1) * sizeof(PathID));
+    const char** paths = (const char**)malloc((total + 1) * sizeof(const char*));
+    StatBatch batch = {0};
+    size_t count = 0;
+    if(ids != NULL && paths != NULL)
+    {
+        for(size_t j = 0; j < plan->count; j++)
+        {
+            ids[count++] = plan->jobs[j].output;
+            for(uint32_t i = 0; i < plan->jobs[j].inputCount; i++) ids[count++] = plan->jobs[j].inputs[i];
+        }
+        qsort(ids, count, sizeof(PathID), compare_ids);
+        size_t unique = 0;
+        for(size_t i = 0; i < count; i++)
+            if(unique == 0 || ids[unique - 1] != ids[i]) ids[unique++] = ids[i];
+        count = unique;
+
+        for(size_t i = 0; i < count; i++)
+        {
+            char path[MAX_PATH_SIZE];
+            path_string(ids[i], path, sizeof(path));
+            paths[i] = arena_strndup(&plan->arena, path, strlen(path));
+        }
+        if(!stat_batch(paths, count, &batch, 0)) count = 0;
+    }
+    uint64_t* hashes = count > 0 ? hash_checked_inputs(plan, ids, paths, count, &batch) : NULL;
+
+    for(size_t j = 0; j < plan->count; j++)
+    {
+        PlanJob* job = &plan->jobs[j];
+        size_t out = count > 0 ? find_id(ids, count, job->output) : 0;
+        bool missing = count == 0 || batch.type[out] == FILE_TYPE_NONE;
+        RebuildReason reason = missing ? REBUILD_MISSING : REBUILD_NONE;
+
+        for(uint32_t i = 0; i < job->inputCount && reason == REBUILD_NONE && job->check != CHECK_STATIC; i++)
+        {
+            uint32_t producer = find_output(plan, job->inputs[i]);
+            if(producer != 0 && plan->jobs[producer - 1].stale)
+            {
+                reason = REBUILD_PRODUCER;
+                break;
+            }
+            size_t in = find_id(ids, count, job->inputs[i]);
+            if(batch.type[in] == FILE_TYPE_NONE || (job->check == CHECK_TIME && batch.mtime[in] > batch.mtime[out]))
+                reason = REBUILD_INPUT;
+        }
+
+        // hash mode compares the content against what this very output was built from
+        if(reason == REBUILD_NONE && job->check == CHECK_HASH)
+        {
+            uint64_t* inputs = hashes != NULL ? (uint64_t*)malloc((job->inputCount + 1) * sizeof(uint64_t)) : NULL;
+            uint64_t digest = 0;
+            for(uint32_t i = 0; inputs != NULL && i < job->inputCount; i++) inputs[i] = hashes[find_id(ids, count, job->inputs[i])];
+            if(inputs != NULL) digest = input_digest(inputs, job->inputCount);
+            if(digest == 0 || digest != get_input_digest(job->timingKey)) reason = REBUILD_INPUT;
+            free(inputs);
+        }
+
+        bool stale = reason != REBUILD_NONE;
+        job->stale = stale;
+        job->reason = (uint8_t)reason;
+        atomic_store(&job->state, stale ? JOB_WAITING : JOB_UP_TO_DATE);
+    }
+
+    free_stat_batch(&batch);
+    free(hashes);
+    free(ids);
+    free(paths);
+}
+
+
+void free_plan(BuildPlan* plan)
+{
+    free(plan->jobs);
+    free(plan->outputSlots);
+    arena_free(&plan->arena);
+    memset(plan, 0, sizeof(BuildPlan));
+}
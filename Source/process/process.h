@@ -0,0 +1,96 @@
+#pragma once
+// Process turns a flow into a build plan. Every mapping of every
+// pipe in the flow is expanded into jobs, one per output file, and
+// jobs are linked to the jobs producing their inputs. Running the
+// plan starts each job as soon as its own inputs are built, so pipes
+// of one flow overlap instead of running as strict barriers.
+
+#include "../global.h"
+#include "../read/read.h"
+#include "../util/path.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+typedef enum
+{
+    CHECK_TIME = 0,     // dynamic(time): rebuild when an input is newer than the output
+    CHECK_HASH,         // dynamic = hash: rebuild when an input's content changed
+    CHECK_STATIC,       // static: build only if the output is missing
+} CheckMode;
+
+typedef enum
+{
+    JOB_WAITING = 0,    // some producer is still running
+    JOB_READY,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_UP_TO_DATE,     // nothing to do
+    JOB_FAILED,
+    JOB_CANCELLED,      // a producer failed, or the build stopped
+} JobState;
+
+typedef struct
+{
+    PathID output;
+    const char* outputPath;     // canonical, in the plan arena
+    PathID* inputs;
+    uint32_t inputCount;
+    const char* command;        // fully expanded
+    uint32_t pipe;              // index into BuildPlan.pipes
+    const char* action;         // name of the action run, in the plan arena
+    CheckMode check;
+    uint64_t timingKey;         // (action, output) entry of the timing cache
+    uint64_t memory;            // bytes the action declares a job needs, 0 if unknown
+    uint64_t weight;            // bytes admission plans for: <memory>, else the last measured peak
+    uint32_t cpu;               // thousandths of a CPU a job may use, 0 for no limit
+    uint32_t pool;              // index into BuildPlan.pools + 1, 0 for none
+
+    uint32_t* dependents;       // jobs reading <output>
+    uint32_t dependentCount;
+    atomic_uint pending;        // producers still to finish before this job may start
+    _Atomic uint8_t state;      // JobState
+    bool stale;                 // must run
+    uint8_t reason;             // RebuildReason, why it must run
+    uint64_t priority;          // expected ns from this job's start to the end of its longest dependent chain
+} PlanJob;
+
+typedef struct
+{
+    const char* name;
+    uint32_t capacity;          // jobs of the pool running at once
+} PlanPool;
+
+typedef struct BuildPlan
+{
+    PlanJob* jobs;              // in flow order, so producers always come first
+    size_t count;
+    size_t capacity;
+    const char** pipes;         // pipe names, for messages
+    size_t pipeCount;
+    PlanPool* pools;            // every pool of the file, whether used or not
+    size_t poolCount;
+
+    uint32_t* outputSlots;      // output PathID -> job index + 1, open addressing
+    size_t slotCount;
+
+    const PipeFile* file;
+    Arena arena;
+} BuildPlan;
+
+
+
+// ==== Interface ====
+
+//* Expand the pipes of <flow> into jobs and link them -> false on error (already logged)
+bool plan_flow(const PipeFile* file, const char* flow, BuildPlan* plan);
+//* Flow to run when none is given: !default_flow, else the first flow of the file -> NULL if none
+const char* default_flow(const PipeFile* file, char* buf, size_t size);
+//* Decide which jobs are stale, from the stat of every input and output at once
+void check_plan(BuildPlan* plan);
+//* Run the stale jobs on the workers, each as soon as its producers finished, longest
+//* remaining chain first -> number of failed jobs
+size_t run_plan(BuildPlan* plan);
+//* Release the plan
+void free_plan(BuildPlan* plan);
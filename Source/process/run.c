@@ -0,0 +1,681 @@
+#include "process.h"
+
+#include "../util/util.h"
+#include "../load/load.h"
+#include "../execute/execute.h"
+#include "../util/pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef struct PlanRun PlanRun;
+
+#define DEFAULT_COST_NS 100000000ull   // guess for a job never timed, when nothing else was either
+#define HASH_PARALLEL_MIN 32            // inputs from which a job's files are hashed on every processor
+#define PREPARE_THREADS_MAX 8           // threads settling artifact keys ahead of admission
+
+//* Admission of one pool; jobs set aside while it is full wait in flow-priority order
+typedef struct
+{
+    uint32_t running;
+    uint32_t head;              // job index + 1 of the first waiting job, 0 if none
+    uint32_t tail;
+} PoolQueue;
+
+typedef enum
+{
+    FETCH_IDLE = 0,
+    FETCH_BUSY,                 // key being computed or artifact downloaded
+    FETCH_DONE,                 // <artifact> is final
+} FetchState;
+
+typedef struct
+{
+    PlanRun* run;
+    uint32_t index;
+    uint64_t startedAt;         // monotonic ns at submission
+    uint64_t artifact;          // artifact store key of the output, 0 if not stored
+    _Atomic uint8_t fetch;      // FetchState
+    bool queued;                // handed to the preparers once
+} JobContext;
+
+/*
+ * Completion callbacks only do bookkeeping and wake the main thread,
+ * which alone submits commands. A callback submitting on its own
+ * worker could block on a full lane that only it would drain.
+ * No more jobs than the throttle allows are handed out at once: the
+ * lanes run in submission order, so the choice of the next job stays
+ * here, and workers without a job sleep until one is admitted. A job
+ * whose pool is full steps aside so that others keep the workers busy.
+ * With the artifact store in use, a job that becomes ready first goes
+ * to the preparer threads, which hash its inputs for the artifact key
+ * and download the artifact; it enters the ready heap once its key is
+ * known, so the main thread never reads inputs before admitting a job.
+ * The same threads upload built outputs to the cache daemon when no job
+ * waits for a key, and finish the uploads before the run closes.
+*/
+struct PlanRun
+{
+    BuildPlan* plan;
+    JobContext* contexts;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint32_t* ready;            // max-heap of runnable jobs on priority, each job enters at most once
+    size_t readyCount;
+
+    size_t toRun;
+    size_t started;
+    size_t inFlight;
+    bool useStore;              // restore outputs from the artifact store
+    size_t restored;            // only touched by the main thread
+
+    bool preparing;             // artifact keys are settled by the preparers, ahead of admission
+    bool closing;
+    pthread_t* preparers;
+    unsigned int preparerCount;
+    pthread_cond_t prepareWake;
+    pthread_cond_t fetched;     // some job reached FETCH_DONE
+    uint32_t* prepareQueue;     // FIFO in the order jobs became ready
+    size_t prepareHead;
+    size_t prepareTail;
+    size_t unprepared;          // ready jobs queued or being prepared, not in the heap yet
+    uint32_t* uploadQueue;      // built jobs whose output goes to the cache daemon, FIFO
+    size_t uploadHead;
+    size_t uploadTail;
+    PoolQueue* pools;           // one per BuildPlan.pools
+    uint32_t* waitNext;         // next job waiting on the same pool, index + 1
+    uint64_t* pipeSpans;        // first start and last end of each pipe's jobs, for the trace
+    size_t failed;
+    bool stopping;              // a job failed: let the running ones finish, start nothing new
+};
+
+
+
+// ==== Internal Helpers ====
+
+//* Create the directories leading to <path>
+static bool make_parents(const char* path)
+{
+    char buf[MAX_PATH_SIZE];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for(char* slash = strchr(buf + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if(!stat_path(buf).exists && !create_dir(buf) && !stat_path(buf).exists) return false;
+        *slash = '/';
+    }
+    return true;
+}
+
+
+static bool runs_before(const BuildPlan* plan, uint32_t left, uint32_t right)
+{
+    if(plan->jobs[left].priority != plan->jobs[right].priority)
+        return plan->jobs[left].priority > plan->jobs[right].priority;
+    return left < right;    // flow order on ties
+}
+
+//* Queue the job to the preparers until its artifact key is known, then to the heap. Lock must be held.
+static void push_ready(PlanRun* run, uint32_t index)
+{
+    JobContext* context = &run->contexts[index];
+    if(run->preparing && atomic_load(&context->fetch) != FETCH_DONE)
+    {
+        if(context->queued) return;
+        context->queued = true;
+        run->prepareQueue[run->prepareTail++] = index;
+        run->unprepared++;
+        pthread_cond_signal(&run->prepareWake);
+        return;
+    }
+
+    size_t at = run->readyCount++;
+    while(at > 0)
+    {
+        size_t parent = (at - 1) / 2;
+        if(!runs_before(run->plan, index, run->ready[parent])) break;
+        run->ready[at] = run->ready[parent];
+        at = parent;
+    }
+    run->ready[at] = index;
+}
+
+//* Lock must be held, heap not empty
+static uint32_t pop_ready(PlanRun* run)
+{
+    uint32_t top = run->ready[0];
+    uint32_t last = run->ready[--run->readyCount];
+    size_t at = 0;
+    while(true)
+    {
+        size_t child = at * 2 + 1;
+        if(child >= run->readyCount) break;
+        if(child + 1 < run->readyCount && runs_before(run->plan, run->ready[child + 1], run->ready[child])) child++;
+        if(!runs_before(run->plan, run->ready[child], last)) break;
+        run->ready[at] = run->ready[child];
+        at = child;
+    }
+    if(run->readyCount > 0) run->ready[at] = last;
+    return top;
+}
+
+
+//* Park a job until its pool has room. Lock must be held.
+static void wait_for_pool(PlanRun* run, uint32_t index)
+{
+    PoolQueue* pool = &run->pools[run->plan->jobs[index].pool - 1];
+    run->waitNext[index] = 0;
+    if(pool->tail != 0) run->waitNext[pool->tail - 1] = index + 1;
+    else pool->head = index + 1;
+    pool->tail = index + 1;
+}
+
+//* A job of <pool> ended: its first waiting job may compete again. Lock must be held.
+static void leave_pool(PlanRun* run, uint32_t pool)
+{
+    if(pool == 0) return;
+    PoolQueue* queue = &run->pools[pool - 1];
+    queue->running--;
+    if(queue->head == 0) return;
+
+    uint32_t index = queue->head - 1;
+    queue->head = run->waitNext[index];
+    if(queue->head == 0) queue->tail = 0;
+    push_ready(run, index);
+}
+
+
+/*
+ * Priority is the job's expected duration plus the longest chain of
+ * stale jobs waiting on it. Dependents always come later in the plan,
+ * so one backward pass settles every chain. Jobs never timed cost the
+ * mean of the timed ones.
+*/
+static void rank_jobs(BuildPlan* plan)
+{
+    uint64_t known = 0;
+    size_t knownCount = 0;
+    for(size_t j = 0; j < plan->count; j++)
+    {
+        PlanJob* job = &plan->jobs[j];
+        job->priority = job->stale ? get_timing(job->timingKey) : 0;
+        if(job->priority == 0) continue;
+        known += job->priority;
+        knownCount++;
+    }
+    uint64_t guess = knownCount > 0 ? known / knownCount : DEFAULT_COST_NS;
+
+    for(size_t j = plan->count; j-- > 0; )
+    {
+        PlanJob* job = &plan->jobs[j];
+        if(!job->stale) continue;
+        if(job->priority == 0) job->priority = guess;
+
+        uint64_t longest = 0;
+        for(uint32_t i = 0; i < job->dependentCount; i++)
+        {
+            uint64_t chain = plan->jobs[job->dependents[i]].priority;
+            if(chain > longest) longest = chain;
+        }
+        job->priority += longest;
+    }
+}
+
+
+//* Content hashes of the job's inputs, in order, mostly served by the file cache -> false if one can't be read
+static bool hash_inputs(const PlanJob* job, uint64_t* hashes)
+{
+    const char** paths = (const char**)malloc((job->inputCount + 1) * sizeof(const char*));
+    char* names = (char*)malloc((size_t)(job->inputCount + 1) * MAX_PATH_SIZE);
+    bool readable = paths != NULL && names != NULL;
+    for(uint32_t i = 0; i < job->inputCount && readable; i++)
+    {
+        paths[i] = &names[(size_t)i * MAX_PATH_SIZE];
+        readable = path_string(job->inputs[i], &names[(size_t)i * MAX_PATH_SIZE], MAX_PATH_SIZE) > 0;
+    }
+    if(readable) hash_files(paths, job->inputs, job->inputCount, hashes, job->inputCount >= HASH_PARALLEL_MIN ? 0 : 1);
+    for(uint32_t i = 0; i < job->inputCount && readable; i++) readable = hashes[i] != 0;
+    free(paths);
+    free(names);
+    return readable;
+}
+
+//* Remember what the output was built from, compared against by the next run (CHECK_HASH).
+//* A failed build forgets it: its output is left in an unknown state.
+static void record_inputs(const PlanJob* job, bool success)
+{
+    if(job->check != CHECK_HASH) return;
+    uint64_t* hashes = (uint64_t*)malloc((job->inputCount + 1) * sizeof(uint64_t));
+    bool hashed = success && hashes != NULL && hash_inputs(job, hashes);
+    record_input_digest(job->timingKey, hashed ? input_digest(hashes, job->inputCount) : 0);
+    free(hashes);
+}
+
+//* Sample the queue depth and the jobs in flight. Lock must be held.
+static void trace_load(const PlanRun* run)
+{
+    if(!trace_enabled()) return;
+    trace_counter("ready jobs", (int64_t)run->readyCount);
+    trace_counter("running jobs", (int64_t)run->inFlight);
+}
+
+//* Slice of a job from <begin> to <end> on <track>, widening its pipe's span. Takes the lock.
+static void trace_job(PlanRun* run, uint32_t index, uint32_t track, uint64_t begin, uint64_t end, const char* args)
+{
+    if(!trace_enabled()) return;
+    const PlanJob* job = &run->plan->jobs[index];
+
+    char name[MAX_PATH_SIZE + 128];
+    snprintf(name, sizeof(name), "%s: %s", job->action, job->outputPath);
+    trace_slice(track, name, run->plan->pipes[job->pipe], begin, end, args);
+
+    pthread_mutex_lock(&run->lock);
+    uint64_t* span = &run->pipeSpans[job->pipe * 2];
+    if(span[0] == 0 || begin < span[0]) span[0] = begin;
+    if(end > span[1]) span[1] = end;
+    pthread_mutex_unlock(&run->lock);
+}
+
+
+//* Release the job's admission and, on success, its dependents. Takes the lock.
+static void settle_job(PlanRun* run, uint32_t index, bool success)
+{
+    BuildPlan* plan = run->plan;
+    PlanJob* job = &plan->jobs[index];
+
+    pthread_mutex_lock(&run->lock);
+    atomic_store(&job->state, success ? JOB_DONE : JOB_FAILED);
+    run->inFlight--;
+    leave_pool(run, job->pool);
+    if(!success)
+    {
+        run->failed++;
+        run->stopping = true;
+    }
+    for(uint32_t i = 0; i < job->dependentCount && success; i++)
+    {
+        PlanJob* dependent = &plan->jobs[job->dependents[i]];
+        if(atomic_fetch_sub(&dependent->pending, 1) != 1) continue;
+        atomic_store(&dependent->state, JOB_READY);
+        push_ready(run, job->dependents[i]);
+    }
+    trace_load(run);
+    pthread_cond_signal(&run->changed);
+    pthread_mutex_unlock(&run->lock);
+}
+
+
+//* Send the job's output to the cache daemon, shared with other machines. Called without the lock.
+static void upload_artifact(PlanRun* run, uint32_t index)
+{
+    const PlanJob* job = &run->plan->jobs[index];
+    if(!remote_push(run->contexts[index].artifact, job->outputPath))
+        log_full("Could not upload an output to the cache daemon.", VERBOSE, CACHE);
+}
+
+//* Leave the upload to the preparers, or do it here when there are none. Called without the lock.
+static void queue_upload(PlanRun* run, uint32_t index)
+{
+    pthread_mutex_lock(&run->lock);
+    bool queued = run->preparerCount > 0;
+    if(queued)
+    {
+        run->uploadQueue[run->uploadTail++] = index;
+        pthread_cond_signal(&run->prepareWake);
+    }
+    pthread_mutex_unlock(&run->lock);
+    if(!queued) upload_artifact(run, index);
+}
+
+
+static void job_finished(CommandTicket ticket, const CommandResult* result, void* context)
+{
+    (void)ticket;
+    JobContext* job_context = (JobContext*)context;
+    PlanRun* run = job_context->run;
+    PlanJob* job = &run->plan->jobs[job_context->index];
+    bool success = result->exit_code == 0 && result->signal == 0 && !result->timed_out;
+
+    if(trace_enabled())
+    {
+        const CommandSpan* span = &result->span;
+        char args[160];
+        snprintf(args, sizeof(args), "\"exit\": %d, \"signal\": %d, \"mode\": \"%s\", \"queued_ms\": %.3f",
+                 result->exit_code, result->signal, result->mode == EXEC_DIRECT ? "direct" : "shell",
+                 span->started > span->queued ? (double)(span->started - span->queued) / 1e6 : 0.0);
+        trace_job(run, job_context->index, result->worker + 1, span->started, span->drained, args);
+    }
+
+    int exitCode = result->signal != 0 ? 128 + result->signal : result->exit_code;
+    record_history(job->action, job->outputPath, success ? HISTORY_BUILT : HISTORY_FAILED, (RebuildReason)job->reason,
+                   exitCode, monotonic_ns() - job_context->startedAt, result->usage.peak_rss,
+                   result->mode == EXEC_DIRECT ? HISTORY_MODE_DIRECT : HISTORY_MODE_SHELL);
+
+    record_inputs(job, success);
+    if(!success)
+    {
+        char buf[MAX_PATH_SIZE + 128];
+        if(result->timed_out) snprintf(buf, sizeof(buf), "Building '%s' timed out.", job->outputPath);
+        else if(result->signal != 0) snprintf(buf, sizeof(buf), "Building '%s' was killed by signal %d.", job->outputPath, result->signal);
+        else snprintf(buf, sizeof(buf), "Building '%s' failed with exit code %d.", job->outputPath, result->exit_code);
+        log_full(buf, CRITICAL, PROCESS);   // its stderr was already logged line by line by the worker
+    }
+    else
+    {
+        record_timing(job->timingKey, monotonic_ns() - job_context->startedAt);
+        record_memory(job->timingKey, result->usage.peak_rss);
+        if(job_context->artifact != 0 && !store_save(job_context->artifact, job->outputPath, job->command))
+            log_full("Could not keep an output in the artifact store.", VERBOSE, CACHE);
+        if(job_context->artifact != 0 && remote_enabled()) queue_upload(run, job_context->index);
+    }
+    settle_job(run, job_context->index, success);
+}
+
+
+/*
+ * Key of the job's output in the artifact store. Producers are done by
+ * now, so every input exists and hashes are mostly served by the file
+ * cache -> 0 if an input can't be read.
+*/
+static uint64_t job_artifact(const PlanJob* job)
+{
+    uint64_t* hashes = (uint64_t*)malloc((job->inputCount + 1) * sizeof(uint64_t));
+    uint64_t key = 0;
+    if(hashes != NULL && hash_inputs(job, hashes)) key = artifact_key(job->command, hashes, job->inputCount);
+    free(hashes);
+    return key;
+}
+
+
+/*
+ * Settle the job's artifact key once, fetching the artifact from the
+ * daemon when the local store lacks it. Whoever comes second, a
+ * preparer or the main thread, waits for the first. Called without
+ * the lock.
+*/
+static uint64_t prepare_artifact(PlanRun* run, uint32_t index)
+{
+    JobContext* context = &run->contexts[index];
+    uint8_t idle = FETCH_IDLE;
+    if(atomic_compare_exchange_strong(&context->fetch, &idle, FETCH_BUSY))
+    {
+        const PlanJob* job = &run->plan->jobs[index];
+        uint64_t artifact = job_artifact(job);
+        if(artifact != 0 && remote_enabled() && !store_has(artifact)) store_import(artifact, job->command);
+
+        pthread_mutex_lock(&run->lock);
+        context->artifact = artifact;
+        atomic_store(&context->fetch, FETCH_DONE);
+        pthread_cond_broadcast(&run->fetched);
+        pthread_mutex_unlock(&run->lock);
+        return artifact;
+    }
+
+    pthread_mutex_lock(&run->lock);
+    while(atomic_load(&context->fetch) != FETCH_DONE) pthread_cond_wait(&run->fetched, &run->lock);
+    uint64_t artifact = context->artifact;
+    pthread_mutex_unlock(&run->lock);
+    return artifact;
+}
+
+/*
+ * Settle the artifact keys of ready jobs while the workers run earlier
+ * ones, then admit them. Uploads only run when no key is wanted, and
+ * are all done before the thread leaves, even after a failure.
+*/
+static void* prepare_artifacts(void* argument)
+{
+    PlanRun* run = (PlanRun*)argument;
+    pthread_mutex_lock(&run->lock);
+    while(true)
+    {
+        bool prepare = run->prepareHead != run->prepareTail && !run->closing && !run->stopping;
+        if(!prepare && run->uploadHead == run->uploadTail)
+        {
+            if(run->closing) break;
+            pthread_cond_wait(&run->prepareWake, &run->lock);
+            continue;
+        }
+
+        uint32_t index = prepare ? run->prepareQueue[run->prepareHead++] : run->uploadQueue[run->uploadHead++];
+        pthread_mutex_unlock(&run->lock);
+        if(prepare) prepare_artifact(run, index);
+        else upload_artifact(run, index);
+        pthread_mutex_lock(&run->lock);
+        if(!prepare) continue;
+
+        run->unprepared--;
+        push_ready(run, index);
+        trace_load(run);
+        pthread_cond_signal(&run->changed);
+    }
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+
+//* Hand one job to the workers, or restore its output from the store. Called without the lock.
+static void start_job(PlanRun* run, uint32_t index)
+{
+    BuildPlan* plan = run->plan;
+    PlanJob* job = &plan->jobs[index];
+    JobContext* context = &run->contexts[index];
+    atomic_store(&job->state, JOB_RUNNING);
+
+    const char* implicitDirs = get_variable(plan->file, "!implicit_dir_creation");
+    bool makeDirs = implicitDirs == NULL || strcmp(implicitDirs, "false") != 0;
+    bool placed = !makeDirs || make_parents(job->outputPath);
+
+    uint64_t begin = monotonic_ns();
+    uint64_t artifact = run->useStore && placed ? prepare_artifact(run, index) : 0;
+    if(artifact != 0 && store_restore(artifact, job->outputPath))
+    {
+        printf("[%zu/%zu] %s: %s (restored)\n", run->started, run->toRun, plan->pipes[job->pipe], job->outputPath);
+        fflush(stdout);
+        record_inputs(job, true);
+        uint64_t end = monotonic_ns();
+        trace_job(run, index, TRACE_FLOW_TRACK, begin, end, "\"restored\": true");
+        record_history(job->action, job->outputPath, HISTORY_RESTORED, (RebuildReason)job->reason, 0, end - begin, 0, HISTORY_MODE_NONE);
+        run->restored++;
+        settle_job(run, index, true);
+        return;
+    }
+
+    printf("[%zu/%zu] %s: %s\n", run->started, run->toRun, plan->pipes[job->pipe], job->outputPath);
+    fflush(stdout);
+    log_full(job->command, VERBOSE, PROCESS);
+
+    CommandTicket ticket = 0;
+    context->startedAt = monotonic_ns();
+    if(placed)
+    {
+        store_detach(job->outputPath);
+        ShellCommand command = (ShellCommand){
+            .command = job->command,
+            .cwd = "./",
+            .timeout = 0,
+            .mode = EXEC_AUTO,
+            .memory_limit = job->memory,
+            .cpu_limit = job->cpu,
+            .weight = job->weight,
+        };
+        ticket = submit_command(command, job_finished, context);
+    }
+    if(ticket != 0) return;
+
+    char buf[MAX_PATH_SIZE + 64];
+    snprintf(buf, sizeof(buf), "Could not start the job building '%s'.", job->outputPath);
+    log_full(buf, CRITICAL, PROCESS);
+    record_history(job->action, job->outputPath, HISTORY_FAILED, (RebuildReason)job->reason, -1, 0, 0, HISTORY_MODE_NONE);
+    settle_job(run, index, false);
+}
+
+
+
+// ==== Interface ====
+
+size_t run_plan(BuildPlan* plan)
+{
+    PlanRun run;
+    memset(&run, 0, sizeof(PlanRun));
+    run.plan = plan;
+    run.contexts = (JobContext*)calloc(plan->count + 1, sizeof(JobContext));
+    run.ready = (uint32_t*)calloc(plan->count + 1, sizeof(uint32_t));
+    run.pools = (PoolQueue*)calloc(plan->poolCount + 1, sizeof(PoolQueue));
+    run.waitNext = (uint32_t*)calloc(plan->count + 1, sizeof(uint32_t));
+    run.prepareQueue = (uint32_t*)calloc(plan->count + 1, sizeof(uint32_t));
+    run.uploadQueue = (uint32_t*)calloc(plan->count + 1, sizeof(uint32_t));
+    run.pipeSpans = (uint64_t*)calloc(plan->pipeCount * 2 + 1, sizeof(uint64_t));
+    if(run.contexts == NULL || run.ready == NULL || run.pools == NULL || run.waitNext == NULL || run.prepareQueue == NULL ||
+       run.uploadQueue == NULL || run.pipeSpans == NULL)
+    {
+        free(run.pipeSpans);
+        free(run.uploadQueue);
+        free(run.prepareQueue);
+        free(run.contexts);
+        free(run.ready);
+        free(run.pools);
+        free(run.waitNext);
+        log_full("Could not allocate the build state.", CRITICAL, PROCESS);
+        return plan->count;
+    }
+    pthread_mutex_init(&run.lock, NULL);
+    const char* artifactCache = get_variable(plan->file, "!artifact_cache");
+    run.useStore = store_enabled() && (artifactCache == NULL || strcmp(artifactCache, "false") != 0);
+    pthread_cond_init(&run.prepareWake, NULL);
+    pthread_cond_init(&run.fetched, NULL);
+    pthread_cond_init(&run.changed, NULL);
+
+    // only stale producers hold their dependents back
+    for(size_t j = 0; j < plan->count; j++)
+    {
+        run.contexts[j] = (JobContext){&run, (uint32_t)j, 0, 0, FETCH_IDLE, false};
+        atomic_store(&plan->jobs[j].pending, 0);
+        // what a job measured last time protects the host as well as a declared size
+        plan->jobs[j].weight = plan->jobs[j].memory ? plan->jobs[j].memory : get_memory(plan->jobs[j].timingKey);
+    }
+    for(size_t j = 0; j < plan->count; j++)
+    {
+        PlanJob* job = &plan->jobs[j];
+        if(!job->stale) continue;
+        run.toRun++;
+        for(uint32_t i = 0; i < job->dependentCount; i++) atomic_fetch_add(&plan->jobs[job->dependents[i]].pending, 1);
+    }
+    rank_jobs(plan);
+
+    // without any preparer, start_job() settles each key itself
+    unsigned int preparers = processor_count() < PREPARE_THREADS_MAX ? processor_count() : PREPARE_THREADS_MAX;
+    run.preparers = run.useStore && run.toRun > 0 ? (pthread_t*)malloc(preparers * sizeof(pthread_t)) : NULL;
+    for(; run.preparers != NULL && run.preparerCount < preparers; run.preparerCount++)
+        if(pthread_create(&run.preparers[run.preparerCount], NULL, prepare_artifacts, &run) != 0) break;
+    run.preparing = run.preparerCount > 0;
+
+    pthread_mutex_lock(&run.lock);
+    for(size_t j = 0; j < plan->count; j++)
+        if(plan->jobs[j].stale && atomic_load(&plan->jobs[j].pending) == 0)
+        {
+            atomic_store(&plan->jobs[j].state, JOB_READY);
+            push_ready(&run, (uint32_t)j);
+        }
+
+    while(true)
+    {
+        bool throttled = false;
+        while(run.readyCount > 0 && !run.stopping)
+        {
+            uint32_t pool = plan->jobs[run.ready[0]].pool;
+            if(pool != 0 && run.pools[pool - 1].running >= plan->pools[pool - 1].capacity)
+            {
+                wait_for_pool(&run, pop_ready(&run));
+                continue;
+            }
+
+            // the top job waits for memory rather than letting smaller ones pass it
+            uint64_t weight = plan->jobs[run.ready[0]].weight;
+            unsigned int running = (unsigned int)run.inFlight;
+            if(running >= throttle_limit(running) || !throttle_admit(weight, running))
+            {
+                throttled = true;
+                break;
+            }
+
+            uint32_t index = pop_ready(&run);
+            run.inFlight++;
+            if(pool != 0) run.pools[pool - 1].running++;
+            run.started++;
+            trace_load(&run);
+            pthread_mutex_unlock(&run.lock);
+            start_job(&run, index);
+            pthread_mutex_lock(&run.lock);
+        }
+        if(run.inFlight == 0 && ((run.readyCount == 0 && run.unprepared == 0) || run.stopping)) break;
+        if(!throttled)
+        {
+            pthread_cond_wait(&run.changed, &run.lock);
+            continue;
+        }
+
+        // the host may free up without any job finishing
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += THROTTLE_PERIOD_MS * 1000000l;
+        until.tv_sec += until.tv_nsec / 1000000000l;
+        until.tv_nsec %= 1000000000l;
+        pthread_cond_timedwait(&run.changed, &run.lock, &until);
+    }
+    run.closing = true;
+    pthread_cond_broadcast(&run.prepareWake);
+    pthread_mutex_unlock(&run.lock);
+    for(unsigned int p = 0; p < run.preparerCount; p++) pthread_join(run.preparers[p], NULL);
+    free(run.preparers);
+
+    size_t cancelled = 0;
+    for(size_t j = 0; j < plan->count; j++)
+    {
+        PlanJob* job = &plan->jobs[j];
+        uint8_t state = atomic_load(&job->state);
+        if(!job->stale) record_history(job->action, job->outputPath, HISTORY_UP_TO_DATE, REBUILD_NONE, 0, 0, 0, HISTORY_MODE_NONE);
+        if(!job->stale || state == JOB_DONE || state == JOB_FAILED) continue;
+        atomic_store(&job->state, JOB_CANCELLED);
+        record_history(job->action, job->outputPath, HISTORY_CANCELLED, (RebuildReason)job->reason, 0, 0, 0, HISTORY_MODE_NONE);
+        cancelled++;
+    }
+    if(cancelled > 0)
+    {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%zu job(s) were not run because of earlier failures.", cancelled);
+        log_full(buf, WARNING, PROCESS);
+    }
+    if(run.toRun == 0) log_full("Everything is up to date.", INFO, PROCESS);
+    if(run.restored > 0)
+    {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "%zu output(s) restored from the artifact store.", run.restored);
+        log_full(buf, INFO, PROCESS);
+    }
+
+    for(size_t p = 0; p < plan->pipeCount && trace_enabled(); p++)
+    {
+        if(run.pipeSpans[p * 2] == 0) continue;
+        trace_track(TRACE_PIPE_TRACK + (uint32_t)p, plan->pipes[p]);
+        trace_slice(TRACE_PIPE_TRACK + (uint32_t)p, plan->pipes[p], "pipe", run.pipeSpans[p * 2], run.pipeSpans[p * 2 + 1], NULL);
+    }
+
+    pthread_cond_destroy(&run.fetched);
+    pthread_cond_destroy(&run.prepareWake);
+    pthread_cond_destroy(&run.changed);
+    pthread_mutex_destroy(&run.lock);
+    free(run.contexts);
+    free(run.ready);
+    free(run.pools);
+    free(run.waitNext);
+    free(run.prepareQueue);
+    free(run.uploadQueue);
+    free(run.pipeSpans);
+    return run.failed;
+}
@@ -0,0 +1,259 @@
+#include "read.h"
+
+#include "../util/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct
+{
+    char* name;
+    char* value;
+} Binding;
+
+typedef struct
+{
+    Binding* bindings;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} Context;
+
+
+
+// ==== Internal Helpers ====
+
+static Binding* find_binding(Context* context, const char* name, size_t length)
+{
+    for(size_t i = 0; i < context->count; i++)
+        if(strlen(context->bindings[i].name) == length && memcmp(context->bindings[i].name, name, length) == 0)
+            return &context->bindings[i];
+    return NULL;
+}
+
+static char* copy_text(Context* context, const char* text, size_t length)
+{
+    char* copy = (char*)malloc(length + 1);
+    if(copy == NULL)
+    {
+        context->failed = true;
+        return NULL;
+    }
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+//* Binding for <name>, created empty if missing -> NULL on allocation failure
+static Binding* get_binding(Context* context, const char* name, size_t length, bool* created)
+{
+    Binding* binding = find_binding(context, name, length);
+    *created = binding == NULL;
+    if(binding != NULL) return binding;
+
+    if(context->count == context->capacity)
+    {
+        size_t capacity = context->capacity == 0 ? 16 : context->capacity * 2;
+        Binding* grown = (Binding*)realloc(context->bindings, capacity * sizeof(Binding));
+        if(grown == NULL)
+        {
+            context->failed = true;
+            return NULL;
+        }
+        context->bindings = grown;
+        context->capacity = capacity;
+    }
+
+    binding = &context->bindings[context->count];
+    binding->name = copy_text(context, name, length);
+    binding->value = copy_text(context, "", 0);
+    if(binding->name == NULL || binding->value == NULL)
+    {
+        free(binding->name);
+        free(binding->value);
+        return NULL;
+    }
+    context->count++;
+    return binding;
+}
+
+//* <current> with every blank-separated word of <words> removed -> NULL on allocation failure
+static char* remove_words(Context* context, const char* current, const char* words, size_t wordsLength)
+{
+    size_t length = strlen(current);
+    char* result = (char*)malloc(length + 1);
+    if(result == NULL)
+    {
+        context->failed = true;
+        return NULL;
+    }
+
+    size_t used = 0;
+    const char* word = current;
+    while(*word != '\0')
+    {
+        while(*word == ' ' || *word == '\t') word++;
+        size_t size = strcspn(word, " \t");
+        if(size == 0) break;
+
+        bool removed = false;
+        for(size_t at = 0; at < wordsLength && !removed; )
+        {
+            while(at < wordsLength && (words[at] == ' ' || words[at] == '\t')) at++;
+            size_t other = at;
+            while(other < wordsLength && words[other] != ' ' && words[other] != '\t') other++;
+            removed = other - at == size && memcmp(&words[at], word, size) == 0;
+            at = other;
+        }
+
+        if(!removed)
+        {
+            if(used > 0) result[used++] = ' ';
+            memcpy(&result[used], word, size);
+            used += size;
+        }
+        word += size;
+    }
+    result[used] = '\0';
+    return result;
+}
+
+static void apply(Context* context, const char* name, size_t nameLength,
+                  AssignOp op, bool isDefault, const char* value, size_t valueLength)
+{
+    bool created;
+    Binding* binding = get_binding(context, name, nameLength, &created);
+    if(binding == NULL) return;
+    if(isDefault && !created) return;
+
+    char* updated = NULL;
+    size_t currentLength = strlen(binding->value);
+    switch(op)
+    {
+        case OP_APPEND:
+            updated = (char*)malloc(currentLength + valueLength + 2);
+            if(updated == NULL) break;
+            memcpy(updated, binding->value, currentLength);
+            if(currentLength > 0 && valueLength > 0) updated[currentLength++] = ' ';
+            memcpy(&updated[currentLength], value, valueLength);
+            updated[currentLength + valueLength] = '\0';
+            break;
+        case OP_REMOVE:
+            updated = remove_words(context, binding->value, value, valueLength);
+            break;
+        default:
+            updated = copy_text(context, value, valueLength);
+            break;
+    }
+
+    if(updated == NULL)
+    {
+        context->failed = true;
+        return;
+    }
+    free(binding->value);
+    binding->value = updated;
+    return;
+}
+
+static void apply_node(Context* context, const PipeFile* file, const Node* node)
+{
+    apply(context, &file->source[node->name.offset], node->name.length, node->op, node->isDefault,
+          &file->source[node->value.offset], node->value.length);
+    return;
+}
+
+//* Copy the bindings into the file's arena as Variable records and one string table
+static bool pack_context(Context* context, PipeFile* file)
+{
+    size_t stringsSize = 0;
+    for(size_t i = 0; i < context->count; i++)
+        stringsSize += strlen(context->bindings[i].name) + strlen(context->bindings[i].value) + 2;
+    if(stringsSize > UINT32_MAX) return false;
+
+    Variable* variables = (Variable*)arena_alloc(&file->arena, context->count * sizeof(Variable) + 1);
+    char* strings = (char*)arena_alloc(&file->arena, stringsSize + 1);
+    if(variables == NULL || strings == NULL) return false;
+
+    size_t used = 0;
+    for(size_t i = 0; i < context->count; i++)
+    {
+        size_t nameLength = strlen(context->bindings[i].name) + 1;
+        size_t valueLength = strlen(context->bindings[i].value) + 1;
+        variables[i].name = (uint32_t)used;
+        memcpy(&strings[used], context->bindings[i].name, nameLength);
+        used += nameLength;
+        variables[i].value = (uint32_t)used;
+        memcpy(&strings[used], context->bindings[i].value, valueLength);
+        used += valueLength;
+    }
+
+    file->variables = variables;
+    file->variableCount = (uint32_t)context->count;
+    file->strings = strings;
+    file->stringsSize = (uint32_t)used;
+    return true;
+}
+
+
+
+// ==== Interface ====
+
+/*
+ * Later assignments win, "default" ones only apply to unset variables,
+ * "+:" appends words and "-:" removes them.
+ * Defines from the command line are applied last and override the file.
+ * Nested blocks in the config (conditionals) are not evaluated yet.
+*/
+bool resolve_config(PipeFile* file, const char* const* defines, size_t count)
+{
+    Context context = {NULL, 0, 0, false};
+    const Node* root = &file->nodes[0];
+
+    for(const Node* node = get_node(file, root->child); node != NULL; node = get_node(file, node->next))
+    {
+        if(node->kind == NODE_ASSIGN) apply_node(&context, file, node);
+        if(node->kind != NODE_CONFIG) continue;
+
+        for(const Node* entry = get_node(file, node->child); entry != NULL; entry = get_node(file, entry->next))
+        {
+            if(entry->kind == NODE_ASSIGN) apply_node(&context, file, entry);
+            else
+            {
+                char buf[128];
+                snprintf(buf, sizeof(buf), "Pipe file, line %u: only assignments are evaluated in config; ignored.", entry->line);
+                log_full(buf, WARNING, READ);
+            }
+        }
+    }
+
+    for(size_t i = 0; i < count && defines != NULL; i++)
+    {
+        const char* equals = strchr(defines[i], '=');
+        size_t nameLength = equals != NULL ? (size_t)(equals - defines[i]) : strlen(defines[i]);
+        const char* value = equals != NULL ? equals + 1 : "";
+        apply(&context, defines[i], nameLength, OP_SET, false, value, strlen(value));
+    }
+
+    bool packed = !context.failed && pack_context(&context, file);
+    for(size_t i = 0; i < context.count; i++)
+    {
+        free(context.bindings[i].name);
+        free(context.bindings[i].value);
+    }
+    free(context.bindings);
+
+    if(!packed) log_full("Could not allocate the resolved configuration.", CRITICAL, READ);
+    return packed;
+}
+
+
+const char* get_variable(const PipeFile* file, const char* name)
+{
+    for(uint32_t i = 0; i < file->variableCount; i++)
+        if(strcmp(&file->strings[file->variables[i].name], name) == 0)
+            return &file->strings[file->variables[i].value];
+    return NULL;
+}
@@ -0,0 +1,215 @@
+#include "read.h"
+
+#include "../util/util.h"
+#include "../load/load.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define IMAGE_MAGIC "PIPEIM\0"      // 8 bytes with the terminator
+#define IMAGE_ALIGN 8               // every section starts on this boundary
+
+/*
+ * Image layout, all offsets from the start of the file:
+ * header | source text | nodes | variables | strings
+ * Nodes and variables only hold indices and offsets, so the
+ * sections are used in place once mapped.
+*/
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint64_t pathHash;          // normalized pipe file path
+    uint64_t contextHash;       // command line defines
+    FileRecord source;          // fingerprint of the pipe file when it was parsed
+    uint32_t variableCount;
+    uint32_t stringsSize;
+    uint64_t sourceOffset;
+    uint64_t nodesOffset;
+    uint64_t variablesOffset;
+    uint64_t stringsOffset;
+    uint64_t totalSize;
+} ImageHeader;
+
+
+
+// ==== Internal Helpers ====
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1);
+}
+
+static void image_path(const char* directory, char* buf, size_t size)
+{
+    snprintf(buf, size, "%s/%s", directory, PIPE_IMAGE);
+    return;
+}
+
+static uint64_t path_hash(const char* path)
+{
+    char normal[MAX_PATH_SIZE];
+    if(normalize_path(path, normal, sizeof(normal)) == NULL) return hash_string(path);
+    return hash_string(normal);
+}
+
+static uint64_t context_hash(const char* const* defines, size_t count)
+{
+    HashState state;
+    hash_init(&state, 0);
+    for(size_t i = 0; i < count && defines != NULL; i++)
+        hash_update(&state, defines[i], strlen(defines[i]) + 1);
+    return hash_digest(&state);
+}
+
+static bool slice_fits(Slice slice, uint64_t size)
+{
+    return (uint64_t)slice.offset + slice.length <= size;
+}
+
+//* Reject images whose indices or offsets point outside their sections
+static bool validate_image(const ImageHeader* header, const Node* nodes,
+                           const Variable* variables, const char* strings)
+{
+    if(header->nodeCount == 0) return false;
+    for(uint32_t i = 0; i < header->nodeCount; i++)
+    {
+        const Node* node = &nodes[i];
+        if(node->child >= header->nodeCount || node->next >= header->nodeCount) return false;
+        if(!slice_fits(node->name, header->source.size) || !slice_fits(node->header, header->source.size) ||
+           !slice_fits(node->value, header->source.size) || !slice_fits(node->extra, header->source.size)) return false;
+    }
+    for(uint32_t i = 0; i < header->variableCount; i++)
+        if(variables[i].name >= header->stringsSize || variables[i].value >= header->stringsSize) return false;
+    return header->stringsSize == 0 || strings[header->stringsSize - 1] == '\0';
+}
+
+//* The pipe file still matches the fingerprint: same stat tuple, or same content
+static bool source_unchanged(const char* path, const FileRecord* record)
+{
+    fileStat info = stat_path(path);
+    if(!info.exists || info.size != record->size) return false;
+    if(info.mtimeNs == record->mtime && info.inode == record->inode) return true;
+
+    uint64_t hash;
+    return hash_file(path, &hash) && hash == record->hash;
+}
+
+static bool write_section(FILE* file, const void* data, size_t size, uint64_t offset)
+{
+    static const char padding[IMAGE_ALIGN] = {0};
+    long at = ftell(file);
+    if(at < 0 || (uint64_t)at > offset) return false;
+    if(offset > (uint64_t)at && fwrite(padding, 1, offset - at, file) != offset - at) return false;
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+
+
+// ==== Interface ====
+
+bool load_pipe_image(const char* directory, const char* path, const char* const* defines, size_t count, PipeFile* file)
+{
+    memset(file, 0, sizeof(PipeFile));
+
+    char imagePath[MAX_PATH_SIZE];
+    image_path(directory, imagePath, sizeof(imagePath));
+    int fd = open(imagePath, O_RDONLY);
+    if(fd == -1) return false;
+
+    struct stat info;
+    if(fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(ImageHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) return false;
+
+    const ImageHeader* header = (const ImageHeader*)mapping;
+    const char* base = (const char*)mapping;
+    bool usable = memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == PIPE_IMAGE_VERSION
+        && header->totalSize == (uint64_t)info.st_size
+        && header->sourceOffset + header->source.size <= header->nodesOffset
+        && header->nodesOffset + (uint64_t)header->nodeCount * sizeof(Node) <= header->variablesOffset
+        && header->variablesOffset + (uint64_t)header->variableCount * sizeof(Variable) <= header->stringsOffset
+        && header->stringsOffset + header->stringsSize <= header->totalSize
+        && header->pathHash == path_hash(path)
+        && header->contextHash == context_hash(defines, count);
+    usable = usable && validate_image(header, (const Node*)(base + header->nodesOffset),
+                                      (const Variable*)(base + header->variablesOffset), base + header->stringsOffset);
+    usable = usable && source_unchanged(path, &header->source);
+    if(!usable)
+    {
+        munmap(mapping, info.st_size);
+        log_full("Pipe cache is stale; reading the pipe file.", VERBOSE, READ);
+        return false;
+    }
+
+    arena_init(&file->arena, 0);
+    file->mapping = mapping;
+    file->mappingSize = info.st_size;
+    file->source = base + header->sourceOffset;
+    file->size = header->source.size;
+    file->sourceMtime = header->source.mtime;
+    file->sourceInode = header->source.inode;
+    file->nodes = (Node*)(base + header->nodesOffset);
+    file->count = header->nodeCount;
+    file->variables = (Variable*)(base + header->variablesOffset);
+    file->variableCount = header->variableCount;
+    file->strings = base + header->stringsOffset;
+    file->stringsSize = header->stringsSize;
+    return true;
+}
+
+
+bool save_pipe_image(const char* directory, const char* path, const char* const* defines, size_t count, const PipeFile* file)
+{
+    // fingerprint of the file as it was mapped, a later edit then fails source_unchanged()
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = PIPE_IMAGE_VERSION;
+    header.nodeCount = file->count;
+    header.pathHash = path_hash(path);
+    header.contextHash = context_hash(defines, count);
+    header.source = (FileRecord){file->sourceMtime, file->size, file->sourceInode, hash_bytes(file->source, file->size, 0)};
+    header.variableCount = file->variableCount;
+    header.stringsSize = file->stringsSize;
+    header.sourceOffset = align_offset(sizeof(ImageHeader));
+    header.nodesOffset = align_offset(header.sourceOffset + file->size);
+    header.variablesOffset = align_offset(header.nodesOffset + (uint64_t)file->count * sizeof(Node));
+    header.stringsOffset = align_offset(header.variablesOffset + (uint64_t)file->variableCount * sizeof(Variable));
+    header.totalSize = header.stringsOffset + file->stringsSize;
+
+    char imagePath[MAX_PATH_SIZE];
+    char tmpPath[MAX_PATH_SIZE + 8];
+    image_path(directory, imagePath, sizeof(imagePath));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", imagePath);
+
+    FILE* out = fopen(tmpPath, "wb");
+    bool written = out != NULL
+        && write_section(out, &header, sizeof(header), 0)
+        && write_section(out, file->source, file->size, header.sourceOffset)
+        && write_section(out, file->nodes, (size_t)file->count * sizeof(Node), header.nodesOffset)
+        && write_section(out, file->variables, (size_t)file->variableCount * sizeof(Variable), header.variablesOffset)
+        && write_section(out, file->strings, file->stringsSize, header.stringsOffset);
+    if(out != NULL && fclose(out) != 0) written = false;
+
+    if(!written || rename(tmpPath, imagePath) == -1)
+    {
+        remove(tmpPath);
+        log_full("Could not write the pipe cache.", WARNING, READ);
+        return false;
+    }
+    return true;
+}
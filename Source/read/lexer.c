@@ -0,0 +1,109 @@
+#include "read.h"
+
+#include <string.h>
+
+
+
+// ==== Internal Helpers ====
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_comment(const Lexer* lexer, uint32_t at)
+{
+    return at + 1 < lexer->size && lexer->source[at] == '/' && lexer->source[at + 1] == '/';
+}
+
+//* Length of the assignment operator starting at <at>, 0 if none
+static uint32_t assign_length(const Lexer* lexer, uint32_t at)
+{
+    char c = lexer->source[at];
+    if(c == ':') return 1;
+    if(at + 1 >= lexer->size) return 0;
+    if((c == '=' || c == '+' || c == '-') && lexer->source[at + 1] == ':') return 2;
+    return 0;
+}
+
+static Token make_token(const Lexer* lexer, TokenType type, uint32_t start)
+{
+    return (Token){type, {start, lexer->cursor - start}, lexer->line};
+}
+
+
+
+// ==== Interface ====
+
+void init_lexer(Lexer* lexer, const char* source, uint32_t size)
+{
+    lexer->source = source;
+    lexer->size = size;
+    lexer->cursor = 0;
+    lexer->line = 1;
+}
+
+
+/*
+ * Words run until a blank, a brace, a comment or an assignment operator,
+ * but parentheses and quotes keep everything together, so
+ * "format($(dir), suffix=_)" is a single word.
+*/
+Token next_token(Lexer* lexer)
+{
+    while(lexer->cursor < lexer->size)
+    {
+        if(is_blank(lexer->source[lexer->cursor])) lexer->cursor++;
+        else if(is_comment(lexer, lexer->cursor))
+            while(lexer->cursor < lexer->size && lexer->source[lexer->cursor] != '\n') lexer->cursor++;
+        else break;
+    }
+
+    uint32_t start = lexer->cursor;
+    if(lexer->cursor >= lexer->size) return make_token(lexer, TOK_EOF, start);
+
+    char c = lexer->source[lexer->cursor];
+    if(c == '\n')
+    {
+        lexer->cursor++;
+        Token token = make_token(lexer, TOK_NEWLINE, start);
+        lexer->line++;
+        return token;
+    }
+    if(c == '{' || c == '}')
+    {
+        lexer->cursor++;
+        return make_token(lexer, c == '{' ? TOK_LBRACE : TOK_RBRACE, start);
+    }
+
+    uint32_t opLength = assign_length(lexer, lexer->cursor);
+    if(opLength > 0)
+    {
+        lexer->cursor += opLength;
+        return make_token(lexer, TOK_ASSIGN, start);
+    }
+
+    int depth = 0;
+    char quote = '\0';
+    while(lexer->cursor < lexer->size)
+    {
+        c = lexer->source[lexer->cursor];
+        if(c == '\n') break;
+        if(quote != '\0')
+        {
+            if(c == quote) quote = '\0';
+        }
+        else if(c == '"' || c == '\'') quote = c;
+        else if(c == '(') depth++;
+        else if(c == ')' && depth > 0) depth--;
+        else if(depth == 0 && (is_blank(c) || c == '{' || c == '}' || is_comment(lexer, lexer->cursor))) break;
+        else if(depth == 0 && lexer->cursor > start && assign_length(lexer, lexer->cursor) > 0) break;
+        lexer->cursor++;
+    }
+
+    Token token = make_token(lexer, TOK_WORD, start);
+    const char* text = &lexer->source[start];
+    if(token.text.length == 2 && text[0] == '-' && text[1] == '>') token.type = TOK_ARROW;
+    if(token.text.length == 1 && text[0] == '=') token.type = TOK_ASSIGN;
+    return token;
+}
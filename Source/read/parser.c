@@ -0,0 +1,400 @@
+#include "read.h"
+
+#include "../util/util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define LINE_HEAD 4     // tokens kept from the start of each statement
+
+typedef struct
+{
+    Lexer lexer;
+    Token current;
+    PipeFile* file;
+    uint32_t capacity;
+    bool failed;
+} Parser;
+
+//* One statement, kept as positions into the source
+typedef struct
+{
+    Token head[LINE_HEAD];
+    uint32_t count;
+    uint32_t end;               // end of the last token
+    uint32_t line;
+    bool hasArrow;
+    uint32_t arrowBefore;       // end of the text before "->"
+    uint32_t arrowAfter;        // start of the text after "->", <end> if none
+    bool hasSplit;
+    uint32_t splitBefore;       // same for the first ':' after "->"
+    uint32_t splitAfter;
+} Statement;
+
+
+
+// ==== Internal Helpers ====
+
+static void advance(Parser* parser)
+{
+    parser->current = next_token(&parser->lexer);
+    return;
+}
+
+static void syntax_error(Parser* parser, uint32_t line, const char* msg)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "Pipe file, line %u: %s", line, msg);
+    log_full(buf, CRITICAL, READ);
+    parser->failed = true;
+    return;
+}
+
+static Slice span(uint32_t from, uint32_t to)
+{
+    if(to < from) to = from;
+    return (Slice){from, to - from};
+}
+
+//* Text from head token <index> to the end of the statement, empty if there is none
+static Slice rest_from(const Statement* stmt, uint32_t index)
+{
+    if(index >= stmt->count) return span(stmt->end, stmt->end);
+    return span(stmt->head[index].text.offset, stmt->end);
+}
+
+static bool token_is(const Parser* parser, Token token, const char* text)
+{
+    return token.type == TOK_WORD && slice_equals(parser->file, token.text, text);
+}
+
+static AssignOp assign_op(const Parser* parser, Token token)
+{
+    const char* text = &parser->file->source[token.text.offset];
+    if(text[0] == '+') return OP_APPEND;
+    if(text[0] == '-') return OP_REMOVE;
+    return OP_SET;
+}
+
+static uint32_t new_node(Parser* parser, NodeKind kind, uint32_t line)
+{
+    if(parser->file->count >= parser->capacity)
+    {
+        syntax_error(parser, line, "too many statements.");
+        return 0;
+    }
+
+    uint32_t index = parser->file->count++;
+    Node* node = &parser->file->nodes[index];
+    memset(node, 0, sizeof(Node));
+    node->kind = kind;
+    node->line = line;
+    return index;
+}
+
+
+//* Gather tokens up to the end of the statement (newline, brace or EOF)
+static void read_statement(Parser* parser, Statement* stmt)
+{
+    memset(stmt, 0, sizeof(Statement));
+    stmt->line = parser->current.line;
+
+    for(; ; advance(parser))
+    {
+        Token token = parser->current;
+        if(token.type == TOK_NEWLINE || token.type == TOK_LBRACE
+            || token.type == TOK_RBRACE || token.type == TOK_EOF) break;
+
+        if(stmt->count < LINE_HEAD) stmt->head[stmt->count] = token;
+        if(stmt->hasArrow && stmt->arrowAfter == 0) stmt->arrowAfter = token.text.offset;
+        if(stmt->hasSplit && stmt->splitAfter == 0) stmt->splitAfter = token.text.offset;
+
+        if(token.type == TOK_ARROW && !stmt->hasArrow && stmt->count > 0)
+        {
+            stmt->hasArrow = true;
+            stmt->arrowBefore = stmt->end;
+        }
+        else if(token.type == TOK_ASSIGN && stmt->hasArrow && !stmt->hasSplit && stmt->arrowAfter != 0)
+        {
+            stmt->hasSplit = true;
+            stmt->splitBefore = stmt->end;
+        }
+
+        stmt->count++;
+        stmt->end = token.text.offset + token.text.length;
+    }
+
+    if(stmt->hasArrow && stmt->arrowAfter == 0) stmt->arrowAfter = stmt->end;
+    if(stmt->hasSplit && stmt->splitAfter == 0) stmt->splitAfter = stmt->end;
+    return;
+}
+
+
+static uint32_t parse_body(Parser* parser, uint32_t parent, bool topLevel);
+
+//* Block header: <kind> [<name>] [:] <header> at top level, <name> [:] <header> when nested
+static uint32_t parse_block(Parser* parser, const Statement* stmt, bool topLevel)
+{
+    static const struct { const char* keyword; NodeKind kind; } blocks[] = {
+        {"config", NODE_CONFIG}, {"action", NODE_ACTION}, {"pipe", NODE_PIPE}, {"flow", NODE_FLOW},
+        {"pool", NODE_POOL},
+    };
+
+    NodeKind kind = NODE_BLOCK;
+    for(size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]) && topLevel; i++)
+        if(token_is(parser, stmt->head[0], blocks[i].keyword)) kind = blocks[i].kind;
+
+    if(stmt->count == 0 || stmt->head[0].type != TOK_WORD)
+    {
+        syntax_error(parser, stmt->line, "block without a name.");
+        return 0;
+    }
+    if(topLevel && kind == NODE_BLOCK)
+    {
+        syntax_error(parser, stmt->line, "unknown block; expected config, action, pipe, flow or pool.");
+        return 0;
+    }
+
+    uint32_t index = new_node(parser, kind, stmt->line);
+    if(parser->failed) return 0;
+    Node* node = &parser->file->nodes[index];
+
+    uint32_t headerAt = 1;
+    if(kind == NODE_CONFIG || kind == NODE_BLOCK) node->name = stmt->head[0].text;
+    else
+    {
+        if(stmt->count < 2 || stmt->head[1].type != TOK_WORD)
+        {
+            syntax_error(parser, stmt->line, "block without a name.");
+            return 0;
+        }
+        node->name = stmt->head[1].text;
+        headerAt = 2;
+    }
+    if(headerAt < stmt->count && headerAt < LINE_HEAD && stmt->head[headerAt].type == TOK_ASSIGN) headerAt++;
+    node->header = rest_from(stmt, headerAt);
+
+    advance(parser);    // '{'
+    parse_body(parser, index, false);
+    return index;
+}
+
+
+static uint32_t parse_statement(Parser* parser, const Statement* stmt, bool topLevel)
+{
+    uint32_t base = 0;
+    bool isDefault = false;
+    if(stmt->count > 1 && token_is(parser, stmt->head[0], "default") && stmt->head[1].type == TOK_WORD)
+    {
+        isDefault = true;
+        base = 1;
+    }
+
+    NodeKind kind = NODE_ITEM;
+    if(stmt->count > base + 1 && stmt->head[base].type == TOK_WORD && stmt->head[base + 1].type == TOK_ASSIGN)
+        kind = NODE_ASSIGN;
+    else if(stmt->hasArrow) kind = NODE_MAPPING;
+
+    if(topLevel && kind != NODE_ASSIGN)
+    {
+        syntax_error(parser, stmt->line, "expected a block or an assignment.");
+        return 0;
+    }
+
+    uint32_t index = new_node(parser, kind, stmt->line);
+    if(parser->failed) return 0;
+    Node* node = &parser->file->nodes[index];
+    node->isDefault = isDefault;
+
+    switch(kind)
+    {
+        case NODE_ASSIGN:
+            node->name = stmt->head[base].text;
+            node->op = assign_op(parser, stmt->head[base + 1]);
+            node->value = rest_from(stmt, base + 2);
+            break;
+        case NODE_MAPPING:
+            node->name = span(stmt->head[base].text.offset, stmt->arrowBefore);
+            node->value = span(stmt->arrowAfter, stmt->hasSplit ? stmt->splitBefore : stmt->end);
+            if(stmt->hasSplit) node->extra = span(stmt->splitAfter, stmt->end);
+            break;
+        default:
+            node->name = rest_from(stmt, base);
+            break;
+    }
+    return index;
+}
+
+
+/*
+ * Statements until the closing brace (or EOF at top level).
+ * A statement followed by '{', on its own line or the next ones,
+ * opens a block; anything else is a one-line statement.
+*/
+static uint32_t parse_body(Parser* parser, uint32_t parent, bool topLevel)
+{
+    uint32_t parentLine = parser->file->nodes[parent].line;
+    uint32_t tail = 0;
+
+    while(!parser->failed)
+    {
+        while(parser->current.type == TOK_NEWLINE) advance(parser);
+
+        if(parser->current.type == TOK_RBRACE)
+        {
+            if(topLevel) syntax_error(parser, parser->current.line, "unmatched '}'.");
+            else advance(parser);
+            break;
+        }
+        if(parser->current.type == TOK_EOF)
+        {
+            if(!topLevel) syntax_error(parser, parentLine, "block is never closed.");
+            break;
+        }
+
+        Statement stmt;
+        read_statement(parser, &stmt);
+        while(parser->current.type == TOK_NEWLINE) advance(parser);
+
+        uint32_t index;
+        if(parser->current.type == TOK_LBRACE) index = parse_block(parser, &stmt, topLevel);
+        else index = parse_statement(parser, &stmt, topLevel);
+        if(parser->failed) break;
+
+        if(tail == 0) parser->file->nodes[parent].child = index;
+        else parser->file->nodes[tail].next = index;
+        tail = index;
+    }
+    return parent;
+}
+
+
+//* Upper bound on the node count: every node ends on a newline or a brace
+static uint32_t node_bound(const char* source, size_t size)
+{
+    uint32_t bound = 2;
+    for(size_t i = 0; i < size; i++)
+    {
+        char c = source[i];
+        if(c == '\n' || c == '{' || c == '}') bound++;
+    }
+    return bound;
+}
+
+
+
+// ==== Interface ====
+
+bool parse_pipefile(const char* source, size_t size, PipeFile* file)
+{
+    if(size > UINT32_MAX)
+    {
+        log_full("Pipe file is too large.", CRITICAL, READ);
+        return false;
+    }
+
+    file->source = source;
+    file->size = size;
+    file->count = 0;
+    arena_init(&file->arena, 0);
+
+    Parser parser = {.file = file, .failed = false};
+    parser.capacity = node_bound(source, size);
+    file->nodes = (Node*)arena_alloc(&file->arena, parser.capacity * sizeof(Node));
+    if(file->nodes == NULL)
+    {
+        log_full("Could not allocate the pipe file tree.", CRITICAL, READ);
+        return false;
+    }
+
+    init_lexer(&parser.lexer, source, (uint32_t)size);
+    advance(&parser);
+    new_node(&parser, NODE_ROOT, 0);
+    parse_body(&parser, 0, true);
+    return !parser.failed;
+}
+
+
+bool read_pipefile(const char* path, PipeFile* file)
+{
+    memset(file, 0, sizeof(PipeFile));
+
+    char buf[MAX_PATH_SIZE + 64];
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        snprintf(buf, sizeof(buf), "Could not open pipe file '%s'.", path);
+        log_full(buf, CRITICAL, READ);
+        return false;
+    }
+
+    struct stat fileInfo;
+    if(fstat(fd, &fileInfo) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = NULL;
+    if(fileInfo.st_size > 0)
+    {
+        mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            close(fd);
+            snprintf(buf, sizeof(buf), "Could not map pipe file '%s'.", path);
+            log_full(buf, CRITICAL, READ);
+            return false;
+        }
+        madvise(mapping, fileInfo.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    file->mapping = mapping;
+    file->mappingSize = fileInfo.st_size;
+    file->sourceMtime = (uint64_t)fileInfo.st_mtim.tv_sec * 1000000000ull + fileInfo.st_mtim.tv_nsec;
+    file->sourceInode = (uint64_t)fileInfo.st_ino;
+    return parse_pipefile(mapping != NULL ? (const char*)mapping : "", fileInfo.st_size, file);
+}
+
+
+void close_pipefile(PipeFile* file)
+{
+    if(file == NULL) return;
+
+    arena_free(&file->arena);
+    if(file->mapping != NULL) munmap(file->mapping, file->mappingSize);
+    memset(file, 0, sizeof(PipeFile));
+    return;
+}
+
+
+const Node* get_node(const PipeFile* file, uint32_t index)
+{
+    if(index == 0 || index >= file->count) return NULL;
+    return &file->nodes[index];
+}
+
+
+bool slice_equals(const PipeFile* file, Slice slice, const char* text)
+{
+    size_t length = strlen(text);
+    return length == slice.length && memcmp(&file->source[slice.offset], text, length) == 0;
+}
+
+
+const char* slice_copy(const PipeFile* file, Slice slice, char* buf, size_t size)
+{
+    if(size == 0) return buf;
+
+    size_t length = slice.length;
+    if(length >= size) length = size - 1;
+    memcpy(buf, &file->source[slice.offset], length);
+    buf[length] = '\0';
+    return buf;
+}
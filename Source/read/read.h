@@ -0,0 +1,150 @@
+#pragma once
+// Read maps the pipe file and parses it into a tree of nodes.
+// Nothing is copied out of the file: tokens and nodes refer to
+// it through (offset, length) slices, and all nodes share one
+// arena released by close_pipefile().
+// The parsed and configured result is saved as a binary image in
+// PIPE_DIRECTORY and mapped back as long as the pipe file is unchanged.
+
+#include "../global.h"
+#include "../util/arena.h"
+
+#include <stdint.h>
+
+
+#define PIPE_IMAGE "pipefile"       // file name of the pipe cache inside PIPE_DIRECTORY
+#define PIPE_IMAGE_VERSION 2
+
+
+// ==== Tokens ====
+
+typedef enum
+{
+    TOK_EOF = 0,
+    TOK_NEWLINE,
+    TOK_WORD,       // anything else, parentheses and quotes may hold blanks
+    TOK_ASSIGN,     // =:  +:  -:  :  =
+    TOK_ARROW,      // ->
+    TOK_LBRACE,
+    TOK_RBRACE,
+} TokenType;
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length;
+} Slice;
+
+typedef struct
+{
+    TokenType type;
+    Slice text;
+    uint32_t line;
+} Token;
+
+typedef struct
+{
+    const char* source;
+    uint32_t size;
+    uint32_t cursor;
+    uint32_t line;
+} Lexer;
+
+
+
+// ==== Syntax tree ====
+
+typedef enum
+{
+    NODE_ROOT = 0,
+    NODE_CONFIG,    // config { ... }
+    NODE_ACTION,    // action <name>[: <header>] { ... }
+    NODE_PIPE,      // pipe <name>[: <header>] { ... }
+    NODE_FLOW,      // flow <name>[: <header>] { ... }
+    NODE_BLOCK,     // <name> [<header>] { ... } nested in another block (map, if, ...)
+    NODE_ASSIGN,    // [default] <name> <op> <value>
+    NODE_MAPPING,   // <name> -> <value> [: <extra>]
+    NODE_ITEM,      // a bare line, e.g. a flow step
+    NODE_POOL,      // pool <name>[: <capacity>] { ... }
+} NodeKind;
+
+typedef enum
+{
+    OP_NONE = 0,
+    OP_SET,         // =:  :  =
+    OP_APPEND,      // +:
+    OP_REMOVE,      // -:
+} AssignOp;
+
+typedef struct
+{
+    uint8_t kind;       // NodeKind
+    uint8_t op;         // AssignOp
+    uint8_t isDefault;
+    uint8_t reserved;
+    uint32_t line;
+    Slice name;         // block name, variable, mapping input or item text
+    Slice header;       // text after the block name (and its ':')
+    Slice value;        // assigned value or mapping output
+    Slice extra;        // mapping dependencies
+    uint32_t child;     // first child, 0 for none (the root is never a child)
+    uint32_t next;      // next sibling, 0 for none
+} Node;
+
+typedef struct
+{
+    uint32_t name;      // offsets into PipeFile.strings, both NUL-terminated
+    uint32_t value;
+} Variable;
+
+typedef struct
+{
+    const char* source;     // the mapped file
+    size_t size;
+    uint64_t sourceMtime;   // ns since the epoch, fstat of the file that was mapped
+    uint64_t sourceInode;
+    Node* nodes;            // nodes[0] is the root
+    uint32_t count;
+
+    Variable* variables;    // resolved configuration, filled by resolve_config()
+    uint32_t variableCount;
+    const char* strings;
+    uint32_t stringsSize;
+
+    Arena arena;
+    void* mapping;
+    size_t mappingSize;
+} PipeFile;
+
+
+
+// ==== Interface ====
+
+//* Start lexing <size> bytes of <source>
+void init_lexer(Lexer* lexer, const char* source, uint32_t size);
+//* Next token. Blanks and // comments are skipped, newlines are tokens.
+Token next_token(Lexer* lexer);
+
+//* Map and parse a pipe file -> false on I/O or syntax error (already logged)
+bool read_pipefile(const char* path, PipeFile* file);
+//* Parse an in-memory buffer that outlives <file> -> false on syntax error (already logged)
+bool parse_pipefile(const char* source, size_t size, PipeFile* file);
+//* Release the nodes and the mapping
+void close_pipefile(PipeFile* file);
+
+//* Run the config block and top-level assignments, then apply "<var>[=<value>]" defines -> false on error
+bool resolve_config(PipeFile* file, const char* const* defines, size_t count);
+//* Resolved value of <name> -> NULL if undefined
+const char* get_variable(const PipeFile* file, const char* name);
+
+//* Map the pipe cache of <path> from <directory> -> false if missing, stale or built with other defines
+bool load_pipe_image(const char* directory, const char* path, const char* const* defines, size_t count, PipeFile* file);
+//* Write a parsed and resolved <file> as the pipe cache of <path> -> false on error (already logged)
+bool save_pipe_image(const char* directory, const char* path, const char* const* defines, size_t count, const PipeFile* file);
+
+//* Node by index -> NULL for 0 (no node) or out of range; the root is file->nodes[0]
+const Node* get_node(const PipeFile* file, uint32_t index);
+//* True if <slice> holds exactly <text>
+bool slice_equals(const PipeFile* file, Slice slice, const char* text);
+//* Copy a slice into <buf> as a string -> <buf>, truncated to fit
+const char* slice_copy(const PipeFile* file, Slice slice, char* buf, size_t size);
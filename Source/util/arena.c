@@ -0,0 +1,107 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+
+
+// ==== Internal Helpers ====
+
+static size_t align_up(size_t size)
+{
+    const size_t alignment = alignof(max_align_t);
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+//* Push a new block able to hold at least <size> bytes
+static ArenaBlock* new_block(Arena* arena, size_t size)
+{
+    size_t blockSize = arena->blockSize;
+    if(size > blockSize) blockSize = size;
+
+    ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+    if(block == NULL) return NULL;
+
+    block->next = arena->head;
+    block->size = blockSize;
+    block->used = 0;
+    arena->head = block;
+    return block;
+}
+
+
+
+// ==== Interface ====
+
+void arena_init(Arena* arena, size_t blockSize)
+{
+    if(arena == NULL) return;
+    if(blockSize == 0) blockSize = ARENA_DEFAULT_BLOCK;
+
+    arena->head = NULL;
+    arena->blockSize = blockSize;
+    return;
+}
+
+
+void* arena_alloc(Arena* arena, size_t size)
+{
+    if(arena == NULL) return NULL;
+
+    size = align_up(size);
+    ArenaBlock* block = arena->head;
+    if(block == NULL || block->size - block->used < size)
+        block = new_block(arena, size);
+    if(block == NULL) return NULL;
+
+    void* ptr = &block->data[block->used];
+    block->used += size;
+    return ptr;
+}
+
+
+char* arena_strndup(Arena* arena, const char* str, size_t size)
+{
+    char* copy = (char*)arena_alloc(arena, size + 1);
+    if(copy == NULL) return NULL;
+
+    memcpy(copy, str, size);
+    copy[size] = '\0';
+    return copy;
+}
+
+
+void arena_reset(Arena* arena)
+{
+    if(arena == NULL || arena->head == NULL) return;
+
+    ArenaBlock* block = arena->head->next;
+    while(block != NULL)
+    {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->head->next = NULL;
+    arena->head->used = 0;
+    return;
+}
+
+
+void arena_free(Arena* arena)
+{
+    if(arena == NULL) return;
+
+    ArenaBlock* block = arena->head;
+    while(block != NULL)
+    {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->head = NULL;
+    return;
+}
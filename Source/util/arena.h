@@ -0,0 +1,38 @@
+#pragma once
+// Arena is a chunked bump allocator. Allocations are never freed
+// one by one: the whole arena is reset or freed in a single call.
+
+#include "../global.h"
+
+
+#define ARENA_DEFAULT_BLOCK 65536   // bytes per block unless a larger allocation asks for more
+
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock* head;       // current block, older blocks follow
+    size_t blockSize;
+} Arena;
+
+
+
+// ==== Interface ====
+
+//* Prepare an empty arena. No memory is reserved until the first allocation.
+void arena_init(Arena* arena, size_t blockSize);
+//* Allocate <size> bytes, aligned for any type -> NULL on allocation failure
+void* arena_alloc(Arena* arena, size_t size);
+//* Copy <size> bytes into the arena and NUL-terminate them
+char* arena_strndup(Arena* arena, const char* str, size_t size);
+//* Drop all allocations, keeping the most recent block for reuse
+void arena_reset(Arena* arena);
+//* Release all memory held by the arena
+void arena_free(Arena* arena);
@@ -0,0 +1,173 @@
+#include "hash.h"
+
+#include <string.h>
+
+
+
+// ==== Internal constants ====
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+
+
+// ==== Internal Helpers ====
+
+static inline uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const uint8_t* ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));     // unaligned safe, little-endian hosts only
+    return value;
+}
+
+static inline uint32_t read32(const uint8_t* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t lane)
+{
+    acc ^= round64(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+//* Consume 32-byte stripes. The four lanes are independent so they pipeline well.
+static const uint8_t* consume_stripes(uint64_t lanes[4], const uint8_t* ptr, const uint8_t* end)
+{
+    while(ptr + 32 <= end)
+    {
+        lanes[0] = round64(lanes[0], read64(ptr));
+        lanes[1] = round64(lanes[1], read64(ptr + 8));
+        lanes[2] = round64(lanes[2], read64(ptr + 16));
+        lanes[3] = round64(lanes[3], read64(ptr + 24));
+        ptr += 32;
+    }
+
+    return ptr;
+}
+
+//* Fold the remaining (< 32) bytes and avalanche
+static uint64_t finalize(uint64_t acc, const uint8_t* ptr, size_t size)
+{
+    const uint8_t* end = ptr + size;
+    while(ptr + 8 <= end)
+    {
+        acc ^= round64(0, read64(ptr));
+        acc = rotl(acc, 27) * PRIME1 + PRIME4;
+        ptr += 8;
+    }
+    if(ptr + 4 <= end)
+    {
+        acc ^= (uint64_t)read32(ptr) * PRIME1;
+        acc = rotl(acc, 23) * PRIME2 + PRIME3;
+        ptr += 4;
+    }
+    while(ptr < end)
+    {
+        acc ^= (*ptr) * PRIME5;
+        acc = rotl(acc, 11) * PRIME1;
+        ptr++;
+    }
+
+    acc ^= acc >> 33;
+    acc *= PRIME2;
+    acc ^= acc >> 29;
+    acc *= PRIME3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+static uint64_t merge_lanes(const uint64_t lanes[4])
+{
+    uint64_t acc = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    for(size_t lane = 0; lane < 4; lane++)
+        acc = merge_round(acc, lanes[lane]);
+    return acc;
+}
+
+
+
+// ==== Interface ====
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+    HashState state;
+    hash_init(&state, seed);
+    hash_update(&state, data, size);
+    return hash_digest(&state);
+}
+
+
+uint64_t hash_string(const char* str)
+{
+    if(str == NULL) return 0;
+    return hash_bytes(str, strlen(str), 0);
+}
+
+
+void hash_init(HashState* state, uint64_t seed)
+{
+    state->lanes[0] = seed + PRIME1 + PRIME2;
+    state->lanes[1] = seed + PRIME2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - PRIME1;
+    state->total = 0;
+    state->buffered = 0;
+    state->seed = seed;
+}
+
+
+void hash_update(HashState* state, const void* data, size_t size)
+{
+    const uint8_t* ptr = (const uint8_t*)data;
+    const uint8_t* end = ptr + size;
+    state->total += size;
+
+    if(state->buffered + size < 32)     // not even one stripe yet
+    {
+        memcpy(&state->buffer[state->buffered], ptr, size);
+        state->buffered += size;
+        return;
+    }
+
+    if(state->buffered > 0)     // complete the pending stripe first
+    {
+        size_t fill = 32 - state->buffered;
+        memcpy(&state->buffer[state->buffered], ptr, fill);
+        consume_stripes(state->lanes, state->buffer, state->buffer + 32);
+        ptr += fill;
+        state->buffered = 0;
+    }
+
+    ptr = consume_stripes(state->lanes, ptr, end);
+    state->buffered = end - ptr;
+    memcpy(state->buffer, ptr, state->buffered);
+}
+
+
+uint64_t hash_digest(const HashState* state)
+{
+    uint64_t acc;
+    if(state->total >= 32) acc = merge_lanes(state->lanes);
+    else acc = state->seed + PRIME5;
+
+    acc += state->total;
+    return finalize(acc, state->buffer, state->buffered);
+}
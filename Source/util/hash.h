@@ -0,0 +1,31 @@
+#pragma once
+// Fast non-cryptographic 64-bit hashing (XXH64), used for
+// file fingerprints, cache keys and hash tables.
+
+#include "../global.h"
+
+#include <stdint.h>
+
+
+typedef struct
+{
+    uint64_t lanes[4];
+    uint64_t total;
+    uint8_t buffer[32];     // bytes waiting for a full stripe
+    size_t buffered;
+    uint64_t seed;
+} HashState;
+
+
+
+// ==== Interface ====
+
+//* Hash a buffer in one call
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
+//* Hash a NUL-terminated string
+uint64_t hash_string(const char* str);
+
+//* Streaming: init, feed any number of chunks, then digest
+void hash_init(HashState* state, uint64_t seed);
+void hash_update(HashState* state, const void* data, size_t size);
+uint64_t hash_digest(const HashState* state);
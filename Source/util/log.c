@@ -1,430 +1,660 @@
-#define LOG_INTERNAL    // Access private functions
-#include "log.h"
-#undef LOG_INTERNAL     // Avoid conflicts with other defs
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <time.h>
-
-
-
-// ==== Internal structures and types ====
-
-typedef enum ColorType
-{
-    CLR_VERBOSE = 0,    // = VERBOSE
-    CLR_INFO = 1,       // = INFO
-    CLR_WARNING = 2,    // = WARNING
-    CLR_CRITICAL = 3,   // = CRITICAL
-    CLR_FATAL = 4,      // = FATAL
-    CLR_CLEAR = 5,
-    CLR_TIME = 6,
-    CLR_SOURCE = 7,
-    CLR_MSG = 8,
-
-} ColorType;
-
-typedef struct LogEntry
-{
-    const char* msg;
-    LogLevel level;
-    LogSource source;
-    clock_t timestamp;
-    struct LogEntry* nextEntry;
-
-} LogEntry;
-
-typedef struct
-{
-    FILE* logfile;          // File to log to
-
-    bool logSupress;        // weather to supress logging to log file 
-    bool logLevel;          // As of which level to log in file
-    bool stdSupress;        // weather to supress logging to stdout
-    bool stdLevel;          // As of which level to log to std
-    
-    LogEntry* stackTail;    // the tail of the log stack
-    LogEntry* stackHead;    // The start of the log stack
-    LogEntry* stackFile;    // Where the file logging begins
-
-    callback_ptr* callbackList; // list of callback cleanup functions
-    size_t callbackSize;
-    size_t nextCallbackIndex;
-
-} LogStack;
-
-
-// ==== Static variables ====
-
-// Static colors array
-static const char* colors[] = 
-{
-    "\x1b[1;34m",   // CLR_VERBOSE  = Bold blue
-    "\x1b[1;32m",   // CLR_INFO     = Bold green
-    "\x1b[1;33m",   // CLR_WARNING  = Bold yellow
-    "\x1b[1;35m",   // CLR_CRITICAL = Bold purple
-    "\x1b[1;31m",   // CLR_FATAL    = Bold red
-    "\x1b[0m",      // CLR_CLEAR    = clear
-    "\x1b[0;36m",   // CLR_TIME     = cyan
-    "\x1b[0;97m",   // CLR_SOURCE   = normal white (high-intensity)
-    "\x1b[0;90m",   // CLR_MSG      = light black (high-intensity)
-};
-
-// Static string mappings
-static const char* const LS_verbose = "VERBOSE";
-static const char* const LS_info = "INFO";
-static const char* const LS_warning = "WARNING";
-static const char* const LS_critical = "CRITICAL";
-static const char* const LS_fatal = "FATAL";
-
-static const char* const TS_none = "";
-static const char* const TS_system = "system";
-static const char* const TS_static_fallback = "static fallback";
-static const char* const TS_cli = "cli";
-static const char* const TS_logger = "logger";
-
-// log stack
-static LogStack mainStack = (LogStack)
-{
-    .logfile = NULL, 
-    .logSupress = true, 
-    .logLevel = INFO,
-    .stdSupress = false,
-    .stdLevel = WARNING,
-    .stackTail = NULL,
-    .stackHead = NULL,
-    .stackFile = NULL,
-    .callbackList = NULL,
-    .callbackSize = 0,
-    .nextCallbackIndex = 0,
-};
-
-// static fallback logs for guaranteed logs in case of logging failure (MUST BE FATAL OR SEGFAULT)
-static LogEntry fatal_malloc_log =
-    {"Could not allocate required space while processing log.", FATAL, STATIC_FALLBACK, 0, NULL};
-static LogEntry fatal_job_alloc = 
-    {"Could not reserve required space for cleanup job.", FATAL, STATIC_FALLBACK, 0, NULL};
-
-
-
-// ==== Internal Helpers ====
-
-static const char* lvl_to_str(LogLevel lvl)
-{
-    switch (lvl)
-    {
-        case VERBOSE: return LS_verbose;
-        case INFO: return LS_info;
-        case WARNING: return LS_warning;
-        case CRITICAL: return LS_critical;
-        case FATAL: return LS_fatal;
-        default:
-            return "VOID";
-    }
-
-    return "VOID";
-}
-
-static const char* src_to_str(LogSource src)
-{
-    switch (src)
-    {
-        case STATIC_FALLBACK: return TS_static_fallback;
-        case NONE: return TS_none;
-        case SYSTEM: return TS_system;
-        case CLI: return TS_cli;
-        case LOGGER: return TS_logger;
-        default:
-            return "unknown";
-    }
-
-    return "unknown";
-}
-
-
-//* Reduce log_stack up to boundary
-static void clean_log_stack(LogEntry* boundary)
-{
-    LogEntry *currentEntry = mainStack.stackHead;
-    LogEntry *previousEntry = NULL;
-    while(currentEntry != boundary)
-    {
-        if(currentEntry == NULL) break; // end reached
-
-        previousEntry = currentEntry;
-        currentEntry = currentEntry->nextEntry;
-        if(previousEntry->source = STATIC_FALLBACK) continue; // don't free static logs
-
-        free(previousEntry);
-    }
-
-    mainStack.stackHead = boundary;
-    return;
-}
-
-//* Clear the log stack
-static void clear_log_stack()
-{
-    clean_log_stack(NULL);
-    return;
-}
-
-//* Clear the job list
-static void free_callback_list()
-{
-    if(mainStack.callbackList != NULL)
-        free(mainStack.callbackList);
-    return;
-}
-
-//* Run all cleanup callback functions upon fatal
-static void cleanup()
-{
-    
-    for(size_t jobID = 0; jobID < mainStack.callbackSize; jobID++)
-    {
-        callback_ptr cleanupFn = mainStack.callbackList[jobID];
-        if(cleanupFn == NULL)
-            continue;
-        cleanupFn();  // call cleanup fn
-    }
-    
-    close_logging();
-    exit(-1);
-}
-
-//* Prints formatted output to desired outputs
-static void print_log(const LogEntry* log)
-{
-    if(log == NULL) return;
-    if(mainStack.stdSupress) return;    // don't print if supressing std
-    if(log->level < mainStack.stdLevel) return; // don't print if not important
-
-    FILE *outStream = stdout;
-    if(log->level >= CRITICAL)  // log to stderr if critical or fatal
-        outStream = stderr;
-
-    fprintf(outStream, "%s%ju%s - [%s%s%s] %s%s%s: %s%s%s\n", colors[CLR_TIME], log->timestamp, colors[CLR_CLEAR],
-                                                              colors[log->level], lvl_to_str(log->level), colors[CLR_CLEAR],
-                                                              colors[CLR_SOURCE], src_to_str(log->source), colors[CLR_CLEAR],
-                                                              colors[CLR_MSG], log->msg, colors[CLR_CLEAR]);
-                                                              
-    // TODO: improve timestamp printing
-    return;
-}
-
-//* Shchedule a new log from entry
-static void log_entry(LogEntry* logEntry)
-{
-    // Set time
-    logEntry->timestamp = clock();
-
-    // append new log
-    if(mainStack.stackTail != NULL)
-        mainStack.stackTail->nextEntry = logEntry;
-    mainStack.stackTail = logEntry;
-
-    // display log
-    print_log((const LogEntry*)logEntry);
-    if(logEntry->level == FATAL)
-        cleanup();
-
-    return;
-}
-
-
-
-// ==== Main Interface ====
-
-void log_full(const char* msg, LogLevel lvl, LogSource src)
-{
-    LogEntry *newEntry = (LogEntry*)malloc(sizeof(LogEntry));
-
-    // if new log could not be allocated: 
-    //   - log a fatal malloc instead
-    if(newEntry == NULL)
-    {
-        log_entry(&fatal_malloc_log);
-        return;
-    }
-
-    newEntry->msg = msg;
-    newEntry->level = lvl;
-    newEntry->source = src;
-    newEntry->nextEntry = NULL;
-    
-    log_entry(newEntry);
-    return;
-}
-
-void log_msg(const char* msg)
-{
-    log_full(msg, INFO, NONE);
-    return;
-}
-
-void log_l(const char* msg, LogLevel lvl)
-{
-    log_full(msg, lvl, NONE);
-    return;
-}
-
-void log_t(const char* msg, LogSource src)
-{
-    log_full(msg, INFO, src);
-    return;
-}
-
-void log_fatal(const char* msg, LogSource src)
-{
-    log_full(msg, FATAL, src);
-    return;
-}
-
-void close_logging(void)
-{
-    // don't run cleanup functions
-    close_log_file();
-    clear_log_stack();
-    free_callback_list();
-    return;
-}
-
-void write_file_logs(void)
-{
-    if(mainStack.logfile == NULL) return;   // don't write if no file
-    if(mainStack.logSupress) return;        // don't write if supressing logs
-
-    while(mainStack.stackFile != NULL)
-    {
-        if(mainStack.stackFile->level < mainStack.logLevel) continue;
-        fprintf(mainStack.logfile, "%s\n", mainStack.stackFile->msg);
-        mainStack.stackFile = mainStack.stackFile->nextEntry;
-    }
-
-    return;
-}
-
-// ==== Parametering Functions ====
-
-void set_verbosity(LogLevel lvl)
-{
-    set_log_verbosity(lvl);
-    set_std_verbosity(lvl);
-}
-void set_log_verbosity(LogLevel lvl)
-{
-    write_file_logs();  // Write all logs up to now
-    mainStack.logLevel = lvl;
-    mainStack.stackFile = mainStack.stackTail;
-    return;
-}
-LogLevel get_log_verbosity(void)
-{
-    return mainStack.logLevel;
-}
-void set_std_verbosity(LogLevel lvl)
-{
-    mainStack.stdLevel = lvl;
-    return;
-}
-LogLevel get_std_verbosity(void)
-{
-    return mainStack.stdLevel;
-}
-
-bool set_log_file(const char* path, bool clearFile)
-{
-    if(clearFile)
-        mainStack.logfile = fopen(path, "w");
-    else mainStack.logfile = fopen(path, "a");
-    if(mainStack.logfile == NULL)
-    {
-        log_full("Could not open log file: \"\"", CRITICAL, LOGGER); // TODO: Add attempted file path
-        log_set_enabled(false);
-        return false;
-    }
-
-    log_set_enabled(true);
-    return true;
-}
-void close_log_file(void)
-{
-    log_set_enabled(false);     // writes all logs to file
-    if(mainStack.logfile == NULL) return; // job is already done
-
-    fclose(mainStack.logfile);
-    mainStack.logfile = NULL;
-    return;
-}
-
-void log_set_enabled(bool enabled)
-{
-    mainStack.logSupress = !enabled;
-    if(enabled)
-        mainStack.stackFile = mainStack.stackTail;
-    else    // supress = true
-    {
-        if(mainStack.logfile == NULL)
-            log_full("No log file to write to.", WARNING, LOGGER);
-        write_file_logs();
-        mainStack.stackFile = NULL;
-    }
-
-    return;
-}
-void std_set_enabled(bool enabled)
-{
-    mainStack.stdSupress = !enabled;
-}
-
-size_t register_cleanup(callback_ptr newCallback)
-{
-    if(mainStack.callbackList == NULL)
-    {
-        mainStack.callbackList = (callback_ptr*)malloc(sizeof(callback_ptr));
-        mainStack.callbackSize = 1;
-    }
-    if(mainStack.nextCallbackIndex >= mainStack.callbackSize)
-    {
-        mainStack.callbackSize++;
-        callback_ptr* newCallbackList =     // don't assign to avoid segfaults when doing fatal cleanup
-            (callback_ptr*)realloc(mainStack.callbackList, mainStack.callbackSize*sizeof(callback_ptr));
-
-        if(newCallbackList == NULL)
-        {
-            newCallback();  // do the cleanup fn that was not allocated and will hence not be run
-            log_entry(&fatal_job_alloc);
-            return 0;       // 0 is error
-        }
-    }
-
-    mainStack.callbackList[mainStack.nextCallbackIndex] = newCallback;
-    size_t jobID = mainStack.nextCallbackIndex+1; // transform to 1-indexed
-    while(++(mainStack.nextCallbackIndex) < mainStack.callbackSize)  // search for next spot as of the index
-    {
-        if(mainStack.callbackList[mainStack.nextCallbackIndex] == NULL)    // spot found
-            break;
-    }
-
-    return jobID;
-}
-bool remove_cleanup(size_t jobID)
-{
-    if(jobID > mainStack.callbackSize)
-        return false;   // no job has this ID
-    
-    mainStack.callbackList[--jobID] = NULL; // jobID is 1-indexed
-    if(mainStack.nextCallbackIndex > jobID)
-        mainStack.nextCallbackIndex = jobID;    // backup the search for available spots
-
-    return true;
-}
-
-
-// TODO: Log printing formating --------------- (TIME)
-// TODO: Cleanup callbacks stack manipulation - (DONE)
-// TODO: Non-fatal cleanup + fatal cleanup ---- (DONE)
-// TODO: Add file+stream logging -------------- (DONE)
-// TODO: Add more logging interface functions - (DONE)
-
+#define LOG_INTERNAL    // Access private functions
+#include "log.h"
+#undef LOG_INTERNAL     // Avoid conflicts with other defs
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+
+// ==== Internal structures and types ====
+
+#define LOG_RING_SLOTS 256          // records per thread ring, always a power of 2
+#define LOG_INLINE 192              // message bytes stored in the record itself
+#define LOG_TEXT_BYTES 16384        // per ring arena of longer messages, which are cut to fit it
+#define LOG_IDLE_MIN_MS 2           // writer poll period right after activity
+#define LOG_IDLE_MAX_MS 50          // writer poll period once idle
+
+typedef enum ColorType
+{
+    CLR_VERBOSE = 0,    // = VERBOSE
+    CLR_INFO = 1,       // = INFO
+    CLR_WARNING = 2,    // = WARNING
+    CLR_CRITICAL = 3,   // = CRITICAL
+    CLR_FATAL = 4,      // = FATAL
+    CLR_CLEAR = 5,
+    CLR_TIME = 6,
+    CLR_SOURCE = 7,
+    CLR_MSG = 8,
+
+} ColorType;
+
+typedef struct LogRecord
+{
+    uint64_t timestamp;     // monotonic ns
+    const char* longText;   // message longer than LOG_INLINE, in the ring's text arena
+    size_t textEnd;         // arena position the writer releases once printed, 0 if none
+    uint8_t level;
+    int8_t source;
+    char text[LOG_INLINE];  // the message when it fits
+
+} LogRecord;
+
+//* Single producer (its thread), single consumer (whoever holds writerLock)
+typedef struct LogRing
+{
+    atomic_size_t head;     // next record written
+    atomic_size_t tail;     // next record printed
+    struct LogRing* next;   // all rings, newest first
+    LogRecord records[LOG_RING_SLOTS];
+
+    atomic_size_t textHead; // next arena byte written, positions only grow
+    atomic_size_t textTail; // arena bytes before it were printed
+    char text[LOG_TEXT_BYTES];
+
+} LogRing;
+
+typedef struct
+{
+    FILE* logfile;          // File to log to
+
+    bool logSupress;        // weather to supress logging to log file 
+    LogLevel logLevel;      // As of which level to log in file
+    bool stdSupress;        // weather to supress logging to stdout
+    LogLevel stdLevel;      // As of which level to log to std
+
+    atomic_uint_least64_t epoch;    // monotonic ns of the first log, timestamps are printed from there
+    _Atomic(LogRing*) rings;    // registry, rings live until close_logging()
+    pthread_mutex_t writerLock; // held while printing and while changing the outputs
+    pthread_mutex_t wakeLock;
+    pthread_cond_t wake;
+    pthread_t writer;
+    atomic_bool running;    // the background writer drains the rings
+    atomic_bool stopping;
+    atomic_bool closed;     // after close_logging(), logs are printed directly
+
+    callback_ptr* callbackList; // list of callback cleanup functions
+    size_t callbackSize;
+    size_t nextCallbackIndex;
+
+} LogStack;
+
+
+// ==== Static variables ====
+
+// Static colors array
+static const char* colors[] = 
+{
+    "\x1b[1;34m",   // CLR_VERBOSE  = Bold blue
+    "\x1b[1;32m",   // CLR_INFO     = Bold green
+    "\x1b[1;33m",   // CLR_WARNING  = Bold yellow
+    "\x1b[1;35m",   // CLR_CRITICAL = Bold purple
+    "\x1b[1;31m",   // CLR_FATAL    = Bold red
+    "\x1b[0m",      // CLR_CLEAR    = clear
+    "\x1b[0;36m",   // CLR_TIME     = cyan
+    "\x1b[0;97m",   // CLR_SOURCE   = normal white (high-intensity)
+    "\x1b[0;90m",   // CLR_MSG      = light black (high-intensity)
+};
+
+// Static string mappings
+static const char* const LS_verbose = "VERBOSE";
+static const char* const LS_info = "INFO";
+static const char* const LS_warning = "WARNING";
+static const char* const LS_critical = "CRITICAL";
+static const char* const LS_fatal = "FATAL";
+
+static const char* const TS_none = "";
+static const char* const TS_system = "system";
+static const char* const TS_static_fallback = "static fallback";
+static const char* const TS_cli = "cli";
+static const char* const TS_logger = "logger";
+static const char* const TS_cache = "cache";
+static const char* const TS_execute = "execute";
+static const char* const TS_read = "read";
+static const char* const TS_process = "process";
+
+// log stack
+static LogStack mainStack = (LogStack)
+{
+    .logfile = NULL, 
+    .logSupress = true, 
+    .logLevel = INFO,
+    .stdSupress = false,
+    .stdLevel = INFO,
+    .epoch = 0,
+    .rings = NULL,
+    .writerLock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeLock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .running = false,
+    .stopping = false,
+    .closed = false,
+    .callbackList = NULL,
+    .callbackSize = 0,
+    .nextCallbackIndex = 0,
+};
+
+static _Thread_local LogRing* threadRing = NULL;    // this thread's ring, NULL until it first logs
+static pthread_once_t writerOnce = PTHREAD_ONCE_INIT;
+
+
+
+// ==== Internal Helpers ====
+
+static const char* lvl_to_str(LogLevel lvl)
+{
+    switch (lvl)
+    {
+        case VERBOSE: return LS_verbose;
+        case INFO: return LS_info;
+        case WARNING: return LS_warning;
+        case CRITICAL: return LS_critical;
+        case FATAL: return LS_fatal;
+        default:
+            return "VOID";
+    }
+
+    return "VOID";
+}
+
+static const char* src_to_str(LogSource src)
+{
+    switch (src)
+    {
+        case STATIC_FALLBACK: return TS_static_fallback;
+        case NONE: return TS_none;
+        case SYSTEM: return TS_system;
+        case CLI: return TS_cli;
+        case LOGGER: return TS_logger;
+        case CACHE: return TS_cache;
+        case EXECUTE: return TS_execute;
+        case READ: return TS_read;
+        case PROCESS: return TS_process;
+        default:
+            return "unknown";
+    }
+
+    return "unknown";
+}
+
+
+//* Clear the job list
+static void free_callback_list()
+{
+    if(mainStack.callbackList != NULL)
+        free(mainStack.callbackList);
+    return;
+}
+
+//* Run all cleanup callback functions upon fatal
+static void cleanup()
+{
+    
+    for(size_t jobID = 0; jobID < mainStack.callbackSize; jobID++)
+    {
+        callback_ptr cleanupFn = mainStack.callbackList[jobID];
+        if(cleanupFn == NULL)
+            continue;
+        cleanupFn();  // call cleanup fn
+    }
+    
+    close_logging();
+    exit(-1);
+}
+
+//* Timestamp for a new record, the first one sets the epoch
+static uint64_t log_clock(void)
+{
+    uint64_t now = monotonic_ns();
+    uint_least64_t unset = 0;
+    atomic_compare_exchange_strong(&mainStack.epoch, &unset, now);
+    return now;
+}
+
+//* "seconds.microseconds" since the epoch, <buffer> holds at least 32 bytes
+static const char* format_time(uint64_t timestamp, char* buffer)
+{
+    uint64_t epoch = atomic_load(&mainStack.epoch);
+    uint64_t elapsed = timestamp > epoch ? (timestamp - epoch) / 1000 : 0;
+    snprintf(buffer, 32, "%3ju.%06ju", (uintmax_t)(elapsed / 1000000), (uintmax_t)(elapsed % 1000000));
+    return buffer;
+}
+
+static const char* record_text(const LogRecord* log)
+{
+    return log->longText != NULL ? log->longText : log->text;
+}
+
+//* Prints formatted output to desired outputs. writerLock must be held.
+static void print_log(const LogRecord* log)
+{
+    char stamp[32];
+    format_time(log->timestamp, stamp);
+    if(log->level >= mainStack.logLevel && !mainStack.logSupress && mainStack.logfile != NULL)
+        fprintf(mainStack.logfile, "%s - [%s] %s: %s\n", stamp, lvl_to_str(log->level),
+                                                          src_to_str(log->source), record_text(log));
+
+    if(mainStack.stdSupress) return;    // don't print if supressing std
+    if(log->level < mainStack.stdLevel) return; // don't print if not important
+
+    FILE *outStream = stdout;
+    if(log->level >= CRITICAL)  // log to stderr if critical or fatal
+        outStream = stderr;
+
+    fprintf(outStream, "%s%s%s - [%s%s%s] %s%s%s: %s%s%s\n", colors[CLR_TIME], stamp, colors[CLR_CLEAR],
+                                                              colors[log->level], lvl_to_str(log->level), colors[CLR_CLEAR],
+                                                              colors[CLR_SOURCE], src_to_str(log->source), colors[CLR_CLEAR],
+                                                              colors[CLR_MSG], record_text(log), colors[CLR_CLEAR]);
+    return;
+}
+
+
+/*
+ * Print every pending record, oldest first across the rings, so lines
+ * of different threads keep their order. writerLock must be held.
+ * -> number of records printed
+*/
+static size_t drain_logs(void)
+{
+    size_t printed = 0;
+    while(true)
+    {
+        LogRing* oldest = NULL;
+        for(LogRing* ring = atomic_load(&mainStack.rings); ring != NULL; ring = ring->next)
+        {
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if(tail == atomic_load_explicit(&ring->head, memory_order_acquire)) continue;
+            if(oldest == NULL || ring->records[tail & (LOG_RING_SLOTS - 1)].timestamp <
+               oldest->records[atomic_load_explicit(&oldest->tail, memory_order_relaxed) & (LOG_RING_SLOTS - 1)].timestamp)
+                oldest = ring;
+        }
+        if(oldest == NULL) break;
+
+        size_t tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+        LogRecord* record = &oldest->records[tail & (LOG_RING_SLOTS - 1)];
+        print_log(record);
+        if(record->textEnd != 0) atomic_store_explicit(&oldest->textTail, record->textEnd, memory_order_release);
+        atomic_store_explicit(&oldest->tail, tail + 1, memory_order_release);
+        printed++;
+    }
+
+    if(printed > 0)
+    {
+        fflush(stdout);
+        if(mainStack.logfile != NULL) fflush(mainStack.logfile);
+    }
+    return printed;
+}
+
+//* Print everything logged so far, from the calling thread
+static void flush_logs(void)
+{
+    pthread_mutex_lock(&mainStack.writerLock);
+    drain_logs();
+    pthread_mutex_unlock(&mainStack.writerLock);
+}
+
+
+static void wake_writer(void)
+{
+    pthread_mutex_lock(&mainStack.wakeLock);
+    pthread_cond_signal(&mainStack.wake);
+    pthread_mutex_unlock(&mainStack.wakeLock);
+}
+
+//* Background writer: drains the rings, polling slower while nothing is logged
+static void* run_writer(void* argument)
+{
+    (void)argument;
+    unsigned int period = LOG_IDLE_MIN_MS;
+    while(!atomic_load(&mainStack.stopping))
+    {
+        pthread_mutex_lock(&mainStack.writerLock);
+        size_t printed = drain_logs();
+        pthread_mutex_unlock(&mainStack.writerLock);
+        period = printed > 0 ? LOG_IDLE_MIN_MS : (period * 2 > LOG_IDLE_MAX_MS ? LOG_IDLE_MAX_MS : period * 2);
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += (long)period * 1000000l;
+        until.tv_sec += until.tv_nsec / 1000000000l;
+        until.tv_nsec %= 1000000000l;
+        pthread_mutex_lock(&mainStack.wakeLock);
+        if(!atomic_load(&mainStack.stopping)) pthread_cond_timedwait(&mainStack.wake, &mainStack.wakeLock, &until);
+        pthread_mutex_unlock(&mainStack.wakeLock);
+    }
+    flush_logs();
+    return NULL;
+}
+
+static void start_writer(void)
+{
+    if(pthread_create(&mainStack.writer, NULL, run_writer, NULL) == 0) atomic_store(&mainStack.running, true);
+}
+
+
+//* This thread's ring, registered on first use -> NULL if it can't be allocated
+static LogRing* local_ring(void)
+{
+    if(threadRing != NULL) return threadRing;
+
+    LogRing* ring = (LogRing*)calloc(1, sizeof(LogRing));
+    if(ring == NULL) return NULL;
+    ring->next = atomic_load(&mainStack.rings);
+    while(!atomic_compare_exchange_weak(&mainStack.rings, &ring->next, ring));
+    threadRing = ring;
+    return ring;
+}
+
+//* Wait for the writer to free room in this thread's ring
+static void wait_writer(void)
+{
+    if(atomic_load(&mainStack.running)) wake_writer();
+    else flush_logs();
+    sched_yield();
+}
+
+/*
+ * Reserves <size> contiguous bytes of the ring's text arena, skipping
+ * the end of the arena when the message would wrap. Space comes back
+ * as the writer prints, in order; once every record is printed the
+ * whole arena is free. -> arena position of the text
+*/
+static size_t reserve_text(LogRing* ring, size_t size)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t start = atomic_load_explicit(&ring->textHead, memory_order_relaxed);
+    size_t offset = start % LOG_TEXT_BYTES;
+    if(offset + size > LOG_TEXT_BYTES) start += LOG_TEXT_BYTES - offset;
+    while(atomic_load_explicit(&ring->tail, memory_order_acquire) != head &&
+          start + size - atomic_load_explicit(&ring->textTail, memory_order_acquire) > LOG_TEXT_BYTES) wait_writer();
+    atomic_store_explicit(&ring->textHead, start + size, memory_order_relaxed);
+    return start;
+}
+
+//* Print a record right away, when no ring can take it
+static void print_direct(const char* msg, LogLevel lvl, LogSource src)
+{
+    LogRecord record = {log_clock(), msg, 0, (uint8_t)lvl, (int8_t)src, {0}};
+    pthread_mutex_lock(&mainStack.writerLock);
+    drain_logs();
+    print_log(&record);
+    fflush(stdout);
+    pthread_mutex_unlock(&mainStack.writerLock);
+}
+
+
+
+// ==== Main Interface ====
+
+/*
+ * The calling thread only copies the message into its own ring and
+ * publishes it; printing happens on the writer thread. A full ring
+ * waits for the writer rather than dropping logs. Long messages go to
+ * the ring's text arena, so logging never allocates.
+*/
+void log_full(const char* msg, LogLevel lvl, LogSource src)
+{
+    if(msg == NULL) msg = "";
+    LogRing* ring = NULL;
+    if(!atomic_load(&mainStack.closed))
+    {
+        pthread_once(&writerOnce, start_writer);
+        ring = local_ring();
+    }
+    if(ring == NULL)
+    {
+        bool closed = atomic_load(&mainStack.closed);
+        if(closed) print_direct(msg, lvl, src);
+        else print_direct("Could not allocate required space while processing log.", FATAL, STATIC_FALLBACK);
+        if(!closed || lvl == FATAL) cleanup();
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SLOTS) wait_writer();
+
+    LogRecord* record = &ring->records[head & (LOG_RING_SLOTS - 1)];
+    size_t length = strlen(msg);
+    record->level = (uint8_t)lvl;
+    record->source = (int8_t)src;
+    record->longText = NULL;
+    record->textEnd = 0;
+    if(length < LOG_INLINE) memcpy(record->text, msg, length + 1);
+    else
+    {
+        if(length >= LOG_TEXT_BYTES) length = LOG_TEXT_BYTES - 1;   // cut rather than lost
+        size_t start = reserve_text(ring, length + 1);
+        char* text = &ring->text[start % LOG_TEXT_BYTES];
+        memcpy(text, msg, length);
+        text[length] = '\0';
+        record->longText = text;
+        record->textEnd = start + length + 1;
+    }
+    record->timestamp = log_clock();
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    if(!atomic_load(&mainStack.running)) flush_logs();
+    if(lvl == FATAL)
+    {
+        flush_logs();
+        cleanup();
+    }
+    return;
+}
+
+void log_msg(const char* msg)
+{
+    log_full(msg, INFO, NONE);
+    return;
+}
+
+void log_l(const char* msg, LogLevel lvl)
+{
+    log_full(msg, lvl, NONE);
+    return;
+}
+
+void log_t(const char* msg, LogSource src)
+{
+    log_full(msg, INFO, src);
+    return;
+}
+
+void log_fatal(const char* msg, LogSource src)
+{
+    log_full(msg, FATAL, src);
+    return;
+}
+
+void close_logging(void)
+{
+    // don't run cleanup functions
+    if(atomic_load(&mainStack.running))
+    {
+        atomic_store(&mainStack.stopping, true);
+        wake_writer();
+        if(!pthread_equal(pthread_self(), mainStack.writer)) pthread_join(mainStack.writer, NULL);
+        atomic_store(&mainStack.running, false);
+    }
+    flush_logs();
+    close_log_file();
+
+    // later logs are printed directly
+    atomic_store(&mainStack.closed, true);
+    pthread_mutex_lock(&mainStack.writerLock);
+    LogRing* ring = atomic_exchange(&mainStack.rings, NULL);
+    pthread_mutex_unlock(&mainStack.writerLock);
+    while(ring != NULL)
+    {
+        LogRing* next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    threadRing = NULL;
+    free_callback_list();
+    mainStack.callbackList = NULL;
+    mainStack.callbackSize = 0;
+    mainStack.nextCallbackIndex = 0;
+    return;
+}
+
+// ==== Parametering Functions ====
+
+void set_verbosity(LogLevel lvl)
+{
+    set_log_verbosity(lvl);
+    set_std_verbosity(lvl);
+}
+void set_log_verbosity(LogLevel lvl)
+{
+    pthread_mutex_lock(&mainStack.writerLock);
+    drain_logs();   // Write all logs up to now
+    mainStack.logLevel = lvl;
+    pthread_mutex_unlock(&mainStack.writerLock);
+    return;
+}
+LogLevel get_log_verbosity(void)
+{
+    return mainStack.logLevel;
+}
+void set_std_verbosity(LogLevel lvl)
+{
+    pthread_mutex_lock(&mainStack.writerLock);
+    drain_logs();
+    mainStack.stdLevel = lvl;
+    pthread_mutex_unlock(&mainStack.writerLock);
+    return;
+}
+LogLevel get_std_verbosity(void)
+{
+    return mainStack.stdLevel;
+}
+
+bool set_log_file(const char* path, bool clearFile)
+{
+    FILE* file = fopen(path, clearFile ? "w" : "a");
+    if(file == NULL)
+    {
+        char buf[512];
+        snprintf(buf, sizeof(buf), "Could not open log file: \"%s\"", path);
+        log_full(buf, CRITICAL, LOGGER);
+        log_set_enabled(false);
+        return false;
+    }
+
+    pthread_mutex_lock(&mainStack.writerLock);
+    drain_logs();   // earlier logs are not written to the new file
+    if(mainStack.logfile != NULL) fclose(mainStack.logfile);
+    mainStack.logfile = file;
+    pthread_mutex_unlock(&mainStack.writerLock);
+    log_set_enabled(true);
+    return true;
+}
+void close_log_file(void)
+{
+    log_set_enabled(false);     // writes all logs to file
+
+    pthread_mutex_lock(&mainStack.writerLock);
+    if(mainStack.logfile != NULL) fclose(mainStack.logfile);
+    mainStack.logfile = NULL;
+    pthread_mutex_unlock(&mainStack.writerLock);
+    return;
+}
+
+void log_set_enabled(bool enabled)
+{
+    if(!enabled && mainStack.logfile == NULL && !mainStack.logSupress)
+        log_full("No log file to write to.", WARNING, LOGGER);
+
+    pthread_mutex_lock(&mainStack.writerLock);
+    drain_logs();   // pending logs follow the previous setting
+    mainStack.logSupress = !enabled;
+    pthread_mutex_unlock(&mainStack.writerLock);
+    return;
+}
+void std_set_enabled(bool enabled)
+{
+    pthread_mutex_lock(&mainStack.writerLock);
+    drain_logs();
+    mainStack.stdSupress = !enabled;
+    pthread_mutex_unlock(&mainStack.writerLock);
+}
+
+size_t register_cleanup(callback_ptr newCallback)
+{
+    if(mainStack.callbackList == NULL)
+    {
+        mainStack.callbackList = (callback_ptr*)malloc(sizeof(callback_ptr));
+        mainStack.callbackSize = 1;
+    }
+    if(mainStack.nextCallbackIndex >= mainStack.callbackSize)
+    {
+        mainStack.callbackSize++;
+        callback_ptr* newCallbackList =     // don't assign to avoid segfaults when doing fatal cleanup
+            (callback_ptr*)realloc(mainStack.callbackList, mainStack.callbackSize*sizeof(callback_ptr));
+
+        if(newCallbackList == NULL)
+        {
+            newCallback();  // do the cleanup fn that was not allocated and will hence not be run
+            log_full("Could not reserve required space for cleanup job.", FATAL, STATIC_FALLBACK);
+            return 0;       // 0 is error
+        }
+        mainStack.callbackList = newCallbackList;
+    }
+
+    mainStack.callbackList[mainStack.nextCallbackIndex] = newCallback;
+    size_t jobID = mainStack.nextCallbackIndex+1; // transform to 1-indexed
+    while(++(mainStack.nextCallbackIndex) < mainStack.callbackSize)  // search for next spot as of the index
+    {
+        if(mainStack.callbackList[mainStack.nextCallbackIndex] == NULL)    // spot found
+            break;
+    }
+
+    return jobID;
+}
+bool remove_cleanup(size_t jobID)
+{
+    if(jobID > mainStack.callbackSize)
+        return false;   // no job has this ID
+    
+    mainStack.callbackList[--jobID] = NULL; // jobID is 1-indexed
+    if(mainStack.nextCallbackIndex > jobID)
+        mainStack.nextCallbackIndex = jobID;    // backup the search for available spots
+
+    return true;
+}
+
+
+// ==== Timing spans ====
+
+LogSpan span_begin(const char* name, LogSource source)
+{
+    return (LogSpan){name != NULL ? name : "", source, monotonic_ns()};
+}
+
+uint64_t span_end(const LogSpan* span)
+{
+    if(span == NULL) return 0;
+    uint64_t elapsed = monotonic_ns() - span->begin;
+
+    char message[LOG_INLINE];
+    snprintf(message, sizeof(message), "%.150s took %.3fms", span->name, (double)elapsed / 1e6);
+    log_full(message, VERBOSE, span->source);
+    return elapsed;
+}
+
+
+// TODO: Log printing formating --------------- (DONE)
+// TODO: Cleanup callbacks stack manipulation - (DONE)
+// TODO: Non-fatal cleanup + fatal cleanup ---- (DONE)
+// TODO: Add file+stream logging -------------- (DONE)
+// TODO: Add more logging interface functions - (DONE)
+
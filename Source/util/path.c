@@ -0,0 +1,301 @@
+#include "path.h"
+
+#include "arena.h"
+#include "hash.h"
+#include "platform.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+// ==== Internal structures and types ====
+
+typedef struct
+{
+    PathID parent;
+    uint32_t length;        // of <name>
+    const char* name;       // in the table's arena
+    uint64_t key;           // hash of the whole canonical path
+} PathNode;
+
+typedef struct
+{
+    PathNode* nodes;        // indexed by id, 0 unused
+    size_t count;
+    size_t capacity;
+
+    PathID* slots;          // open addressing over (parent, name), PATH_NONE marks a free slot
+    size_t slotCount;
+
+    Arena names;
+    pthread_mutex_t lock;
+} PathTable;
+
+
+// ==== Static variables ====
+
+static PathTable pathTable = (PathTable)
+{
+    .nodes = NULL,
+    .count = 0,
+    .capacity = 0,
+    .slots = NULL,
+    .slotCount = 0,
+    .names = {NULL, 0},
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+// ==== Internal Helpers ====
+
+static uint64_t edge_hash(PathID parent, const char* name, size_t length)
+{
+    return hash_bytes(name, length, parent);
+}
+
+static uint64_t string_key(const char* path)
+{
+    uint64_t key = hash_string(path);
+    return key == 0 ? 1 : key;  // 0 is reserved, as in the file cache
+}
+
+//* Slot holding the edge, or the free slot it would take. Lock must be held.
+static PathID* find_slot(PathID parent, const char* name, size_t length)
+{
+    size_t mask = pathTable.slotCount - 1;
+    for(size_t slot = edge_hash(parent, name, length) & mask; ; slot = (slot + 1) & mask)
+    {
+        PathID id = pathTable.slots[slot];
+        if(id == PATH_NONE) return &pathTable.slots[slot];
+
+        const PathNode* node = &pathTable.nodes[id];
+        if(node->parent == parent && node->length == length && memcmp(node->name, name, length) == 0)
+            return &pathTable.slots[slot];
+    }
+}
+
+//* Make room for one more node and edge. Lock must be held.
+static bool reserve(void)
+{
+    if(pathTable.count == pathTable.capacity)
+    {
+        size_t capacity = pathTable.capacity ? pathTable.capacity * 2 : PATH_TABLE_MIN;
+        PathNode* grown = (PathNode*)realloc(pathTable.nodes, capacity * sizeof(PathNode));
+        if(grown == NULL) return false;
+        pathTable.nodes = grown;
+        pathTable.capacity = capacity;
+    }
+
+    if(pathTable.slots != NULL && (pathTable.count + 1) * 10 < pathTable.slotCount * 7) return true;
+
+    size_t oldCount = pathTable.slotCount;
+    PathID* old = pathTable.slots;
+    size_t newCount = oldCount ? oldCount * 2 : PATH_TABLE_MIN;
+    PathID* grown = (PathID*)calloc(newCount, sizeof(PathID));
+    if(grown == NULL) return false;
+
+    pathTable.slots = grown;
+    pathTable.slotCount = newCount;
+    for(size_t slot = 0; slot < oldCount; slot++)
+    {
+        if(old[slot] == PATH_NONE) continue;
+        const PathNode* node = &pathTable.nodes[old[slot]];
+        *find_slot(node->parent, node->name, node->length) = old[slot];
+    }
+    free(old);
+    return true;
+}
+
+static PathID add_node(PathID parent, const char* name, size_t length, uint64_t key)
+{
+    char* copy = arena_strndup(&pathTable.names, name, length);
+    if(copy == NULL) return PATH_NONE;
+
+    PathID id = (PathID)pathTable.count++;
+    pathTable.nodes[id] = (PathNode){parent, (uint32_t)length, copy, key};
+    return id;
+}
+
+//* Create the unused slot 0 and both roots. Lock must be held.
+static bool init_table(void)
+{
+    if(pathTable.count > 0) return true;
+    arena_init(&pathTable.names, 0);
+    if(!reserve()) return false;
+
+    pathTable.count = 1;    // PATH_NONE
+    pathTable.nodes[PATH_NONE] = (PathNode){PATH_NONE, 0, "", 0};
+    return add_node(PATH_CURRENT, ".", 1, string_key(".")) == PATH_CURRENT
+        && add_node(PATH_ROOT, "/", 1, string_key("/")) == PATH_ROOT;
+}
+
+//* Rebuild the canonical string of <id>. Lock must be held.
+static size_t build_string(PathID id, char* buf, size_t size)
+{
+    if(id == PATH_NONE || id >= pathTable.count || size < 2) return 0;
+    if(id == PATH_CURRENT || id == PATH_ROOT)
+    {
+        buf[0] = id == PATH_CURRENT ? '.' : '/';
+        buf[1] = '\0';
+        return 1;
+    }
+
+    size_t length = 0;
+    for(PathID at = id; at != PATH_CURRENT && at != PATH_ROOT; at = pathTable.nodes[at].parent)
+        length += pathTable.nodes[at].length + 1;
+    PathID top = id;
+    while(pathTable.nodes[top].parent != PATH_CURRENT && pathTable.nodes[top].parent != PATH_ROOT)
+        top = pathTable.nodes[top].parent;
+    bool absolute = pathTable.nodes[top].parent == PATH_ROOT;
+    if(!absolute) length--;     // no leading separator
+    if(length + 1 > size) return 0;
+
+    buf[length] = '\0';
+    size_t end = length;
+    for(PathID at = id; at != PATH_CURRENT && at != PATH_ROOT; at = pathTable.nodes[at].parent)
+    {
+        const PathNode* node = &pathTable.nodes[at];
+        end -= node->length;
+        memcpy(&buf[end], node->name, node->length);
+        if(end > 0) buf[--end] = '/';
+    }
+    return length;
+}
+
+//* Walk (and optionally extend) the trie along a canonical path. Lock must be held.
+static PathID walk_path(const char* normal, bool create)
+{
+    PathID id = normal[0] == '/' ? PATH_ROOT : PATH_CURRENT;
+    if(strcmp(normal, ".") == 0 || strcmp(normal, "/") == 0) return id;
+
+    const char* part = normal[0] == '/' ? normal + 1 : normal;
+    while(*part != '\0')
+    {
+        const char* end = strchr(part, '/');
+        size_t length = end != NULL ? (size_t)(end - part) : strlen(part);
+
+        PathID* slot = find_slot(id, part, length);
+        if(*slot == PATH_NONE)
+        {
+            if(!create || !reserve()) return PATH_NONE;
+            slot = find_slot(id, part, length);     // the table may have grown
+            size_t prefix = (size_t)(part - normal) + length;
+            char key[MAX_PATH_SIZE];
+            memcpy(key, normal, prefix);
+            key[prefix] = '\0';
+            PathID child = add_node(id, part, length, string_key(key));
+            if(child == PATH_NONE) return PATH_NONE;
+            *slot = child;
+        }
+        id = *slot;
+
+        if(end == NULL) break;
+        part = end + 1;
+    }
+    return id;
+}
+
+
+
+// ==== Interface ====
+
+PathID intern_path(const char* path)
+{
+    char normal[MAX_PATH_SIZE];
+    if(path == NULL || normalize_path(path, normal, sizeof(normal)) == NULL) return PATH_NONE;
+
+    pthread_mutex_lock(&pathTable.lock);
+    PathID id = init_table() ? walk_path(normal, true) : PATH_NONE;
+    pthread_mutex_unlock(&pathTable.lock);
+    return id;
+}
+
+
+PathID intern_child(PathID parent, const char* name, size_t length)
+{
+    char path[MAX_PATH_SIZE];
+    pthread_mutex_lock(&pathTable.lock);
+    size_t used = init_table() ? build_string(parent, path, sizeof(path)) : 0;
+    pthread_mutex_unlock(&pathTable.lock);
+    if(used == 0 || used + length + 2 > sizeof(path)) return PATH_NONE;
+
+    path[used] = '/';
+    memcpy(&path[used + 1], name, length);
+    path[used + length + 1] = '\0';
+    return intern_path(path);
+}
+
+
+PathID find_path(const char* path)
+{
+    char normal[MAX_PATH_SIZE];
+    if(path == NULL || normalize_path(path, normal, sizeof(normal)) == NULL) return PATH_NONE;
+
+    pthread_mutex_lock(&pathTable.lock);
+    PathID id = init_table() ? walk_path(normal, false) : PATH_NONE;
+    pthread_mutex_unlock(&pathTable.lock);
+    return id;
+}
+
+
+PathID path_parent(PathID id)
+{
+    pthread_mutex_lock(&pathTable.lock);
+    PathID parent = id < pathTable.count ? pathTable.nodes[id].parent : PATH_NONE;
+    pthread_mutex_unlock(&pathTable.lock);
+    return parent;
+}
+
+
+const char* path_name(PathID id)
+{
+    pthread_mutex_lock(&pathTable.lock);
+    const char* name = id < pathTable.count ? pathTable.nodes[id].name : "";
+    pthread_mutex_unlock(&pathTable.lock);
+    return name;
+}
+
+
+uint64_t path_key(PathID id)
+{
+    pthread_mutex_lock(&pathTable.lock);
+    uint64_t key = id < pathTable.count ? pathTable.nodes[id].key : 0;
+    pthread_mutex_unlock(&pathTable.lock);
+    return key;
+}
+
+
+size_t path_string(PathID id, char* buf, size_t size)
+{
+    pthread_mutex_lock(&pathTable.lock);
+    size_t length = build_string(id, buf, size);
+    pthread_mutex_unlock(&pathTable.lock);
+    return length;
+}
+
+
+size_t path_count(void)
+{
+    pthread_mutex_lock(&pathTable.lock);
+    size_t count = pathTable.count;
+    pthread_mutex_unlock(&pathTable.lock);
+    return count;
+}
+
+
+void close_paths(void)
+{
+    pthread_mutex_lock(&pathTable.lock);
+    free(pathTable.nodes);
+    free(pathTable.slots);
+    arena_free(&pathTable.names);
+    pathTable.nodes = NULL;
+    pathTable.count = 0;
+    pathTable.capacity = 0;
+    pathTable.slots = NULL;
+    pathTable.slotCount = 0;
+    pthread_mutex_unlock(&pathTable.lock);
+}
@@ -0,0 +1,42 @@
+#pragma once
+// Path interns canonical paths as 32-bit ids. Each path is stored
+// once as a trie node: its parent's id plus its last component, so
+// "src/a.c" and "./src//a.c" give the same id and comparing paths
+// becomes comparing integers. Thread-safe.
+
+#include "../global.h"
+
+#include <stdint.h>
+
+
+#define PATH_NONE 0         // invalid / failed lookups
+#define PATH_CURRENT 1      // "." every relative path hangs from
+#define PATH_ROOT 2         // "/" every absolute path hangs from
+#define PATH_TABLE_MIN 1024 // initial edge table slots, always a power of 2
+
+typedef uint32_t PathID;
+
+
+
+// ==== Interface ====
+
+//* Canonicalize (lexically, see normalize_path) and intern <path> -> PATH_NONE on failure
+PathID intern_path(const char* path);
+//* Id of <parent>/<name> -> PATH_NONE on failure
+PathID intern_child(PathID parent, const char* name, size_t length);
+//* Id of <path> if it was interned before, without adding it -> PATH_NONE otherwise
+PathID find_path(const char* path);
+
+//* Parent of <id>: PATH_CURRENT and PATH_ROOT are their own parents
+PathID path_parent(PathID id);
+//* Last component of <id>, valid until close_paths()
+const char* path_name(PathID id);
+//* Hash of the canonical path string, the key the file cache uses
+uint64_t path_key(PathID id);
+//* Write the canonical path of <id> into <buf> -> its length, 0 if it doesn't fit
+size_t path_string(PathID id, char* buf, size_t size);
+//* Number of interned paths, the two roots included
+size_t path_count(void);
+
+//* Drop every interned path; ids handed out before become invalid
+void close_paths(void);
@@ -1,119 +1,133 @@
-#pragma once
-
-#include "../global.h"
-
-#include <stdint.h>
-
-
-// ==== PLATFORM ENUMS ====
-
-typedef enum {
-    PLATFORM_ARCH_UNKNOWN = 0,
-    
-    PLATFORM_ARCH_X86,
-    PLATFORM_ARCH_X64,
-    PLATFORM_ARCH_ARM,
-    PLATFORM_ARCH_ARM64,
-    PLATFORM_ARCH_RISCV64,
-    PLATFORM_ARCH_PPC,
-    PLATFORM_ARCH_PPC64,
-    PLATFORM_ARCH_MIPS,
-    PLATFORM_ARCH_MIPS64,
-    
-    PLATFORM_ARCH_COUNT
-} hostArch;
-
-typedef enum {
-    PLATFORM_VENDOR_UNKNOWN = 0,
-
-    PLATFORM_VENDOR_NONE,     // "none"
-    PLATFORM_VENDOR_PC,       // "pc"
-    PLATFORM_VENDOR_APPLE,    // "apple"
-    PLATFORM_VENDOR_W64,      // "w64" (MinGW-w64)
-    PLATFORM_VENDOR_IBM,      // "ibm"
-    PLATFORM_VENDOR_ORACLE,   // "oracle" (Solaris)
-    PLATFORM_VENDOR_HP,       // "hp" (HP-UX)
-
-    PLATFORM_VENDOR_COUNT
-} hostVendor;
-
-typedef enum {
-    PLATFORM_ABI_UNKNOWN = 0,
-    PLATFORM_ABI_GLIBC,
-    PLATFORM_ABI_MUSL,
-    PLATFORM_ABI_MSVC,
-    PLATFORM_ABI_BSD,
-    PLATFORM_ABI_SOLARIS,
-    PLATFORM_ABI_AIX,
-    PLATFORM_ABI_HPUX,
-    
-    PLATFORM_ABI_COUNT
-} hostAbi;
-    
-typedef enum {
-    PLATFORM_OS_UNKNOWN = 0,
-
-    PLATFORM_OS_WINDOWS,
-    PLATFORM_OS_LINUX,
-    PLATFORM_OS_MACOS,
-    PLATFORM_OS_FREEBSD,
-    PLATFORM_OS_NETBSD,
-    PLATFORM_OS_OPENBSD,
-    PLATFORM_OS_DRAGONFLYBSD,
-    PLATFORM_OS_SOLARIS,
-    PLATFORM_OS_AIX,
-    PLATFORM_OS_HPUX,
-    PLATFORM_OS_UNIX_GENERIC,
-
-    PLATFORM_OS_COUNT
-} hostOS;
-
-
-
-// ==== Interface Structures ====
-
-typedef enum {
-    FILE_TYPE_NONE = 0,
-    FILE_TYPE_FILE,
-    FILE_TYPE_DIR,
-    FILE_TYPE_ANY
-} fileType;
-
-typedef struct {
-    bool exists;
-    fileType type;
-    uint64_t mtime; // modification time, standardized to unix-time
-    bool readAllow;
-    bool writeAllow;
-} fileStat;
-
-
-
-// ==== Host System Reflection Functions ====
-hostArch get_host_arch(void);
-hostVendor get_host_vendor(void);
-hostAbi get_host_abi(void);
-hostOS get_host_os(void);
-
-const char* get_host_group_name(void);
-const char* get_host_arch_name(void);
-const char* get_host_vendor_name(void);
-const char* get_host_abi_name(void);
-const char* get_host_os_name(void);
-
-bool host_is_windows(void);
-bool host_is_posix(void);
-bool host_is_bsd(void);
-
-
-
-// ==== Interface ====
-
-//* Get the current working directory in standard form.
-const char* get_cwd(char* buf, int size);
-
-//* Get path information. File can be file or directory.
-fileStat stat_path(const char* path);
-
-//* Create desired path. Returns true on success.
-bool create_dir(const char* path);
\ No newline at end of file
+#pragma once
+
+#include "../global.h"
+
+#include <stdint.h>
+
+
+#ifndef MAX_PATH_SIZE
+    #define MAX_PATH_SIZE 4096  // path buffer size used across pipe
+#endif
+
+
+// ==== PLATFORM ENUMS ====
+
+typedef enum {
+    PLATFORM_ARCH_UNKNOWN = 0,
+    
+    PLATFORM_ARCH_X86,
+    PLATFORM_ARCH_X64,
+    PLATFORM_ARCH_ARM,
+    PLATFORM_ARCH_ARM64,
+    PLATFORM_ARCH_RISCV64,
+    PLATFORM_ARCH_PPC,
+    PLATFORM_ARCH_PPC64,
+    PLATFORM_ARCH_MIPS,
+    PLATFORM_ARCH_MIPS64,
+    
+    PLATFORM_ARCH_COUNT
+} hostArch;
+
+typedef enum {
+    PLATFORM_VENDOR_UNKNOWN = 0,
+
+    PLATFORM_VENDOR_NONE,     // "none"
+    PLATFORM_VENDOR_PC,       // "pc"
+    PLATFORM_VENDOR_APPLE,    // "apple"
+    PLATFORM_VENDOR_W64,      // "w64" (MinGW-w64)
+    PLATFORM_VENDOR_IBM,      // "ibm"
+    PLATFORM_VENDOR_ORACLE,   // "oracle" (Solaris)
+    PLATFORM_VENDOR_HP,       // "hp" (HP-UX)
+
+    PLATFORM_VENDOR_COUNT
+} hostVendor;
+
+typedef enum {
+    PLATFORM_ABI_UNKNOWN = 0,
+    PLATFORM_ABI_GLIBC,
+    PLATFORM_ABI_MUSL,
+    PLATFORM_ABI_MSVC,
+    PLATFORM_ABI_BSD,
+    PLATFORM_ABI_SOLARIS,
+    PLATFORM_ABI_AIX,
+    PLATFORM_ABI_HPUX,
+    
+    PLATFORM_ABI_COUNT
+} hostAbi;
+    
+typedef enum {
+    PLATFORM_OS_UNKNOWN = 0,
+
+    PLATFORM_OS_WINDOWS,
+    PLATFORM_OS_LINUX,
+    PLATFORM_OS_MACOS,
+    PLATFORM_OS_FREEBSD,
+    PLATFORM_OS_NETBSD,
+    PLATFORM_OS_OPENBSD,
+    PLATFORM_OS_DRAGONFLYBSD,
+    PLATFORM_OS_SOLARIS,
+    PLATFORM_OS_AIX,
+    PLATFORM_OS_HPUX,
+    PLATFORM_OS_UNIX_GENERIC,
+
+    PLATFORM_OS_COUNT
+} hostOS;
+
+
+
+// ==== Interface Structures ====
+
+typedef enum {
+    FILE_TYPE_NONE = 0,
+    FILE_TYPE_FILE,
+    FILE_TYPE_DIR,
+    FILE_TYPE_ANY
+} fileType;
+
+typedef struct {
+    bool exists;
+    fileType type;
+    uint64_t mtime; // modification time, standardized to unix-time
+    bool readAllow;
+    bool writeAllow;
+    uint64_t mtimeNs;   // modification time in nanoseconds since the epoch
+    uint64_t size;
+    uint64_t inode;
+} fileStat;
+
+
+
+// ==== Host System Reflection Functions ====
+hostArch get_host_arch(void);
+hostVendor get_host_vendor(void);
+hostAbi get_host_abi(void);
+hostOS get_host_os(void);
+
+const char* get_host_group_name(void);
+const char* get_host_arch_name(void);
+const char* get_host_vendor_name(void);
+const char* get_host_abi_name(void);
+const char* get_host_os_name(void);
+
+bool host_is_windows(void);
+bool host_is_posix(void);
+bool host_is_bsd(void);
+
+
+
+// ==== Interface ====
+
+//* Get the current working directory in standard form.
+const char* get_cwd(char* buf, int size);
+
+//* Get path information. File can be file or directory.
+fileStat stat_path(const char* path);
+
+//* Lexically normalize a path ("./a//b/../c" -> "a/c") into <buf> -> NULL if it does not fit.
+const char* normalize_path(const char* path, char* buf, size_t size);
+
+//* Create desired path. Returns true on success.
+bool create_dir(const char* path);
+
+//* Monotonic clock in nanoseconds, unaffected by wall clock changes.
+uint64_t monotonic_ns(void);
\ No newline at end of file
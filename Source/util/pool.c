@@ -0,0 +1,70 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+
+// ==== Internal structures and types ====
+
+typedef struct
+{
+    atomic_size_t next;
+    size_t count;
+    task_ptr task;
+    void* context;
+} TaskQueue;
+
+
+
+// ==== Internal Helpers ====
+
+static void* task_loop(void* arg)
+{
+    TaskQueue* queue = (TaskQueue*)arg;
+    size_t index;
+    while((index = atomic_fetch_add(&queue->next, 1)) < queue->count)
+        queue->task(index, queue->context);
+
+    return NULL;
+}
+
+
+
+// ==== Interface ====
+
+unsigned int processor_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned int)count : 1;
+}
+
+
+void run_parallel(size_t count, unsigned int threads, task_ptr task, void* context)
+{
+    if(task == NULL || count == 0) return;
+    if(threads == 0) threads = processor_count();
+    if(threads > count) threads = (unsigned int)count;
+
+    TaskQueue queue;
+    atomic_init(&queue.next, 0);
+    queue.count = count;
+    queue.task = task;
+    queue.context = context;
+
+    // the calling thread works too, helpers are optional
+    pthread_t* helpers = NULL;
+    if(threads > 1) helpers = (pthread_t*)malloc((threads - 1) * sizeof(pthread_t));
+
+    size_t started = 0;
+    for(; helpers != NULL && started < threads - 1; started++)
+        if(pthread_create(&helpers[started], NULL, task_loop, &queue) != 0) break;
+
+    task_loop(&queue);
+    for(size_t helper = 0; helper < started; helper++)
+        pthread_join(helpers[helper], NULL);
+
+    free(helpers);
+}
@@ -0,0 +1,17 @@
+#pragma once
+// Pool runs independent, index-addressed tasks over a set of
+// short-lived threads. Threads pull the next index from a shared
+// atomic counter, so uneven task costs balance out on their own.
+
+#include "../global.h"
+
+
+typedef void (*task_ptr)(size_t index, void* context);
+
+
+// ==== Interface ====
+
+//* Number of online processors (at least 1)
+unsigned int processor_count(void);
+//* Run task(0..count-1) on up to <threads> threads (0 = one per processor) and wait for all
+void run_parallel(size_t count, unsigned int threads, task_ptr task, void* context);
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include "statbatch.h"
+
+#include "pool.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+#define STAT_MASK (STATX_TYPE | STATX_MTIME | STATX_SIZE | STATX_INO)
+#define FALLBACK_CHUNK 64       // paths per fallback task
+
+typedef struct
+{
+    int fd;
+    unsigned int entries;
+
+    void* sqMapping;
+    size_t sqMappingSize;
+    void* cqMapping;
+    size_t cqMappingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+
+    unsigned int* sqHead;
+    unsigned int* sqTail;
+    unsigned int* sqMask;
+    unsigned int* sqArray;
+    unsigned int* cqHead;
+    unsigned int* cqTail;
+    unsigned int* cqMask;
+    struct io_uring_cqe* cqes;
+} StatRing;
+
+typedef struct
+{
+    const char* const* paths;
+    StatBatch* batch;
+} StatJob;
+
+
+
+// ==== Internal Helpers ====
+
+static void fill_slot(StatBatch* batch, size_t index, const struct statx* info)
+{
+    batch->mtime[index] = (uint64_t)info->stx_mtime.tv_sec * 1000000000ull + info->stx_mtime.tv_nsec;
+    batch->size[index] = info->stx_size;
+    batch->inode[index] = info->stx_ino;
+    if(S_ISREG(info->stx_mode)) batch->type[index] = FILE_TYPE_FILE;
+    else if(S_ISDIR(info->stx_mode)) batch->type[index] = FILE_TYPE_DIR;
+    else batch->type[index] = FILE_TYPE_ANY;
+}
+
+static void stat_one(const char* const* paths, StatBatch* batch, size_t index)
+{
+    struct statx info;
+    if(paths[index] != NULL && statx(AT_FDCWD, paths[index], 0, STAT_MASK, &info) == 0)
+        fill_slot(batch, index, &info);
+}
+
+static void stat_task(size_t chunk, void* context)
+{
+    StatJob* job = (StatJob*)context;
+    size_t end = (chunk + 1) * FALLBACK_CHUNK;
+    if(end > job->batch->count) end = job->batch->count;
+    for(size_t index = chunk * FALLBACK_CHUNK; index < end; index++)
+        stat_one(job->paths, job->batch, index);
+}
+
+
+static void close_ring(StatRing* ring)
+{
+    if(ring->sqes != NULL) munmap(ring->sqes, ring->sqesSize);
+    if(ring->cqMapping != NULL && ring->cqMapping != ring->sqMapping) munmap(ring->cqMapping, ring->cqMappingSize);
+    if(ring->sqMapping != NULL) munmap(ring->sqMapping, ring->sqMappingSize);
+    if(ring->fd >= 0) close(ring->fd);
+}
+
+//* Set up a ring through the raw syscalls -> false if io_uring is missing or not allowed
+static bool open_ring(StatRing* ring)
+{
+    memset(ring, 0, sizeof(StatRing));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, STAT_RING_ENTRIES, &params);
+    if(ring->fd < 0) return false;
+
+    ring->entries = params.sq_entries;
+    ring->sqMappingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqMappingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single && ring->cqMappingSize > ring->sqMappingSize) ring->sqMappingSize = ring->cqMappingSize;
+
+    ring->sqMapping = mmap(NULL, ring->sqMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sqMapping == MAP_FAILED) ring->sqMapping = NULL;
+    if(ring->sqMapping != NULL && single) ring->cqMapping = ring->sqMapping;
+    else if(ring->sqMapping != NULL)
+    {
+        ring->cqMapping = mmap(NULL, ring->cqMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cqMapping == MAP_FAILED) ring->cqMapping = NULL;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) ring->sqes = NULL;
+
+    if(ring->sqMapping == NULL || ring->cqMapping == NULL || ring->sqes == NULL)
+    {
+        close_ring(ring);
+        return false;
+    }
+
+    char* sq = (char*)ring->sqMapping;
+    char* cq = (char*)ring->cqMapping;
+    ring->sqHead = (unsigned int*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned int*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int*)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned int*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned int*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+
+/*
+ * Paths go through the ring in windows of at most <entries> requests,
+ * each with its own statx buffer; the window is drained before the next.
+ * Returns false if the kernel refuses STATX, so the caller can fall back.
+*/
+static bool ring_stat(StatRing* ring, const char* const* paths, StatBatch* batch)
+{
+    struct statx* buffers = (struct statx*)malloc(ring->entries * sizeof(struct statx));
+    if(buffers == NULL) return false;
+    bool unsupported = false;
+
+    for(size_t start = 0; start < batch->count; start += ring->entries)
+    {
+        size_t window = batch->count - start;
+        if(window > ring->entries) window = ring->entries;
+
+        unsigned int tail = *ring->sqTail;
+        unsigned int queued = 0;
+        for(size_t i = 0; i < window; i++)
+        {
+            if(paths[start + i] == NULL) continue;
+            unsigned int slot = tail & *ring->sqMask;
+            struct io_uring_sqe* sqe = &ring->sqes[slot];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)paths[start + i];
+            sqe->len = STAT_MASK;
+            sqe->off = (uint64_t)(uintptr_t)&buffers[i];
+            sqe->statx_flags = 0;
+            sqe->user_data = i;
+            ring->sqArray[slot] = slot;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+        unsigned int completed = 0;
+        unsigned int submitted = 0;
+        while(completed < queued)
+        {
+            long entered = syscall(__NR_io_uring_enter, ring->fd, queued - submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if(entered < 0)
+            {
+                if(errno == EINTR) continue;
+                if(submitted == completed) free(buffers);   // otherwise requests in flight may still write there
+                return false;
+            }
+            submitted += (unsigned int)entered;
+
+            unsigned int head = *ring->cqHead;
+            unsigned int cqTail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+            for(; head != cqTail; head++, completed++)
+            {
+                const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+                if(cqe->res == -EINVAL) unsupported = true;     // kernel without STATX on the ring
+                else if(cqe->res == 0) fill_slot(batch, start + cqe->user_data, &buffers[cqe->user_data]);
+            }
+            __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+        }
+        if(unsupported) break;      // the window is drained, nothing writes to the buffers anymore
+    }
+
+    free(buffers);
+    return !unsupported;
+}
+
+
+
+// ==== Interface ====
+
+bool stat_batch(const char* const* paths, size_t count, StatBatch* batch, unsigned int threads)
+{
+    memset(batch, 0, sizeof(StatBatch));
+    if(paths == NULL || count == 0) return true;
+
+    batch->count = count;
+    batch->mtime = (uint64_t*)calloc(count, sizeof(uint64_t));
+    batch->size = (uint64_t*)calloc(count, sizeof(uint64_t));
+    batch->inode = (uint64_t*)calloc(count, sizeof(uint64_t));
+    batch->type = (uint8_t*)calloc(count, sizeof(uint8_t));
+    if(batch->mtime == NULL || batch->size == NULL || batch->inode == NULL || batch->type == NULL)
+    {
+        free_stat_batch(batch);
+        return false;
+    }
+
+    if(count <= STAT_INLINE_LIMIT)
+    {
+        for(size_t index = 0; index < count; index++) stat_one(paths, batch, index);
+        return true;
+    }
+
+    StatRing ring;
+    if(open_ring(&ring))
+    {
+        bool done = ring_stat(&ring, paths, batch);
+        close_ring(&ring);
+        if(done) return true;
+        memset(batch->type, FILE_TYPE_NONE, count);
+    }
+
+    StatJob job = {paths, batch};
+    run_parallel((count + FALLBACK_CHUNK - 1) / FALLBACK_CHUNK, threads, stat_task, &job);
+    return true;
+}
+
+
+void free_stat_batch(StatBatch* batch)
+{
+    free(batch->mtime);
+    free(batch->size);
+    free(batch->inode);
+    free(batch->type);
+    memset(batch, 0, sizeof(StatBatch));
+}
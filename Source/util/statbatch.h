@@ -0,0 +1,33 @@
+#pragma once
+// Statbatch stats many paths at once. Requests are queued on an
+// io_uring (IORING_OP_STATX) when the kernel allows it, and spread
+// over a few threads calling statx() otherwise.
+// Results come back as parallel arrays, one slot per path.
+
+#include "../global.h"
+#include "platform.h"
+
+#include <stdint.h>
+
+
+#define STAT_RING_ENTRIES 256   // submission queue depth, also the statx buffers kept in flight
+#define STAT_INLINE_LIMIT 32    // smaller batches are stated in the calling thread
+
+typedef struct
+{
+    size_t count;
+    uint64_t* mtime;        // nanoseconds since the epoch
+    uint64_t* size;
+    uint64_t* inode;
+    uint8_t* type;          // fileType, FILE_TYPE_NONE when the path does not exist
+} StatBatch;
+
+
+
+// ==== Interface ====
+
+//* Stat <count> paths (symlinks followed), using <threads> threads for the fallback
+//* (0 = one per processor) -> false on allocation failure
+bool stat_batch(const char* const* paths, size_t count, StatBatch* batch, unsigned int threads);
+//* Release the result arrays
+void free_stat_batch(StatBatch* batch);
@@ -1,28 +1,31 @@
-#pragma once
-// Deals with printing and parsing things to a from the terminal
-
-#include "../global.h"
-
-
-typedef 
-struct Config{
-    const char **flows; // list of <const char[]> to run
-    size_t flow_count;
-    bool help;
-    bool doConfig;
-    char *statuses; //single character array
-    bool clear;
-    bool atomic;
-    bool verbose;
-    char parse; // d: default, s: static, e: emit
-    const char **defines; // array of "key=value" strings
-    size_t define_count;
-    unsigned int jobs;
-    const char *inputFile;
-}Config;
-
-
-const Config* parse_settings(int argc, const char* const argv[]);
-void clear_config();
-
+#pragma once
+// Deals with printing and parsing things to a from the terminal
+
+#include "../global.h"
+
+
+typedef 
+struct Config{
+    const char **flows; // list of <const char[]> to run
+    size_t flow_count;
+    bool help;
+    bool doConfig;
+    char *statuses; //single character array
+    bool clear;
+    bool atomic;
+    bool verbose;
+    char parse; // d: default, s: static, e: emit
+    const char **defines; // array of "key=value" strings
+    size_t define_count;
+    unsigned int jobs;
+    bool autoJobs; // -j auto: follow the host load, up to <jobs>
+    const char *inputFile;
+    const char *serveCache; // socket to serve artifacts on, NULL to build
+    const char *traceFile;  // Chrome trace of the build, NULL for none
+}Config;
+
+
+const Config* parse_settings(int argc, const char* const argv[]);
+void clear_config();
+
 void print_help();
\ No newline at end of file
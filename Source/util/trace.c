@@ -0,0 +1,237 @@
+#include "trace.h"
+
+#include "log.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+#define TRACE_EVENTS_MIN 1024   // initial event capacity
+
+typedef struct
+{
+    char phase;         // 'X' slice, 'C' counter, 'M' track name
+    uint32_t track;
+    uint64_t begin;     // monotonic ns
+    uint64_t end;
+    int64_t value;      // counters only
+    char* name;
+    char* category;     // may be NULL
+    char* args;         // may be NULL
+} TraceEvent;
+
+typedef struct
+{
+    char* filePath;
+    uint64_t epoch;         // monotonic ns at open_trace(), time 0 of the timeline
+    atomic_bool enabled;
+
+    TraceEvent* events;
+    size_t count;
+    size_t capacity;
+
+    pthread_mutex_t lock;   // events come from the main thread and worker callbacks
+} TraceLog;
+
+
+// ==== Static variables ====
+
+static TraceLog trace = (TraceLog)
+{
+    .filePath = NULL,
+    .epoch = 0,
+    .enabled = false,
+    .events = NULL,
+    .count = 0,
+    .capacity = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+// ==== Internal Helpers ====
+
+//* Copy of <text>, NULL stays NULL
+static char* copy_text(const char* text)
+{
+    return text != NULL ? strdup(text) : NULL;
+}
+
+//* Append <event>, taking its strings -> false if it was dropped
+static bool add_event(TraceEvent event)
+{
+    pthread_mutex_lock(&trace.lock);
+    if(trace.count == trace.capacity)
+    {
+        size_t capacity = trace.capacity ? trace.capacity * 2 : TRACE_EVENTS_MIN;
+        TraceEvent* grown = (TraceEvent*)realloc(trace.events, capacity * sizeof(TraceEvent));
+        if(grown == NULL)
+        {
+            pthread_mutex_unlock(&trace.lock);
+            free(event.name);
+            free(event.category);
+            free(event.args);
+            return false;
+        }
+        trace.events = grown;
+        trace.capacity = capacity;
+    }
+    trace.events[trace.count++] = event;
+    pthread_mutex_unlock(&trace.lock);
+    return true;
+}
+
+//* Microseconds from the epoch, as the format expects
+static double trace_time(uint64_t timestamp)
+{
+    if(timestamp < trace.epoch) return 0.0;
+    return (double)(timestamp - trace.epoch) / 1000.0;
+}
+
+//* Write <text> as a JSON string
+static void write_string(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for(const unsigned char* c = (const unsigned char*)text; *c != '\0'; c++)
+    {
+        if(*c == '"' || *c == '\\') fprintf(file, "\\%c", *c);
+        else if(*c < 0x20) fprintf(file, "\\u%04x", *c);
+        else fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+static void write_event(FILE* file, const TraceEvent* event)
+{
+    fprintf(file, "{\"ph\": \"%c\", \"pid\": %d, \"tid\": %u, \"name\": ", event->phase, TRACE_PROCESS, event->track);
+    write_string(file, event->name);
+    switch(event->phase)
+    {
+    case 'M':
+        fprintf(file, ", \"args\": {\"name\": ");
+        write_string(file, event->args);
+        fputc('}', file);
+        break;
+    case 'C':
+        fprintf(file, ", \"ts\": %.3f, \"args\": {\"value\": %jd}", trace_time(event->begin), (intmax_t)event->value);
+        break;
+    default:
+        if(event->category != NULL)
+        {
+            fprintf(file, ", \"cat\": ");
+            write_string(file, event->category);
+        }
+        fprintf(file, ", \"ts\": %.3f, \"dur\": %.3f", trace_time(event->begin),
+                event->end > event->begin ? (double)(event->end - event->begin) / 1000.0 : 0.0);
+        if(event->args != NULL) fprintf(file, ", \"args\": {%s}", event->args);
+        break;
+    }
+    fputc('}', file);
+}
+
+static void free_events(void)
+{
+    for(size_t index = 0; index < trace.count; index++)
+    {
+        free(trace.events[index].name);
+        free(trace.events[index].category);
+        free(trace.events[index].args);
+    }
+    free(trace.events);
+    trace.events = NULL;
+    trace.count = 0;
+    trace.capacity = 0;
+}
+
+
+
+// ==== Interface ====
+
+bool open_trace(const char* path)
+{
+    if(path == NULL) return false;
+
+    FILE* file = fopen(path, "w");  // fail now rather than after the build
+    if(file == NULL)
+    {
+        log_l("Could not create the trace file.", WARNING);
+        return false;
+    }
+    fclose(file);
+
+    free(trace.filePath);
+    trace.filePath = strdup(path);
+    if(trace.filePath == NULL) return false;
+    trace.epoch = monotonic_ns();
+    atomic_store(&trace.enabled, true);
+    trace_track(TRACE_FLOW_TRACK, "flows");
+    return true;
+}
+
+
+bool trace_enabled(void)
+{
+    return atomic_load_explicit(&trace.enabled, memory_order_relaxed);
+}
+
+
+void trace_track(uint32_t track, const char* name)
+{
+    if(!trace_enabled() || name == NULL) return;
+    add_event((TraceEvent){'M', track, 0, 0, 0, strdup("thread_name"), NULL, copy_text(name)});
+}
+
+
+void trace_slice(uint32_t track, const char* name, const char* category,
+                 uint64_t begin, uint64_t end, const char* args)
+{
+    if(!trace_enabled() || name == NULL) return;
+    add_event((TraceEvent){'X', track, begin, end, 0, copy_text(name), copy_text(category), copy_text(args)});
+}
+
+
+void trace_counter(const char* name, int64_t value)
+{
+    if(!trace_enabled() || name == NULL) return;
+    add_event((TraceEvent){'C', TRACE_FLOW_TRACK, monotonic_ns(), 0, value, copy_text(name), NULL, NULL});
+}
+
+
+/*
+ * Events are written in the order they were recorded; viewers sort
+ * them by time. A failed allocation only loses its own event.
+*/
+bool close_trace(void)
+{
+    if(!atomic_exchange(&trace.enabled, false)) return true;
+
+    pthread_mutex_lock(&trace.lock);
+    bool written = false;
+    FILE* file = fopen(trace.filePath, "w");
+    if(file != NULL)
+    {
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for(size_t index = 0; index < trace.count; index++)
+        {
+            const TraceEvent* event = &trace.events[index];
+            if(event->name == NULL || (event->phase == 'M' && event->args == NULL)) continue;
+            if(!first) fprintf(file, ",\n");
+            write_event(file, event);
+            first = false;
+        }
+        fprintf(file, "\n]}\n");
+        written = fclose(file) == 0;
+    }
+    if(!written) log_l("Could not write the trace file.", WARNING);
+
+    free_events();
+    free(trace.filePath);
+    trace.filePath = NULL;
+    pthread_mutex_unlock(&trace.lock);
+    return written;
+}
@@ -0,0 +1,34 @@
+#pragma once
+// Trace records a timeline of the build and writes it as Chrome
+// Trace Event JSON, readable by chrome://tracing and Perfetto.
+// Events are kept in memory and written once, on close_trace().
+
+#include "../global.h"
+
+#include <stdint.h>
+
+
+#define TRACE_PROCESS 1         // pid of every event, the timeline shows a single process
+#define TRACE_FLOW_TRACK 0      // track of the flow spans, workers follow from 1
+#define TRACE_PIPE_TRACK 1000   // first track of the pipe spans, one per pipe
+
+
+
+// ==== Interface ====
+
+//* Start recording, written to <path> by close_trace() -> false if it can't be created
+bool open_trace(const char* path);
+//* Weather events are recorded
+bool trace_enabled(void);
+
+//* Name the track <track>
+void trace_track(uint32_t track, const char* name);
+//* Record a slice on <track> from <begin> to <end> (monotonic ns).
+//* <args> is NULL or the members of a JSON object, e.g. "\"exit\": 0".
+void trace_slice(uint32_t track, const char* name, const char* category,
+                 uint64_t begin, uint64_t end, const char* args);
+//* Record the value of the counter <name> now
+void trace_counter(const char* name, int64_t value);
+
+//* Write the trace file and stop recording -> false if it could not be written
+bool close_trace(void);
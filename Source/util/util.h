@@ -1,9 +1,13 @@
-#pragma once
-
-#define UTIL_PUBLIC
-
-#include "terminal.h"        // to interface with the CLI (options parsing, ...)
-#include "log.h"        // to log the process
-#include "platform.h"   // to have platform-(in)dependent code
-
-#undef UTIL_PUBLIC
+#pragma once
+
+#define UTIL_PUBLIC
+
+#include "terminal.h"        // to interface with the CLI (options parsing, ...)
+#include "log.h"        // to log the process
+#include "platform.h"   // to have platform-(in)dependent code
+#include "arena.h"      // to allocate short-lived memory in bulk
+#include "hash.h"       // to fingerprint files and keys
+#include "path.h"       // to intern canonical paths as ids
+#include "trace.h"      // to record a timeline of the build
+
+#undef UTIL_PUBLIC
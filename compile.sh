@@ -5,33 +5,81 @@ mkdir -p Build/objects 2>/dev/null
 
 # execute
 mkdir -p Build/objects/execute 2>/dev/null
+gcc -c Source/execute/command.c -o Build/objects/execute/command.o
 gcc -c Source/execute/scheduler.c -o Build/objects/execute/scheduler.o
 gcc -c Source/execute/worker.c -o Build/objects/execute/worker.o
 gcc -c Source/execute/shell.c -o Build/objects/execute/shell.o
+gcc -c Source/execute/throttle.c -o Build/objects/execute/throttle.o
+gcc -c Source/execute/cgroup.c -o Build/objects/execute/cgroup.o
 
 # load
-# mkdir -p Build/objects/load 2>/dev/null
-# gcc -c Source/load/cache.c -o Build/objects/load/cache.o
+mkdir -p Build/objects/load 2>/dev/null
+gcc -c Source/load/cache.c -o Build/objects/load/cache.o
+gcc -c Source/load/glob.c -o Build/objects/load/glob.o
+gcc -c Source/load/hasher.c -o Build/objects/load/hasher.o
+gcc -c Source/load/history.c -o Build/objects/load/history.o
+gcc -c Source/load/listing.c -o Build/objects/load/listing.o
+gcc -c Source/load/remote.c -o Build/objects/load/remote.o
+gcc -c Source/load/store.c -o Build/objects/load/store.o
+gcc -c Source/load/timing.c -o Build/objects/load/timing.o
 
 # process
+mkdir -p Build/objects/process 2>/dev/null
+gcc -c Source/process/plan.c -o Build/objects/process/plan.o
+gcc -c Source/process/run.c -o Build/objects/process/run.o
 
 # read
+mkdir -p Build/objects/read 2>/dev/null
+gcc -c Source/read/config.c -o Build/objects/read/config.o
+gcc -c Source/read/image.c -o Build/objects/read/image.o
+gcc -c Source/read/lexer.c -o Build/objects/read/lexer.o
+gcc -c Source/read/parser.c -o Build/objects/read/parser.o
 
 # util
 mkdir -p Build/objects/util 2>/dev/null
+gcc -c Source/util/arena.c -o Build/objects/util/arena.o
+gcc -c Source/util/hash.c -o Build/objects/util/hash.o
 gcc -c Source/util/log.c -o Build/objects/util/log.o
+gcc -c Source/util/path.c -o Build/objects/util/path.o
 gcc -c Source/util/platform.c -o Build/objects/util/platform.o
+gcc -c Source/util/pool.c -o Build/objects/util/pool.o
+gcc -c Source/util/statbatch.c -o Build/objects/util/statbatch.o
 gcc -c Source/util/terminal.c -o Build/objects/util/terminal.o
+gcc -c Source/util/trace.c -o Build/objects/util/trace.o
 
 # main
 gcc -c Source/main.c -o Build/objects/main.o
 
 gcc \
+Build/objects/execute/command.o \
 Build/objects/execute/scheduler.o \
 Build/objects/execute/worker.o \
 Build/objects/execute/shell.o \
+Build/objects/execute/throttle.o \
+Build/objects/execute/cgroup.o \
+Build/objects/load/cache.o \
+Build/objects/load/glob.o \
+Build/objects/load/hasher.o \
+Build/objects/load/history.o \
+Build/objects/load/listing.o \
+Build/objects/load/remote.o \
+Build/objects/load/store.o \
+Build/objects/load/timing.o \
+Build/objects/process/plan.o \
+Build/objects/process/run.o \
+Build/objects/read/config.o \
+Build/objects/read/image.o \
+Build/objects/read/lexer.o \
+Build/objects/read/parser.o \
+Build/objects/util/arena.o \
+Build/objects/util/hash.o \
 Build/objects/util/log.o \
+Build/objects/util/path.o \
 Build/objects/util/platform.o \
+Build/objects/util/pool.o \
+Build/objects/util/statbatch.o \
 Build/objects/util/terminal.o \
+Build/objects/util/trace.o \
 Build/objects/main.o \
+-lz \
 -o Build/pipe
\ No newline at end of file